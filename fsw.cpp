@@ -18,7 +18,11 @@
 #  include "config.h"
 #endif
 #include "fsw.h"
+#include "fsw_exec.h"
 #include "fsw_log.h"
+#include "fsw_output.h"
+#include "fsw_relay.h"
+#include "fsw_serve.h"
 #include <iostream>
 #include <sstream>
 #include <csignal>
@@ -26,8 +30,19 @@
 #include <cmath>
 #include <ctime>
 #include <cerrno>
+#include <cctype>
+#include <climits>
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <unistd.h>
+#include <pthread.h>
+#include <memory>
 #include <vector>
 #include "libfsw/c++/monitor.h"
+#include "libfsw/c++/event_log.h"
+#include "libfsw/c++/replay_monitor.h"
+#include "libfsw/c++/shm_ring.h"
 
 #ifdef HAVE_GETOPT_LONG
 #  include <getopt.h>
@@ -38,6 +53,7 @@ using namespace std;
 static const unsigned int TIME_FORMAT_BUFF_SIZE = 128;
 
 static fsw::monitor *active_monitor = nullptr;
+static pthread_t main_thread;
 static vector<monitor_filter> filters;
 static bool _0flag = false;
 static bool _1flag = false;
@@ -56,7 +72,95 @@ static bool uflag = false;
 static bool vflag = false;
 static bool xflag = false;
 static double lvalue = 1.0;
+static double debounce_value = 0.0;
+static double throttle_value = 0.0;
+static double settle_value = 0.0;
+static unsigned int debounce_depth = 0;
 static string tformat = "%c";
+static string shm_name;
+static string exec_command;
+static bool exec_flag = false;
+static bool exec_options_flag = false;
+static double exec_debounce = 0.0;
+static unsigned int exec_jobs = 1;
+static exec_paths_mode exec_paths = exec_paths_none;
+static command_runner * runner = nullptr;
+static string record_path;
+static bool replay_flag = false;
+static double replay_speed = 1.0;
+static string serve_path;
+static double serve_idle = 30.0;
+static event_server * server = nullptr;
+static string relay_url;
+static bool relay_compress = false;
+static event_relay * relay = nullptr;
+static string aggregate_url;
+
+enum output_format
+{
+  text_format = 0,
+  json_format,
+  binary_format
+};
+
+static output_format format = text_format;
+
+/*
+ * A --printf template is compiled once into a list of instructions, each of
+ * which copies a literal or prints a field of the event.
+ */
+enum printf_field
+{
+  printf_literal = 0,
+  printf_path,
+  printf_relative_path,
+  printf_basename,
+  printf_flags,
+  printf_mask,
+  printf_time,
+  printf_time_ns,
+  printf_sequence
+};
+
+typedef struct printf_instruction
+{
+  printf_field field;
+  string literal;
+} printf_instruction;
+
+static bool printf_flag = false;
+static vector<printf_instruction> printf_template;
+static vector<string> root_paths;
+static output_buffer output(STDOUT_FILENO);
+static unique_ptr<fsw::shm_ring_writer> shm_writer;
+static unique_ptr<fsw::event_log_writer> recorder;
+
+/*
+ * Options without a short equivalent.
+ */
+enum long_option
+{
+  AGGREGATE_OPTION = 256,
+  DEBOUNCE_OPTION,
+  DEBOUNCE_DEPTH_OPTION,
+  EXEC_OPTION,
+  EXEC_DEBOUNCE_OPTION,
+  EXEC_JOBS_OPTION,
+  EXEC_PATHS_OPTION,
+  FLUSH_OPTION,
+  FORMAT_OPTION,
+  PRINTF_OPTION,
+  RECORD_OPTION,
+  RELAY_OPTION,
+  RELAY_COMPRESS_OPTION,
+  REPLAY_OPTION,
+  REPLAY_SPEED_OPTION,
+  SERVE_OPTION,
+  SERVE_IDLE_OPTION,
+  SETTLE_OPTION,
+  SHM_OPTION,
+  THROTTLE_OPTION
+};
 
 bool is_verbose()
 {
@@ -75,12 +179,33 @@ static void usage(ostream& stream)
     << " -0, --print0          Use the ASCII NUL character (0) as line separator.\n";
   stream
     << " -1, --one-event       Exit fsw after the first set of events is received.\n";
+  stream << "     --aggregate=URL   Print the events received from relays connecting\n";
+  stream << "                       to tcp://[host]:port instead of watching paths.\n";
+  stream << "     --debounce=DOUBLE Print the events of a path once it has not changed\n";
+  stream << "                       for the specified number of seconds.\n";
+  stream << "     --debounce-depth=N\n";
+  stream << "                       Debounce and throttle per subtree of N path\n";
+  stream << "                       components instead of per path.\n";
 #  ifdef HAVE_REGCOMP
   stream << " -e, --exclude=REGEX   Exclude paths matching REGEX.\n";
   stream << " -E, --extended        Use extended regular expressions.\n";
 #  endif
+  stream << "     --exec=COMMAND    Run COMMAND when events are received instead of\n";
+  stream << "                       printing them.\n";
+  stream << "     --exec-debounce=DOUBLE\n";
+  stream << "                       Run the command once no event has been received\n";
+  stream << "                       for the specified number of seconds.\n";
+  stream << "     --exec-jobs=N     Run at most N commands at the same time.\n";
+  stream << "     --exec-paths=MODE Pass the changed paths to the command: none (the\n";
+  stream << "                       default), on its standard input (stdin) or in the\n";
+  stream << "                       file named by $FSW_PATHS_FILE (file).\n";
+  stream << "     --format=FORMAT   Print the events as text (the default), as JSON\n";
+  stream << "                       Lines (json) or as binary records (binary).\n";
   stream
     << " -f, --format-time     Print the event time using the specified format.\n";
+  stream << "     --flush=POLICY    Write the events after every batch (batch, the\n";
+  stream << "                       default), after every event (event) or once at\n";
+  stream << "                       least the specified number of bytes is pending.\n";
   stream << " -h, --help            Show this message.\n";
 #  ifdef HAVE_REGCOMP
   stream << " -i, --include=REGEX   Include paths matching REGEX.\n";
@@ -93,8 +218,30 @@ static void usage(ostream& stream)
   stream << " -o, --one-per-batch   Print a single message with the number of change events.\n";
   stream << "                       in the current batch.\n";
   stream << " -p, --poll            Use the poll monitor.\n";
+  stream << "     --printf=TEMPLATE Print the events using the specified template.\n";
   stream << " -r, --recursive       Recurse subdirectories.\n";
+  stream << "     --record=FILE     Record the events into the event log FILE instead\n";
+  stream << "                       of printing them.\n";
+  stream << "     --relay=URL       Send the events to the aggregator listening on\n";
+  stream << "                       tcp://host:port instead of printing them.\n";
+  stream << "     --relay-compress  Compress the events sent to the aggregator.\n";
+  stream << "     --replay          Replay the events of the event logs given as paths\n";
+  stream << "                       instead of watching them.\n";
+  stream << "     --replay-speed=DOUBLE\n";
+  stream << "                       Replay the events faster by the specified factor,\n";
+  stream << "                       or as fast as possible if 0.\n";
+  stream << "     --serve=SOCKET    Serve the events of the paths requested by the\n";
+  stream << "                       clients of the Unix domain socket SOCKET.\n";
+  stream << "     --serve-idle=DOUBLE\n";
+  stream << "                       Release a monitor once it has had no client for\n";
+  stream << "                       the specified number of seconds.\n";
+  stream << "     --settle=DOUBLE   Print a Settled event once no change has been\n";
+  stream << "                       observed for the specified number of seconds.\n";
+  stream << "     --shm=NAME        Publish the events into the shared memory ring NAME\n";
+  stream << "                       instead of printing them.\n";
   stream << " -t, --timestamp       Print the event timestamp.\n";
+  stream << "     --throttle=DOUBLE Print the first event of a path and suppress the\n";
+  stream << "                       following ones for the specified number of seconds.\n";
   stream << " -u, --utc-time        Print the event time as UTC time.\n";
   stream << " -v, --verbose         Print verbose output.\n";
   stream << " -x, --event-flags     Print the event flags.\n";
@@ -159,10 +306,23 @@ static void close_stream()
 
     active_monitor = nullptr;
   }
+
+  if (server) ::unlink(server->get_socket_path().c_str());
+
+  cout.flush();
+  output.flush();
 }
 
 static void close_handler(int signal)
 {
+  // The signal may be delivered to a thread of the monitor, which cannot
+  // delete the monitor it belongs to: let the main thread handle it.
+  if (!pthread_equal(pthread_self(), main_thread))
+  {
+    pthread_kill(main_thread, signal);
+    return;
+  }
+
   close_stream();
 
   fsw_log("Done.\n");
@@ -191,8 +351,25 @@ static bool validate_latency(double latency, ostream &ost, ostream &est)
   return true;
 }
 
+static double parse_non_negative(const char * option, const char * value)
+{
+  char * end;
+  errno = 0;
+  double number = strtod(value, &end);
+
+  if (end == value || *end != '\0' || number < 0 || errno == ERANGE)
+  {
+    cerr << "Invalid value for " << option << ": " << value << endl;
+    exit(FSW_EXIT_OPT);
+  }
+
+  return number;
+}
+
 static void register_signal_handlers()
 {
+  main_thread = pthread_self();
+
   struct sigaction action;
   action.sa_handler = close_handler;
   sigemptyset(&action.sa_mask);
@@ -226,120 +403,460 @@ static void register_signal_handlers()
   }
 }
 
-static vector<string> decode_event_flag_name(vector<fsw_event_flag> flags)
+typedef struct fsw_event_flag_name
+{
+  fsw_event_flag flag;
+  const char * name;
+} fsw_event_flag_name;
+
+static const fsw_event_flag_name event_flag_names[] = {
+  {fsw_event_flag::PlatformSpecific, "PlatformSpecific"},
+  {fsw_event_flag::Created, "Created"},
+  {fsw_event_flag::Updated, "Updated"},
+  {fsw_event_flag::Removed, "Removed"},
+  {fsw_event_flag::Renamed, "Renamed"},
+  {fsw_event_flag::OwnerModified, "OwnerModified"},
+  {fsw_event_flag::AttributeModified, "AttributeModified"},
+  {fsw_event_flag::IsFile, "IsFile"},
+  {fsw_event_flag::IsDir, "IsDir"},
+  {fsw_event_flag::IsSymLink, "IsSymLink"},
+  {fsw_event_flag::Link, "Link"},
+  {fsw_event_flag::Overflow, "Overflow"},
+  {fsw_event_flag::Settled, "Settled"}
+};
+
+/*
+ * strftime(3) has no conversion for fractions of a second.  The time format
+ * is split once at every %N, replaced by the nanoseconds of the event time,
+ * and at every %<digits>N, replaced by its first <digits> fractional digits
+ * (e.g. %3N for milliseconds).  The parts in between are formatted by
+ * strftime only when the second of the event time changes, since events
+ * mostly come in bursts sharing the same second, while the fractional
+ * digits are appended to them for every event.
+ */
+typedef struct time_format_part
+{
+  string format;
+  size_t fraction_digits;
+} time_format_part;
+
+static vector<time_format_part> time_format_parts;
+static vector<string> formatted_time_parts;
+static size_t formatted_time_length = 0;
+static time_t formatted_time = 0;
+static bool formatted_time_valid = false;
+
+static void compile_time_format(const string &format)
 {
-  vector<string> names;
+  time_format_parts.clear();
+  formatted_time_valid = false;
 
-  for (fsw_event_flag flag : flags)
+  string part;
+
+  for (size_t i = 0; i < format.length(); ++i)
   {
-    switch (flag)
+    if (format[i] != '%' || i + 1 == format.length())
     {
-    case fsw_event_flag::PlatformSpecific:
-      names.push_back("PlatformSpecific");
-      break;
-    case fsw_event_flag::Created:
-      names.push_back("Created");
-      break;
-    case fsw_event_flag::Updated:
-      names.push_back("Updated");
+      part += format[i];
+      continue;
+    }
+
+    size_t j = i + 1;
+    size_t width = 0;
+
+    while (j < format.length() && isdigit(format[j]))
+    {
+      width = width * 10 + (format[j] - '0');
+      ++j;
+    }
+
+    if (j < format.length() && format[j] == 'N')
+    {
+      if (width == 0 || width > 9) width = 9;
+
+      time_format_parts.push_back({part, width});
+      part.clear();
+      i = j;
+    }
+    else
+    {
+      // Copy the conversion (including %%) and let strftime handle it.
+      part += format[i];
+      part += format[i + 1];
+      ++i;
+    }
+  }
+
+  time_format_parts.push_back({part, 0});
+}
+
+static void format_time_parts(const time_t &evt_time)
+{
+  char time_format_buffer[4096];
+  struct tm * tm_time = uflag ? gmtime(&evt_time) : localtime(&evt_time);
+
+  formatted_time_parts.resize(time_format_parts.size());
+  formatted_time_length = 0;
+
+  for (size_t i = 0; i < time_format_parts.size(); ++i)
+  {
+    const size_t length = strftime(time_format_buffer,
+                                   sizeof (time_format_buffer),
+                                   time_format_parts[i].format.c_str(),
+                                   tm_time);
+
+    formatted_time_parts[i].assign(time_format_buffer, length);
+    formatted_time_length += length + time_format_parts[i].fraction_digits;
+  }
+
+  formatted_time = evt_time;
+  formatted_time_valid = true;
+}
+
+static void append_event_time(const time_t &evt_time, uint64_t evt_time_ns)
+{
+  if (!formatted_time_valid || evt_time != formatted_time)
+    format_time_parts(evt_time);
+
+  // Same limits as formatting the whole time with strftime in a buffer of
+  // TIME_FORMAT_BUFF_SIZE characters.
+  if (formatted_time_length == 0 || formatted_time_length >= TIME_FORMAT_BUFF_SIZE)
+  {
+    output.append("<date format error>");
+    return;
+  }
+
+  char digits[9];
+  uint64_t nsec = evt_time_ns % 1000000000ULL;
+
+  for (int i = 8; i >= 0; --i, nsec /= 10)
+    digits[i] = '0' + nsec % 10;
+
+  for (size_t i = 0; i < time_format_parts.size(); ++i)
+  {
+    output.append(formatted_time_parts[i]);
+    output.append(digits, time_format_parts[i].fraction_digits);
+  }
+}
+
+static void print_event_timestamp(const time_t &evt_time, uint64_t evt_time_ns)
+{
+  append_event_time(evt_time, evt_time_ns);
+  output.append(' ');
+}
+
+/*
+ * Print the names of the flags, each preceded by separator except the first
+ * one if separate_first is false.
+ */
+static void append_flag_names(uint32_t flags, bool separate_first)
+{
+  uint32_t known_flags = 0;
+  bool separate = separate_first;
+
+  for (const fsw_event_flag_name &flag_name : event_flag_names)
+  {
+    known_flags |= flag_name.flag;
+
+    if (flags & flag_name.flag)
+    {
+      if (separate) output.append(' ');
+      output.append(flag_name.name);
+      separate = true;
+    }
+  }
+
+  if (flags & ~known_flags)
+  {
+    if (separate) output.append(' ');
+    output.append("<Unknown>");
+  }
+}
+
+static void print_event_flags(uint32_t flags)
+{
+  if (nflag)
+  {
+    output.append(' ');
+    output.append_uint(flags);
+  }
+  else
+  {
+    append_flag_names(flags, true);
+  }
+}
+
+static void compile_printf_template(const char * text)
+{
+  string literal;
+
+  auto add = [&literal](printf_field field)
+  {
+    if (!literal.empty())
+    {
+      printf_template.push_back({printf_literal, literal});
+      literal.clear();
+    }
+
+    if (field != printf_literal) printf_template.push_back({field, ""});
+  };
+
+  for (const char * c = text; *c; ++c)
+  {
+    if (*c == '\\' && c[1])
+    {
+      switch (*++c)
+      {
+      case 'n': literal += '\n';
+        break;
+      case 't': literal += '\t';
+        break;
+      case '0': literal += '\0';
+        break;
+      case '\\': literal += '\\';
+        break;
+      default:
+        literal += '\\';
+        literal += *c;
+      }
+
+      continue;
+    }
+
+    if (*c != '%')
+    {
+      literal += *c;
+      continue;
+    }
+
+    switch (*++c)
+    {
+    case '%': literal += '%';
       break;
-    case fsw_event_flag::Removed:
-      names.push_back("Removed");
+    case 'p': add(printf_path);
       break;
-    case fsw_event_flag::Renamed:
-      names.push_back("Renamed");
+    case 'r': add(printf_relative_path);
       break;
-    case fsw_event_flag::OwnerModified:
-      names.push_back("OwnerModified");
+    case 'b': add(printf_basename);
       break;
-    case fsw_event_flag::AttributeModified:
-      names.push_back("AttributeModified");
+    case 'f': add(printf_flags);
       break;
-    case fsw_event_flag::IsFile:
-      names.push_back("IsFile");
+    case 'm': add(printf_mask);
       break;
-    case fsw_event_flag::IsDir:
-      names.push_back("IsDir");
+    case 't': add(printf_time);
       break;
-    case fsw_event_flag::IsSymLink:
-      names.push_back("IsSymLink");
+    case 'T': add(printf_time_ns);
       break;
-    case fsw_event_flag::Link:
-      names.push_back("Link");
+    case 's': add(printf_sequence);
       break;
     default:
-      names.push_back("<Unknown>");
-      break;
+      cerr << "Invalid directive in --printf template: %" << (*c ? string(1, *c) : string()) << endl;
+      exit(FSW_EXIT_OPT);
     }
   }
 
-  return names;
+  add(printf_literal);
 }
 
-static void print_event_timestamp(const time_t &evt_time)
+/*
+ * Print the path relative to the longest monitored path containing it, or
+ * the whole path if there is none.
+ */
+static void append_relative_path(const char * path, size_t length)
 {
-  char time_format_buffer[TIME_FORMAT_BUFF_SIZE];
-  struct tm * tm_time = uflag ? gmtime(&evt_time) : localtime(&evt_time);
+  size_t prefix = 0;
+
+  for (const string &root : root_paths)
+  {
+    const size_t root_length = root.length();
+
+    if (root_length <= prefix || root_length > length) continue;
+    if (root.compare(0, root_length, path, root_length) != 0) continue;
+
+    if (root_length == length || root[root_length - 1] == '/')
+      prefix = root_length;
+    else if (path[root_length] == '/')
+      prefix = root_length + 1;
+  }
+
+  output.append(path + prefix, length - prefix);
+}
 
-  string date =
-    strftime(
-             time_format_buffer,
-             TIME_FORMAT_BUFF_SIZE,
-             tformat.c_str(),
-             tm_time) ? string(time_format_buffer) : string("<date format error>");
+static void append_basename(const char * path, size_t length)
+{
+  size_t start = length;
 
-  cout << date << " ";
+  while (start && path[start - 1] != '/') --start;
+
+  output.append(path + start, length - start);
 }
 
-static void print_event_flags(const vector<fsw_event_flag> &flags)
+static void check_output(bool written)
 {
-  if (nflag)
+  if (written) return;
+
+  perror("write()");
+  ::_exit(FSW_EXIT_STREAM);
+}
+
+static void flush_output()
+{
+  // Messages printed with cout must precede the events printed after them.
+  cout.flush();
+  check_output(output.flush());
+}
+
+static void end_event_record()
+{
+  output.append(_0flag ? '\0' : '\n');
+  check_output(output.end_record());
+}
+
+static void write_one_batch_event(const fsw::event_batch &events)
+{
+  output.append_uint(events.size());
+  end_event_record();
+}
+
+/*
+ * JSON Lines: one object per event with its path, its flags (their names or,
+ * with -n, their numeric mask), its time in nanoseconds since the Epoch and
+ * its sequence number.  A path which is not valid UTF-8 is also printed
+ * exactly, in base64, as path_bytes.
+ */
+static void write_json_events(const fsw::event_batch &events)
+{
+  for (size_t i = 0; i < events.size(); ++i)
   {
-    int mask = 0;
-    for (const fsw_event_flag &flag : flags)
+    const fsw::compact_event evt = events[i];
+    const uint32_t flags = evt.get_flags();
+
+    output.append("{\"path\":", 8);
+
+    if (!output.append_json_string(evt.get_path(), evt.get_path_length()))
     {
-      mask += static_cast<int> (flag);
+      output.append(",\"path_bytes\":\"", 15);
+      output.append_base64(evt.get_path(), evt.get_path_length());
+      output.append('"');
     }
 
-    cout << " " << mask;
-  }
-  else
-  {
-    vector<string> flag_names = decode_event_flag_name(flags);
+    output.append(",\"flags\":", 9);
 
-    for (string &name : flag_names)
+    if (nflag)
     {
-      cout << " " << name;
+      output.append_uint(flags);
     }
+    else
+    {
+      bool first = true;
+
+      output.append('[');
+
+      for (const fsw_event_flag_name &flag_name : event_flag_names)
+      {
+        if (!(flags & flag_name.flag)) continue;
+
+        if (!first) output.append(',');
+        output.append('"');
+        output.append(flag_name.name);
+        output.append('"');
+        first = false;
+      }
+
+      output.append(']');
+    }
+
+    output.append(",\"time_ns\":", 11);
+    output.append_uint(evt.get_time_ns());
+    output.append(",\"sequence\":", 12);
+    output.append_uint(evt.get_sequence());
+    output.append('}');
+
+    end_event_record();
   }
 }
 
-static void end_event_record()
+/*
+ * Binary records, all integers being little-endian:
+ *
+ *   uint32  length of the rest of the record (24 + path length)
+ *   uint64  time of the event in nanoseconds since the Epoch
+ *   uint64  sequence number
+ *   uint32  flags
+ *   uint32  path length
+ *   bytes   path, not NUL-terminated
+ */
+static void write_binary_events(const fsw::event_batch &events)
 {
-  if (_0flag)
+  for (size_t i = 0; i < events.size(); ++i)
   {
-    cout << '\0';
-    cout.flush();
-  }
-  else
-  {
-    cout << endl;
+    const fsw::compact_event evt = events[i];
+    const uint32_t path_length = evt.get_path_length();
+
+    output.append_le32(24 + path_length);
+    output.append_le64(evt.get_time_ns());
+    output.append_le64(evt.get_sequence());
+    output.append_le32(evt.get_flags());
+    output.append_le32(path_length);
+    output.append(evt.get_path(), path_length);
+
+    check_output(output.end_record());
   }
 }
 
-static void write_one_batch_event(const vector<event> &events)
+static void write_printf_events(const fsw::event_batch &events)
 {
-  cout << events.size();
-  end_event_record();
+  for (size_t i = 0; i < events.size(); ++i)
+  {
+    const fsw::compact_event evt = events[i];
+
+    for (const printf_instruction &instruction : printf_template)
+    {
+      switch (instruction.field)
+      {
+      case printf_literal:
+        output.append(instruction.literal);
+        break;
+      case printf_path:
+        output.append(evt.get_path(), evt.get_path_length());
+        break;
+      case printf_relative_path:
+        append_relative_path(evt.get_path(), evt.get_path_length());
+        break;
+      case printf_basename:
+        append_basename(evt.get_path(), evt.get_path_length());
+        break;
+      case printf_flags:
+        append_flag_names(evt.get_flags(), false);
+        break;
+      case printf_mask:
+        output.append_uint(evt.get_flags());
+        break;
+      case printf_time:
+        append_event_time(evt.get_time(), evt.get_time_ns());
+        break;
+      case printf_time_ns:
+        output.append_uint(evt.get_time_ns());
+        break;
+      case printf_sequence:
+        output.append_uint(evt.get_sequence());
+        break;
+      }
+    }
+
+    check_output(output.end_record());
+  }
 }
 
-static void write_events(const vector<event> &events)
+static void write_events(const fsw::event_batch &events)
 {
-  for (const event &evt : events)
+  for (size_t i = 0; i < events.size(); ++i)
   {
-    if (tflag) print_event_timestamp(evt.get_time());
+    const fsw::compact_event evt = events[i];
+
+    if (tflag) print_event_timestamp(evt.get_time(), evt.get_time_ns());
 
-    cout << evt.get_path();
+    output.append(evt.get_path(), evt.get_path_length());
 
     if (xflag)
     {
@@ -348,54 +865,111 @@ static void write_events(const vector<event> &events)
 
     end_event_record();
   }
+}
 
-  if (_1flag)
-  {
+/*
+ * With -1, stops the monitor once the first batch has been processed: fsw
+ * exits when start() returns, after the last runs of the command have
+ * finished and the aggregator has received the batch.  The callback may run
+ * on a thread of the monitor (e.g. when debouncing), which must not call
+ * exit(): close_stream() would delete the monitor, which joins that thread.
+ * The aggregator has no monitor and runs the callback on the main thread.
+ */
+static bool one_event_processed = false;
+
+static void stop_after_one_event()
+{
+  one_event_processed = true;
+
+  if (active_monitor)
+    active_monitor->stop();
+  else
     ::exit(FSW_EXIT_OK);
-  }
 }
 
-static void process_events(const vector<event> &events, void * context)
+static void process_events(fsw::event_batch &events, void * context)
 {
+  // Batches delivered while the monitor stops are ignored.
+  if (one_event_processed) return;
+
+  if (recorder)
+  {
+    check_output(recorder->write_batch(events));
+
+    if (_1flag) stop_after_one_event();
+
+    return;
+  }
+
+  if (relay)
+  {
+    relay->send_batch(events);
+
+    if (_1flag) stop_after_one_event();
+
+    return;
+  }
+
+  if (runner)
+  {
+    runner->add_batch(events);
+
+    if (_1flag) stop_after_one_event();
+
+    return;
+  }
+
   if (oflag)
     write_one_batch_event(events);
+  else if (printf_flag)
+    write_printf_events(events);
+  else if (format == json_format)
+    write_json_events(events);
+  else if (format == binary_format)
+    write_binary_events(events);
   else
     write_events(events);
-}
-
-static void start_monitor(int argc, char ** argv, int optind)
-{
-  // parsing paths
-  vector<string> paths;
 
-  for (auto i = optind; i < argc; ++i)
+  // Whatever the flush policy, -1 exits only after the events are written.
+  if (_1flag)
   {
-    char *real_path = ::realpath(argv[i], nullptr);
-    string path(real_path ? real_path : argv[i]);
+    flush_output();
+    stop_after_one_event();
+    return;
+  }
 
-    if (real_path)
-    {
-      ::free(real_path);
-    }
+  cout.flush();
+  check_output(output.end_batch());
+}
 
-    fsw_log("Adding path: ");
-    fsw_log(path.c_str());
-    fsw_log("\n");
+/*
+ * Creates a monitor of the paths configured with the options of fsw.  The
+ * server uses it to create the monitor of every root its clients watch.
+ */
+static fsw::monitor * create_monitor(const vector<string> &paths,
+                                     bool recursive,
+                                     fsw::FSW_EVENT_BATCH_CALLBACK * callback,
+                                     void * context)
+{
+  fsw::monitor * monitor;
 
-    paths.push_back(path);
+  if (replay_flag)
+  {
+    fsw::replay_monitor * replay = new fsw::replay_monitor(paths, callback, context);
+    replay->set_speed(replay_speed);
+    monitor = replay;
   }
-
-  if (pflag)
+  else if (pflag)
   {
-    active_monitor = fsw::monitor::create_monitor(poll_monitor_type, paths, process_events);
+    monitor = fsw::monitor::create_monitor(poll_monitor_type, paths, callback, context);
   }
   else if (kflag)
   {
-    active_monitor = fsw::monitor::create_monitor(kqueue_monitor_type, paths, process_events);
+    monitor = fsw::monitor::create_monitor(kqueue_monitor_type, paths, callback, context);
   }
   else
   {
-    active_monitor = fsw::monitor::create_default_monitor(paths, process_events);
+    monitor = fsw::monitor::create_default_monitor(paths, callback, context);
   }
 
   /* 
@@ -410,11 +984,120 @@ static void start_monitor(int argc, char ** argv, int optind)
     filter.extended = Eflag;
   }
 
-  active_monitor->set_latency(lvalue);
-  active_monitor->set_recursive(rflag);
-  active_monitor->set_filters(filters);
-  active_monitor->set_follow_symlinks(Lflag);
+  monitor->set_latency(lvalue);
+  monitor->set_recursive(recursive);
+  monitor->set_filters(filters);
+  monitor->set_follow_symlinks(Lflag);
+  monitor->set_debounce(debounce_value);
+  monitor->set_throttle(throttle_value);
+  monitor->set_settle_time(settle_value);
+  monitor->set_debounce_depth(debounce_depth);
+
+  return monitor;
+}
+
+static void start_server()
+{
+  // A client disconnecting while events are written must not kill fsw.
+  ::signal(SIGPIPE, SIG_IGN);
+
+  server = new event_server(serve_path, create_monitor, serve_idle);
+
+  fsw_log("Serving on: ");
+  fsw_log(serve_path.c_str());
+  fsw_log("\n");
+
+  server->run();
+}
+
+/*
+ * Sets up the destination of the events (the output by default) and returns
+ * the callback which delivers them there.
+ */
+static void open_sinks(fsw::FSW_EVENT_BATCH_CALLBACK *& callback, void *& context)
+{
+  callback = process_events;
+  context = nullptr;
+
+  if (exec_flag || !relay_url.empty())
+  {
+    // A command exiting before reading its paths, or an aggregator
+    // disconnecting, must not kill fsw.
+    ::signal(SIGPIPE, SIG_IGN);
+  }
+
+  if (exec_flag)
+  {
+    runner = new command_runner(exec_command,
+                                exec_paths,
+                                _0flag ? '\0' : '\n',
+                                exec_debounce,
+                                exec_jobs);
+  }
+
+  if (!relay_url.empty())
+  {
+    relay = new event_relay(relay_url, relay_compress);
+  }
+
+  if (!record_path.empty())
+  {
+    recorder.reset(new fsw::event_log_writer(record_path));
+  }
+
+  if (!shm_name.empty())
+  {
+    shm_writer.reset(new fsw::shm_ring_writer(shm_name));
+    callback = fsw::shm_ring_writer::publish_batch;
+    context = shm_writer.get();
+  }
+}
+
+static void start_aggregator()
+{
+  fsw::FSW_EVENT_BATCH_CALLBACK * callback;
+  void * context;
+  open_sinks(callback, context);
+
+  event_aggregator aggregator(aggregate_url, callback, context);
 
+  fsw_log("Aggregating on: ");
+  fsw_log(aggregate_url.c_str());
+  fsw_log("\n");
+
+  aggregator.run();
+}
+
+static void start_monitor(int argc, char ** argv, int optind)
+{
+  // parsing paths
+  vector<string> paths;
+
+  for (auto i = optind; i < argc; ++i)
+  {
+    char *real_path = ::realpath(argv[i], nullptr);
+    string path(real_path ? real_path : argv[i]);
+
+    if (real_path)
+    {
+      ::free(real_path);
+    }
+
+    fsw_log("Adding path: ");
+    fsw_log(path.c_str());
+    fsw_log("\n");
+
+    paths.push_back(path);
+  }
+
+  // The paths of a replay are event logs, not the roots of the events.
+  if (!replay_flag) root_paths = paths;
+
+  fsw::FSW_EVENT_BATCH_CALLBACK * callback;
+  void * context;
+  open_sinks(callback, context);
+
+  active_monitor = create_monitor(paths, rflag, callback, context);
   active_monitor->start();
 }
 
@@ -434,10 +1117,19 @@ static void parse_opts(int argc, char ** argv)
   static struct option long_options[] = {
     { "print0", no_argument, nullptr, '0'},
     { "one-event", no_argument, nullptr, '1'},
+    { "aggregate", required_argument, nullptr, AGGREGATE_OPTION},
+    { "debounce", required_argument, nullptr, DEBOUNCE_OPTION},
+    { "debounce-depth", required_argument, nullptr, DEBOUNCE_DEPTH_OPTION},
 #  ifdef HAVE_REGCOMP
     { "exclude", required_argument, nullptr, 'e'},
     { "extended", no_argument, nullptr, 'E'},
 #  endif
+    { "exec", required_argument, nullptr, EXEC_OPTION},
+    { "exec-debounce", required_argument, nullptr, EXEC_DEBOUNCE_OPTION},
+    { "exec-jobs", required_argument, nullptr, EXEC_JOBS_OPTION},
+    { "exec-paths", required_argument, nullptr, EXEC_PATHS_OPTION},
+    { "flush", required_argument, nullptr, FLUSH_OPTION},
+    { "format", required_argument, nullptr, FORMAT_OPTION},
     { "format-time", required_argument, nullptr, 'f'},
     { "help", no_argument, nullptr, 'h'},
 #  ifdef HAVE_REGCOMP
@@ -450,8 +1142,19 @@ static void parse_opts(int argc, char ** argv)
     { "numeric", no_argument, nullptr, 'n'},
     { "one-per-batch", no_argument, nullptr, 'o'},
     { "poll", no_argument, nullptr, 'p'},
+    { "printf", required_argument, nullptr, PRINTF_OPTION},
     { "recursive", no_argument, nullptr, 'r'},
+    { "record", required_argument, nullptr, RECORD_OPTION},
+    { "relay", required_argument, nullptr, RELAY_OPTION},
+    { "relay-compress", no_argument, nullptr, RELAY_COMPRESS_OPTION},
+    { "replay", no_argument, nullptr, REPLAY_OPTION},
+    { "replay-speed", required_argument, nullptr, REPLAY_SPEED_OPTION},
+    { "serve", required_argument, nullptr, SERVE_OPTION},
+    { "serve-idle", required_argument, nullptr, SERVE_IDLE_OPTION},
+    { "settle", required_argument, nullptr, SETTLE_OPTION},
+    { "shm", required_argument, nullptr, SHM_OPTION},
     { "timestamp", no_argument, nullptr, 't'},
+    { "throttle", required_argument, nullptr, THROTTLE_OPTION},
     { "utc-time", no_argument, nullptr, 'u'},
     { "verbose", no_argument, nullptr, 'v'},
     { "event-flags", no_argument, nullptr, 'x'},
@@ -560,6 +1263,169 @@ static void parse_opts(int argc, char ** argv)
       xflag = true;
       break;
 
+    case AGGREGATE_OPTION:
+      aggregate_url = optarg;
+      break;
+
+    case DEBOUNCE_OPTION:
+      debounce_value = parse_non_negative("--debounce", optarg);
+      break;
+
+    case DEBOUNCE_DEPTH_OPTION:
+    {
+      double depth = parse_non_negative("--debounce-depth", optarg);
+
+      if (depth != floor(depth) || depth > UINT_MAX)
+      {
+        cerr << "Invalid value for --debounce-depth: " << optarg << endl;
+        exit(FSW_EXIT_OPT);
+      }
+
+      debounce_depth = static_cast<unsigned int> (depth);
+      break;
+    }
+
+    case EXEC_OPTION:
+      exec_flag = true;
+      exec_command = optarg;
+      break;
+
+    case EXEC_DEBOUNCE_OPTION:
+      exec_options_flag = true;
+      exec_debounce = parse_non_negative("--exec-debounce", optarg);
+      break;
+
+    case EXEC_JOBS_OPTION:
+    {
+      exec_options_flag = true;
+      double jobs = parse_non_negative("--exec-jobs", optarg);
+
+      if (jobs < 1 || jobs != floor(jobs) || jobs > UINT_MAX)
+      {
+        cerr << "Invalid value for --exec-jobs: " << optarg << endl;
+        exit(FSW_EXIT_OPT);
+      }
+
+      exec_jobs = static_cast<unsigned int> (jobs);
+      break;
+    }
+
+    case EXEC_PATHS_OPTION:
+      exec_options_flag = true;
+
+      if (strcmp(optarg, "none") == 0)
+      {
+        exec_paths = exec_paths_none;
+      }
+      else if (strcmp(optarg, "stdin") == 0)
+      {
+        exec_paths = exec_paths_stdin;
+      }
+      else if (strcmp(optarg, "file") == 0)
+      {
+        exec_paths = exec_paths_file;
+      }
+      else
+      {
+        cerr << "Invalid value for --exec-paths: " << optarg << endl;
+        exit(FSW_EXIT_OPT);
+      }
+      break;
+
+    case SETTLE_OPTION:
+      settle_value = parse_non_negative("--settle", optarg);
+      break;
+
+    case FLUSH_OPTION:
+      if (strcmp(optarg, "batch") == 0)
+      {
+        output.set_flush_policy(flush_per_batch);
+      }
+      else if (strcmp(optarg, "event") == 0)
+      {
+        output.set_flush_policy(flush_per_event);
+      }
+      else
+      {
+        double bytes = parse_non_negative("--flush", optarg);
+
+        if (bytes != floor(bytes) || bytes > SIZE_MAX)
+        {
+          cerr << "Invalid value for --flush: " << optarg << endl;
+          exit(FSW_EXIT_OPT);
+        }
+
+        output.set_flush_policy(flush_per_bytes, static_cast<size_t> (bytes));
+      }
+      break;
+
+    case FORMAT_OPTION:
+      if (strcmp(optarg, "text") == 0)
+      {
+        format = text_format;
+      }
+      else if (strcmp(optarg, "json") == 0)
+      {
+        format = json_format;
+      }
+      else if (strcmp(optarg, "binary") == 0)
+      {
+        format = binary_format;
+      }
+      else
+      {
+        cerr << "Invalid value for --format: " << optarg << endl;
+        exit(FSW_EXIT_OPT);
+      }
+      break;
+
+    case PRINTF_OPTION:
+      printf_flag = true;
+      printf_template.clear();
+      compile_printf_template(optarg);
+      break;
+
+    case RECORD_OPTION:
+      record_path = optarg;
+      break;
+
+    case RELAY_OPTION:
+      relay_url = optarg;
+      break;
+
+    case RELAY_COMPRESS_OPTION:
+#ifdef HAVE_ZLIB
+      relay_compress = true;
+      break;
+#else
+      cerr << "--relay-compress is not supported: fsw was built without zlib." << endl;
+      ::exit(FSW_EXIT_OPT);
+#endif
+
+    case REPLAY_OPTION:
+      replay_flag = true;
+      break;
+
+    case REPLAY_SPEED_OPTION:
+      replay_speed = parse_non_negative("--replay-speed", optarg);
+      break;
+
+    case SERVE_OPTION:
+      serve_path = optarg;
+      break;
+
+    case SERVE_IDLE_OPTION:
+      serve_idle = parse_non_negative("--serve-idle", optarg);
+      break;
+
+    case SHM_OPTION:
+      shm_name = optarg;
+      break;
+
+    case THROTTLE_OPTION:
+      throttle_value = parse_non_negative("--throttle", optarg);
+      break;
+
     default:
       usage(cerr);
       exit(FSW_EXIT_UNK_OPT);
@@ -570,9 +1436,39 @@ static void parse_opts(int argc, char ** argv)
 int main(int argc, char ** argv)
 {
   parse_opts(argc, argv);
+  compile_time_format(tformat);
 
   // validate options
-  if (optind == argc)
+  if (!aggregate_url.empty())
+  {
+    if (optind != argc)
+    {
+      cerr << "--aggregate takes no path: the relays send the events." << endl;
+      ::exit(FSW_EXIT_UNK_OPT);
+    }
+
+    if (!serve_path.empty() || replay_flag)
+    {
+      cerr << "--aggregate cannot be used with --replay or --serve." << endl;
+      ::exit(FSW_EXIT_OPT);
+    }
+  }
+  else if (!serve_path.empty())
+  {
+    if (optind != argc)
+    {
+      cerr << "--serve takes no path: the clients request the paths to watch." << endl;
+      ::exit(FSW_EXIT_UNK_OPT);
+    }
+
+    if (_1flag || oflag || printf_flag || format != text_format || !shm_name.empty()
+        || exec_flag || !record_path.empty() || replay_flag)
+    {
+      cerr << "--serve cannot be used with -1, -o, --exec, --format, --printf, --record, --replay or --shm." << endl;
+      ::exit(FSW_EXIT_OPT);
+    }
+  }
+  else if (optind == argc)
   {
     cerr << "Invalid number of arguments." << endl;
     ::exit(FSW_EXIT_UNK_OPT);
@@ -585,6 +1481,72 @@ int main(int argc, char ** argv)
     ::exit(FSW_EXIT_OPT);
   }
 
+  if (replay_flag && (pflag || kflag))
+  {
+    cerr << "--replay cannot be used with -k or -p." << endl;
+    ::exit(FSW_EXIT_OPT);
+  }
+
+  if (oflag && format != text_format)
+  {
+    cerr << "-o and --format are mutually exclusive." << endl;
+    ::exit(FSW_EXIT_OPT);
+  }
+
+  if (printf_flag && (oflag || format != text_format))
+  {
+    cerr << "--printf cannot be used with -o or --format." << endl;
+    ::exit(FSW_EXIT_OPT);
+  }
+
+  if (exec_options_flag && !exec_flag)
+  {
+    cerr << "--exec-debounce, --exec-jobs and --exec-paths require --exec." << endl;
+    ::exit(FSW_EXIT_OPT);
+  }
+
+  if (exec_flag)
+  {
+    if (exec_command.find_first_not_of(" \t") == string::npos)
+    {
+      cerr << "Invalid value for --exec: " << exec_command << endl;
+      ::exit(FSW_EXIT_OPT);
+    }
+
+    if (oflag || printf_flag || format != text_format || !shm_name.empty())
+    {
+      cerr << "--exec cannot be used with -o, --format, --printf or --shm." << endl;
+      ::exit(FSW_EXIT_OPT);
+    }
+  }
+
+  if (!record_path.empty()
+      && (oflag || printf_flag || format != text_format || !shm_name.empty() || exec_flag))
+  {
+    cerr << "--record cannot be used with -o, --exec, --format, --printf or --shm." << endl;
+    ::exit(FSW_EXIT_OPT);
+  }
+
+  if (!relay_url.empty()
+      && (oflag || printf_flag || format != text_format || !shm_name.empty() || exec_flag
+          || !record_path.empty() || !serve_path.empty()))
+  {
+    cerr << "--relay cannot be used with -o, --exec, --format, --printf, --record, --serve or --shm." << endl;
+    ::exit(FSW_EXIT_OPT);
+  }
+
+  if (!shm_name.empty() && (_1flag || oflag || printf_flag || format != text_format))
+  {
+    cerr << "--shm cannot be used with -1, -o, --format or --printf." << endl;
+    ::exit(FSW_EXIT_OPT);
+  }
+
+  if (relay_compress && relay_url.empty())
+  {
+    cerr << "--relay-compress requires --relay." << endl;
+    ::exit(FSW_EXIT_OPT);
+  }
+
   // configure and start the monitor
   try
   {
@@ -593,7 +1555,17 @@ int main(int argc, char ** argv)
     ::atexit(close_stream);
 
     // configure and start the monitor loop
-    start_monitor(argc, argv, optind);
+    if (!serve_path.empty())
+      start_server();
+    else if (!aggregate_url.empty())
+      start_aggregator();
+    else
+      start_monitor(argc, argv, optind);
+
+    // A replay returns once the logs are replayed: let the last runs finish
+    // and the aggregator receive the last batches.
+    if (runner) runner->wait();
+    if (relay) relay->wait();
   }
   catch (exception & conf)
   {
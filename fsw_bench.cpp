@@ -0,0 +1,979 @@
+/* 
+ * Copyright (C) 2014, Enrico M. Crisostomo
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 3, or (at your option)
+ * any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+/*
+ * fsw-bench: end-to-end benchmark of the libfsw monitors.
+ *
+ * For every monitor and churn pattern, fsw-bench builds a synthetic tree,
+ * starts the monitor in a child process, applies the pattern to the tree and
+ * matches the events received by the monitor against the changes it made.
+ * Running the monitor in a child process lets its CPU time and peak memory
+ * be measured on their own, and the churn is generated from a seeded random
+ * number generator, so that every monitor sees the same changes.
+ *
+ * The results are printed as JSON Lines, one object per run, with:
+ *
+ *   version                 the version of fsw
+ *   monitor, pattern        the monitor and the churn pattern of the run
+ *   depth, fanout, files    the shape of the tree
+ *   seed                    the seed of the churn
+ *   changes                 the number of changes made: renames and
+ *                           checkouts change every file at most once, and
+ *                           removals remove the whole tree
+ *   events                  the number of events received after the churn
+ *                           started
+ *   missed                  the changes no event was received for
+ *   startup_ms              the time from the start of the monitor to its
+ *                           first event
+ *   churn_ms                the time taken to make the changes
+ *   events_per_second       the events received per second, from the start
+ *                           of the churn to the last event
+ *   latency_p50_ms,         the percentiles of the time from a change to the
+ *   latency_p99_ms          first event received for its path
+ *   cpu_ms                  the user and system time of the monitor
+ *   peak_rss_kb             the peak resident set size of the monitor
+ *   error                   why the run failed, if it did
+ */
+#ifdef HAVE_CONFIG_H
+#  include "config.h"
+#endif
+#include <iostream>
+#include <sstream>
+#include <algorithm>
+#include <cerrno>
+#include <cmath>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <map>
+#include <random>
+#include <string>
+#include <thread>
+#include <unordered_map>
+#include <vector>
+#include <fcntl.h>
+#include <ftw.h>
+#include <poll.h>
+#include <signal.h>
+#include <sys/resource.h>
+#include <sys/stat.h>
+#include <sys/types.h>
+#include <sys/wait.h>
+#include <unistd.h>
+#ifdef HAVE_GETOPT_LONG
+#  include <getopt.h>
+#endif
+#include "libfsw/c++/monitor.h"
+#include "libfsw/c++/event_timestamp.h"
+
+using namespace std;
+
+#define BENCH_EXIT_OK    0
+#define BENCH_EXIT_USAGE 1
+#define BENCH_EXIT_ERROR 2
+
+// Seconds a monitor is given to report its first event.
+static const int STARTUP_TIMEOUT = 30;
+
+// Files changed by the append storm.
+static const size_t HOT_FILES = 16;
+
+enum churn_pattern
+{
+  create_pattern = 0,
+  append_pattern,
+  rename_pattern,
+  remove_pattern,
+  checkout_pattern
+};
+
+struct named_pattern
+{
+  const char * name;
+  churn_pattern pattern;
+};
+
+static const named_pattern pattern_names[] = {
+  {"create", create_pattern},
+  {"append", append_pattern},
+  {"rename", rename_pattern},
+  {"remove", remove_pattern},
+  {"checkout", checkout_pattern}
+};
+
+struct named_monitor
+{
+  const char * name;
+  fsw_monitor_type type;
+};
+
+static const named_monitor monitor_names[] = {
+  {"fsevents", fsevents_monitor_type},
+  {"kqueue", kqueue_monitor_type},
+  {"inotify", inotify_monitor_type},
+  {"poll", poll_monitor_type}
+};
+
+static unsigned int depth = 2;
+static unsigned int fanout = 4;
+static unsigned int files_per_dir = 8;
+static unsigned int operations = 1000;
+static unsigned long seed = 1;
+static double latency = 1.0;
+static double settle = 2.5;
+static string base_dir;
+static vector<named_monitor> monitors;
+static vector<named_pattern> patterns;
+
+/*
+ * A change made to the tree, which the monitor is expected to report.
+ */
+typedef struct bench_change
+{
+  string path;
+  uint64_t time_ns;
+} bench_change;
+
+/*
+ * The tree a run works on.  Its paths are updated as the churn changes it.
+ */
+typedef struct bench_tree
+{
+  string root;
+  vector<string> dirs;
+  vector<string> files;
+} bench_tree;
+
+typedef struct bench_result
+{
+  size_t changes = 0;
+  size_t events = 0;
+  size_t missed = 0;
+  double startup_ms = 0;
+  double churn_ms = 0;
+  double events_per_second = 0;
+  double latency_p50_ms = 0;
+  double latency_p99_ms = 0;
+  double cpu_ms = 0;
+  long peak_rss_kb = 0;
+  string error;
+} bench_result;
+
+/*
+ * An event received by the monitor, with the monotonic time at which it was
+ * received.
+ */
+typedef struct received_event
+{
+  string path;
+  uint64_t time_ns;
+} received_event;
+
+static void usage(ostream &stream)
+{
+  stream << "fsw-bench [options]\n\n";
+  stream << "Options:\n";
+  stream << " -d, --depth=N         Depth of the tree (default: 2).\n";
+  stream << " -D, --dir=DIR         Create the trees in DIR (default: $TMPDIR or /tmp).\n";
+  stream << " -f, --fanout=N        Subdirectories of every directory (default: 4).\n";
+  stream << " -h, --help            Show this message.\n";
+  stream << " -l, --latency=DOUBLE  Latency of the monitors (default: 1).\n";
+  stream << " -m, --monitor=LIST    Comma-separated monitors to run: fsevents, kqueue,\n";
+  stream << "                       inotify, poll (default: all those available).\n";
+  stream << " -n, --files=N         Files in every directory (default: 8).\n";
+  stream << " -o, --operations=N    Changes made by every pattern (default: 1000).\n";
+  stream << " -p, --pattern=LIST    Comma-separated churn patterns to run: create,\n";
+  stream << "                       append, rename, remove, checkout (default: all).\n";
+  stream << " -s, --seed=N          Seed of the churn (default: 1).\n";
+  stream << " -S, --settle=DOUBLE   Seconds to wait for events after the churn\n";
+  stream << "                       (default: 2.5).\n";
+  stream << endl;
+}
+
+static unsigned long parse_unsigned(const char * option, const char * value)
+{
+  char * end;
+  errno = 0;
+  const unsigned long result = strtoul(value, &end, 10);
+
+  if (*value == '\0' || *end != '\0' || *value == '-' || errno == ERANGE)
+  {
+    cerr << "Invalid value for " << option << ": " << value << endl;
+    exit(BENCH_EXIT_USAGE);
+  }
+
+  return result;
+}
+
+static double parse_seconds(const char * option, const char * value)
+{
+  char * end;
+  const double result = strtod(value, &end);
+
+  if (*value == '\0' || *end != '\0' || !(result >= 0) || std::isinf(result))
+  {
+    cerr << "Invalid value for " << option << ": " << value << endl;
+    exit(BENCH_EXIT_USAGE);
+  }
+
+  return result;
+}
+
+template <typename T, size_t N>
+static vector<T> parse_list(const char * option, const string &value, const T (&names)[N])
+{
+  vector<T> selected;
+  istringstream list(value);
+  string name;
+
+  while (getline(list, name, ','))
+  {
+    const T * found = find_if(names, names + N, [&name](const T &item)
+    {
+      return name == item.name;
+    });
+
+    if (found == names + N)
+    {
+      cerr << "Invalid value for " << option << ": " << name << endl;
+      exit(BENCH_EXIT_USAGE);
+    }
+
+    selected.push_back(*found);
+  }
+
+  return selected;
+}
+
+static void write_file(const string &path, const char * data, size_t size, int flags)
+{
+  const int fd = ::open(path.c_str(), O_WRONLY | O_CREAT | flags, 0644);
+
+  if (fd < 0)
+  {
+    perror(path.c_str());
+    exit(BENCH_EXIT_ERROR);
+  }
+
+  if (::write(fd, data, size) < 0) perror(path.c_str());
+
+  ::close(fd);
+}
+
+static void make_dir(const string &path)
+{
+  if (::mkdir(path.c_str(), 0755) != 0 && errno != EEXIST)
+  {
+    perror(path.c_str());
+    exit(BENCH_EXIT_ERROR);
+  }
+}
+
+static void build_tree(bench_tree &tree, const string &dir, unsigned int level)
+{
+  make_dir(dir);
+  tree.dirs.push_back(dir);
+
+  for (unsigned int i = 0; i < files_per_dir; ++i)
+  {
+    const string path = dir + "/file" + to_string(i) + ".txt";
+    write_file(path, "fsw-bench\n", 10, O_TRUNC);
+    tree.files.push_back(path);
+  }
+
+  if (level == 0) return;
+
+  for (unsigned int i = 0; i < fanout; ++i)
+  {
+    build_tree(tree, dir + "/dir" + to_string(i), level - 1);
+  }
+}
+
+// nftw() takes no context: the changes of the removal in progress.
+static vector<bench_change> * removed_changes = nullptr;
+
+static int remove_entry(const char * path, const struct stat *, int, struct FTW * ftw)
+{
+  const uint64_t now = fsw::get_monotonic_time_ns();
+
+  if (::remove(path) != 0) perror(path);
+
+  if (removed_changes && ftw->level > 0) removed_changes->push_back({path, now});
+
+  return 0;
+}
+
+/*
+ * Removes the contents of root, recording a change for every entry if
+ * changes is not null.
+ */
+static void remove_tree(const string &root, vector<bench_change> * changes)
+{
+  removed_changes = changes;
+  ::nftw(root.c_str(), remove_entry, 64, FTW_DEPTH | FTW_PHYS);
+  removed_changes = nullptr;
+
+  make_dir(root);
+}
+
+static string parent_dir(const string &path)
+{
+  return path.substr(0, path.rfind('/'));
+}
+
+/*
+ * Applies a churn pattern to the tree and records the changes it made.  The
+ * time of a change is taken right before the system call making it.
+ */
+static void churn(bench_tree &tree,
+                  churn_pattern pattern,
+                  mt19937 &random,
+                  vector<bench_change> &changes)
+{
+  static const char line[] = "appended by fsw-bench\n";
+
+  switch (pattern)
+  {
+  case create_pattern:
+    for (unsigned int i = 0; i < operations; ++i)
+    {
+      const string path = tree.dirs[random() % tree.dirs.size()] + "/new" + to_string(i) + ".txt";
+
+      changes.push_back({path, fsw::get_monotonic_time_ns()});
+      write_file(path, line, sizeof (line) - 1, O_TRUNC);
+      tree.files.push_back(path);
+    }
+    break;
+
+  case append_pattern:
+  {
+    shuffle(tree.files.begin(), tree.files.end(), random);
+    const size_t hot_files = min(HOT_FILES, tree.files.size());
+
+    for (unsigned int i = 0; i < operations && hot_files; ++i)
+    {
+      const string &path = tree.files[random() % hot_files];
+
+      changes.push_back({path, fsw::get_monotonic_time_ns()});
+      write_file(path, line, sizeof (line) - 1, O_APPEND);
+    }
+    break;
+  }
+
+  case rename_pattern:
+    // Every file is renamed at most once: a path renamed twice between two
+    // scans cannot be observed by a polling monitor.
+    shuffle(tree.files.begin(), tree.files.end(), random);
+
+    for (unsigned int i = 0; i < operations && i < tree.files.size(); ++i)
+    {
+      string &path = tree.files[i];
+      const string renamed = parent_dir(path) + "/renamed" + to_string(i) + ".txt";
+
+      changes.push_back({renamed, fsw::get_monotonic_time_ns()});
+      if (::rename(path.c_str(), renamed.c_str()) != 0) perror(path.c_str());
+      path = renamed;
+    }
+    break;
+
+  case remove_pattern:
+    remove_tree(tree.root, &changes);
+    tree.dirs.assign(1, tree.root);
+    tree.files.clear();
+    break;
+
+  case checkout_pattern:
+  {
+    // Like switching branches: mostly rewritten files, some files added,
+    // deleted and moved, and a few new directories.  As in a checkout, every
+    // existing file is changed at most once.
+    shuffle(tree.files.begin(), tree.files.end(), random);
+
+    vector<string> untouched;
+    untouched.swap(tree.files);
+
+    for (unsigned int i = 0; i < operations; ++i)
+    {
+      const unsigned int kind = random() % 20;
+
+      if (kind < 14 && !untouched.empty())
+      {
+        string path = move(untouched.back());
+        untouched.pop_back();
+
+        if (kind < 8)
+        {
+          changes.push_back({path, fsw::get_monotonic_time_ns()});
+          write_file(path, line, sizeof (line) - 1, O_TRUNC);
+          tree.files.push_back(path);
+        }
+        else if (kind < 12)
+        {
+          changes.push_back({path, fsw::get_monotonic_time_ns()});
+          if (::unlink(path.c_str()) != 0) perror(path.c_str());
+        }
+        else
+        {
+          const string moved = tree.dirs[random() % tree.dirs.size()] + "/moved" + to_string(i) + ".txt";
+
+          changes.push_back({moved, fsw::get_monotonic_time_ns()});
+          if (::rename(path.c_str(), moved.c_str()) != 0) perror(path.c_str());
+          tree.files.push_back(moved);
+        }
+      }
+      else if (kind < 15)
+      {
+        const string dir = tree.dirs[random() % tree.dirs.size()] + "/newdir" + to_string(i);
+
+        changes.push_back({dir, fsw::get_monotonic_time_ns()});
+        make_dir(dir);
+        tree.dirs.push_back(dir);
+      }
+      else
+      {
+        const string path = tree.dirs[random() % tree.dirs.size()] + "/added" + to_string(i) + ".txt";
+
+        changes.push_back({path, fsw::get_monotonic_time_ns()});
+        write_file(path, line, sizeof (line) - 1, O_TRUNC);
+        tree.files.push_back(path);
+      }
+    }
+
+    tree.files.insert(tree.files.end(), untouched.begin(), untouched.end());
+    break;
+  }
+  }
+}
+
+typedef struct child_state
+{
+  string probe;
+  int ready_fd;
+  bool ready = false;
+  vector<received_event> events;
+} child_state;
+
+static void record_events(fsw::event_batch &events, void * context)
+{
+  child_state * state = static_cast<child_state *> (context);
+  const uint64_t now = fsw::get_monotonic_time_ns();
+
+  for (size_t i = 0; i < events.size(); ++i)
+  {
+    const fsw::compact_event evt = events[i];
+    state->events.push_back({string(evt.get_path(), evt.get_path_length()), now});
+
+    if (!state->ready && state->events.back().path == state->probe)
+    {
+      state->ready = true;
+
+      const char ready = 'r';
+      if (::write(state->ready_fd, &ready, 1) < 0) perror("write");
+    }
+  }
+}
+
+static bool write_fully(int fd, const void * data, size_t size)
+{
+  const char * p = static_cast<const char *> (data);
+
+  while (size)
+  {
+    const ssize_t written = ::write(fd, p, size);
+
+    if (written < 0)
+    {
+      if (errno == EINTR) continue;
+      return false;
+    }
+
+    p += written;
+    size -= written;
+  }
+
+  return true;
+}
+
+/*
+ * Runs the monitor until the parent writes to control_fd, and then writes
+ * the events it received to result_fd.
+ */
+static void run_monitor(fsw_monitor_type type,
+                        const bench_tree &tree,
+                        int ready_fd,
+                        int control_fd,
+                        int result_fd)
+{
+  child_state state;
+  state.probe = tree.root + "/.fsw-bench-probe";
+  state.ready_fd = ready_fd;
+
+  fsw::monitor * monitor;
+
+  try
+  {
+    monitor = fsw::monitor::create_monitor(type, {tree.root}, record_events, &state);
+    monitor->set_latency(latency);
+    monitor->set_recursive(true);
+  }
+  catch (exception &ex)
+  {
+    cerr << ex.what() << endl;
+    _exit(BENCH_EXIT_ERROR);
+  }
+
+  thread monitor_thread([monitor]
+  {
+    try
+    {
+      monitor->start();
+    }
+    catch (exception &ex)
+    {
+      cerr << ex.what() << endl;
+      _exit(BENCH_EXIT_ERROR);
+    }
+  });
+
+  char command;
+  while (::read(control_fd, &command, 1) < 0 && errno == EINTR);
+
+  monitor->stop();
+  monitor_thread.join();
+
+  for (const received_event &event : state.events)
+  {
+    const uint32_t length = event.path.size();
+
+    if (!write_fully(result_fd, &event.time_ns, sizeof (event.time_ns))
+        || !write_fully(result_fd, &length, sizeof (length))
+        || !write_fully(result_fd, event.path.data(), length))
+      _exit(BENCH_EXIT_ERROR);
+  }
+
+  _exit(BENCH_EXIT_OK);
+}
+
+static bool read_fully(int fd, void * data, size_t size)
+{
+  char * p = static_cast<char *> (data);
+
+  while (size)
+  {
+    const ssize_t rc = ::read(fd, p, size);
+
+    if (rc < 0 && errno == EINTR) continue;
+    if (rc <= 0) return false;
+
+    p += rc;
+    size -= rc;
+  }
+
+  return true;
+}
+
+static double to_ms(uint64_t ns)
+{
+  return ns / 1e6;
+}
+
+static double percentile(const vector<uint64_t> &sorted, double rank)
+{
+  if (sorted.empty()) return 0;
+
+  const size_t index = static_cast<size_t> (ceil(rank * sorted.size()));
+
+  return to_ms(sorted[index ? index - 1 : 0]);
+}
+
+/*
+ * Matches every change with the first event received for its path since it
+ * was made.
+ */
+static void match_events(const vector<bench_change> &changes,
+                         const vector<received_event> &events,
+                         uint64_t churn_start,
+                         const string &probe,
+                         bench_result &result)
+{
+  unordered_map<string, vector<uint64_t>> times_by_path;
+  uint64_t last_event = churn_start;
+
+  for (const received_event &event : events)
+  {
+    if (event.time_ns < churn_start || event.path == probe) continue;
+
+    times_by_path[event.path].push_back(event.time_ns);
+    last_event = max(last_event, event.time_ns);
+    ++result.events;
+  }
+
+  vector<uint64_t> latencies;
+
+  for (const bench_change &change : changes)
+  {
+    auto found = times_by_path.find(change.path);
+
+    if (found != times_by_path.end())
+    {
+      auto received = lower_bound(found->second.begin(), found->second.end(), change.time_ns);
+
+      if (received != found->second.end())
+      {
+        latencies.push_back(*received - change.time_ns);
+        continue;
+      }
+    }
+
+    ++result.missed;
+  }
+
+  sort(latencies.begin(), latencies.end());
+
+  result.changes = changes.size();
+  result.latency_p50_ms = percentile(latencies, 0.50);
+  result.latency_p99_ms = percentile(latencies, 0.99);
+
+  if (last_event > churn_start)
+    result.events_per_second = result.events / ((last_event - churn_start) / 1e9);
+}
+
+static bench_result run_benchmark(const named_monitor &monitor, const named_pattern &pattern)
+{
+  bench_result result;
+  bench_tree tree;
+  tree.root = base_dir + "/" + monitor.name + "-" + pattern.name;
+
+  make_dir(tree.root);
+  remove_tree(tree.root, nullptr);
+  tree.dirs.clear();
+  build_tree(tree, tree.root, depth);
+
+  int ready_pipe[2];
+  int control_pipe[2];
+  int result_pipe[2];
+
+  if (::pipe(ready_pipe) != 0 || ::pipe(control_pipe) != 0 || ::pipe(result_pipe) != 0)
+  {
+    perror("pipe");
+    exit(BENCH_EXIT_ERROR);
+  }
+
+  const uint64_t start = fsw::get_monotonic_time_ns();
+  const pid_t pid = ::fork();
+
+  if (pid < 0)
+  {
+    perror("fork");
+    exit(BENCH_EXIT_ERROR);
+  }
+
+  if (pid == 0)
+  {
+    ::close(ready_pipe[0]);
+    ::close(control_pipe[1]);
+    ::close(result_pipe[0]);
+    run_monitor(monitor.type, tree, ready_pipe[1], control_pipe[0], result_pipe[1]);
+  }
+
+  ::close(ready_pipe[1]);
+  ::close(control_pipe[0]);
+  ::close(result_pipe[1]);
+
+  // The monitor is ready once it reports the changes of the probe, which is
+  // touched until it does.
+  const string probe = tree.root + "/.fsw-bench-probe";
+  const uint64_t deadline = start + STARTUP_TIMEOUT * 1000000000ULL;
+  bool ready = false;
+
+  while (!ready && fsw::get_monotonic_time_ns() < deadline)
+  {
+    write_file(probe, "probe\n", 6, O_TRUNC);
+
+    struct pollfd fds = {ready_pipe[0], POLLIN, 0};
+
+    if (::poll(&fds, 1, 1) > 0)
+    {
+      char ready_byte;
+      ready = ::read(ready_pipe[0], &ready_byte, 1) == 1;
+      if (!ready) break;
+    }
+  }
+
+  vector<bench_change> changes;
+  uint64_t churn_start = 0;
+
+  if (ready)
+  {
+    result.startup_ms = to_ms(fsw::get_monotonic_time_ns() - start);
+    ::unlink(probe.c_str());
+
+    mt19937 random(seed);
+    churn_start = fsw::get_monotonic_time_ns();
+    churn(tree, pattern.pattern, random, changes);
+    result.churn_ms = to_ms(fsw::get_monotonic_time_ns() - churn_start);
+
+    ::usleep(static_cast<useconds_t> (settle * 1e6));
+  }
+  else
+  {
+    result.error = "The monitor did not report any event.";
+    ::kill(pid, SIGKILL);
+  }
+
+  ::close(control_pipe[1]);
+
+  vector<received_event> events;
+  uint64_t time_ns;
+  uint32_t length;
+
+  while (read_fully(result_pipe[0], &time_ns, sizeof (time_ns))
+         && read_fully(result_pipe[0], &length, sizeof (length)))
+  {
+    string path(length, '\0');
+
+    if (!read_fully(result_pipe[0], &path[0], length)) break;
+
+    events.push_back({move(path), time_ns});
+  }
+
+  ::close(ready_pipe[0]);
+  ::close(result_pipe[0]);
+
+  int status;
+  struct rusage usage;
+
+  while (::wait4(pid, &status, 0, &usage) < 0 && errno == EINTR);
+
+  if (ready && !(WIFEXITED(status) && WEXITSTATUS(status) == BENCH_EXIT_OK))
+  {
+    result.error = "The monitor failed.";
+  }
+
+  result.cpu_ms = usage.ru_utime.tv_sec * 1e3 + usage.ru_utime.tv_usec / 1e3
+    + usage.ru_stime.tv_sec * 1e3 + usage.ru_stime.tv_usec / 1e3;
+#ifdef __APPLE__
+  result.peak_rss_kb = usage.ru_maxrss / 1024;
+#else
+  result.peak_rss_kb = usage.ru_maxrss;
+#endif
+
+  if (result.error.empty()) match_events(changes, events, churn_start, probe, result);
+
+  remove_tree(tree.root, nullptr);
+  ::rmdir(tree.root.c_str());
+
+  return result;
+}
+
+static string json_string(const string &value)
+{
+  ostringstream json;
+  json << '"';
+
+  for (const char c : value)
+  {
+    if (c == '"' || c == '\\')
+      json << '\\' << c;
+    else if (static_cast<unsigned char> (c) < 0x20)
+      json << "\\u00" << "0123456789abcdef"[c >> 4] << "0123456789abcdef"[c & 0xf];
+    else
+      json << c;
+  }
+
+  json << '"';
+
+  return json.str();
+}
+
+static void print_result(const named_monitor &monitor,
+                         const named_pattern &pattern,
+                         const bench_result &result)
+{
+  ostringstream json;
+  json.setf(ios::fixed);
+  json.precision(3);
+
+  json << "{\"version\":" << json_string(PACKAGE_VERSION)
+    << ",\"monitor\":" << json_string(monitor.name)
+    << ",\"pattern\":" << json_string(pattern.name)
+    << ",\"depth\":" << depth
+    << ",\"fanout\":" << fanout
+    << ",\"files\":" << files_per_dir
+    << ",\"seed\":" << seed
+    << ",\"changes\":" << result.changes
+    << ",\"events\":" << result.events
+    << ",\"missed\":" << result.missed
+    << ",\"startup_ms\":" << result.startup_ms
+    << ",\"churn_ms\":" << result.churn_ms
+    << ",\"events_per_second\":" << result.events_per_second
+    << ",\"latency_p50_ms\":" << result.latency_p50_ms
+    << ",\"latency_p99_ms\":" << result.latency_p99_ms
+    << ",\"cpu_ms\":" << result.cpu_ms
+    << ",\"peak_rss_kb\":" << result.peak_rss_kb;
+
+  if (!result.error.empty()) json << ",\"error\":" << json_string(result.error);
+
+  json << "}";
+
+  cout << json.str() << endl;
+}
+
+/*
+ * The monitors which can be created on this system.
+ */
+static vector<named_monitor> available_monitors()
+{
+  vector<named_monitor> available;
+
+  for (const named_monitor &monitor : monitor_names)
+  {
+    try
+    {
+      delete fsw::monitor::create_monitor(monitor.type, {base_dir}, record_events);
+      available.push_back(monitor);
+    }
+    catch (exception &ex)
+    {
+    }
+  }
+
+  return available;
+}
+
+static void parse_opts(int argc, char ** argv)
+{
+  const char * short_options = "d:D:f:hl:m:n:o:p:s:S:";
+  int ch;
+
+#ifdef HAVE_GETOPT_LONG
+  static struct option long_options[] = {
+    { "depth", required_argument, nullptr, 'd'},
+    { "dir", required_argument, nullptr, 'D'},
+    { "fanout", required_argument, nullptr, 'f'},
+    { "help", no_argument, nullptr, 'h'},
+    { "latency", required_argument, nullptr, 'l'},
+    { "monitor", required_argument, nullptr, 'm'},
+    { "files", required_argument, nullptr, 'n'},
+    { "operations", required_argument, nullptr, 'o'},
+    { "pattern", required_argument, nullptr, 'p'},
+    { "seed", required_argument, nullptr, 's'},
+    { "settle", required_argument, nullptr, 'S'},
+    { nullptr, 0, nullptr, 0}
+  };
+
+  while ((ch = getopt_long(argc, argv, short_options, long_options, nullptr)) != -1)
+#else
+  while ((ch = getopt(argc, argv, short_options)) != -1)
+#endif
+  {
+    switch (ch)
+    {
+    case 'd':
+      depth = parse_unsigned("--depth", optarg);
+      break;
+
+    case 'D':
+      base_dir = optarg;
+      break;
+
+    case 'f':
+      fanout = parse_unsigned("--fanout", optarg);
+      break;
+
+    case 'h':
+      usage(cout);
+      exit(BENCH_EXIT_OK);
+
+    case 'l':
+      latency = parse_seconds("--latency", optarg);
+      break;
+
+    case 'm':
+      monitors = parse_list("--monitor", optarg, monitor_names);
+      break;
+
+    case 'n':
+      files_per_dir = parse_unsigned("--files", optarg);
+      break;
+
+    case 'o':
+      operations = parse_unsigned("--operations", optarg);
+      break;
+
+    case 'p':
+      patterns = parse_list("--pattern", optarg, pattern_names);
+      break;
+
+    case 's':
+      seed = parse_unsigned("--seed", optarg);
+      break;
+
+    case 'S':
+      settle = parse_seconds("--settle", optarg);
+      break;
+
+    default:
+      usage(cerr);
+      exit(BENCH_EXIT_USAGE);
+    }
+  }
+
+  if (optind != argc)
+  {
+    usage(cerr);
+    exit(BENCH_EXIT_USAGE);
+  }
+}
+
+int main(int argc, char ** argv)
+{
+  parse_opts(argc, argv);
+
+  // The trees are created in a directory of their own, removed at the end.
+  const char * tmpdir = getenv("TMPDIR");
+  string parent = base_dir.empty() ? (tmpdir && *tmpdir ? tmpdir : "/tmp") : base_dir;
+  vector<char> dir_template(parent.begin(), parent.end());
+  const string suffix = "/fsw-bench.XXXXXX";
+  dir_template.insert(dir_template.end(), suffix.begin(), suffix.end());
+  dir_template.push_back('\0');
+
+  if (!::mkdtemp(dir_template.data()))
+  {
+    perror(parent.c_str());
+    return BENCH_EXIT_ERROR;
+  }
+
+  char * real_dir = ::realpath(dir_template.data(), nullptr);
+  base_dir = real_dir;
+  ::free(real_dir);
+
+  if (monitors.empty()) monitors = available_monitors();
+  if (patterns.empty()) patterns.assign(begin(pattern_names), end(pattern_names));
+
+  for (const named_monitor &monitor : monitors)
+  {
+    for (const named_pattern &pattern : patterns)
+    {
+      print_result(monitor, pattern, run_benchmark(monitor, pattern));
+    }
+  }
+
+  ::rmdir(base_dir.c_str());
+
+  return BENCH_EXIT_OK;
+}
@@ -0,0 +1,345 @@
+/* 
+ * Copyright (C) 2014, Enrico M. Crisostomo
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 3, or (at your option)
+ * any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+#include "fsw_exec.h"
+#include "fsw_log.h"
+#include <iostream>
+#include <cerrno>
+#include <csignal>
+#include <cstdlib>
+#include <cstring>
+#include <thread>
+#include <fcntl.h>
+#include <pthread.h>
+#include <spawn.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+extern char ** environ;
+
+using namespace std;
+using namespace std::chrono;
+
+static const char PATHS_FILE_VARIABLE[] = "FSW_PATHS_FILE";
+
+command_runner::command_runner(const string &command,
+                               exec_paths_mode mode,
+                               char separator,
+                               double debounce,
+                               unsigned int jobs) :
+  command(command),
+  mode(mode),
+  separator(separator),
+  debounce(duration_cast<steady_clock::duration> (duration<double>(debounce))),
+  jobs(jobs ? jobs : 1)
+{
+  if (!needs_shell(command))
+  {
+    size_t start = command.find_first_not_of(" \t");
+
+    while (start != string::npos)
+    {
+      size_t end = command.find_first_of(" \t", start);
+      words.push_back(command.substr(start, end - start));
+      start = command.find_first_not_of(" \t", end);
+    }
+  }
+
+  // Signals are handled by the thread running the monitor, not by the
+  // threads of the runner, which inherit this mask.
+  sigset_t all_signals;
+  sigset_t previous_signals;
+  sigfillset(&all_signals);
+  pthread_sigmask(SIG_BLOCK, &all_signals, &previous_signals);
+
+  thread(&command_runner::schedule, this).detach();
+
+  pthread_sigmask(SIG_SETMASK, &previous_signals, nullptr);
+}
+
+/*
+ * Anything a shell would interpret beyond splitting words at blanks requires
+ * running the command through /bin/sh.
+ */
+bool command_runner::needs_shell(const string &command)
+{
+  return command.find_first_of("|&;<>()$`\\\"'*?[]#~=%{}!\n") != string::npos;
+}
+
+void command_runner::add_batch(const fsw::event_batch &events)
+{
+  lock_guard<mutex> lock(runner_mutex);
+
+  for (size_t i = 0; i < events.size(); ++i)
+  {
+    const fsw::compact_event evt = events[i];
+
+    // Overflow markers carry no path but still trigger a run.
+    if (evt.get_path_length() == 0) continue;
+
+    string path(evt.get_path(), evt.get_path_length());
+
+    if (path_set.insert(path).second) paths.push_back(move(path));
+  }
+
+  pending = true;
+  last_batch = steady_clock::now();
+  runner_cv.notify_all();
+}
+
+void command_runner::wait()
+{
+  unique_lock<mutex> lock(runner_mutex);
+
+  runner_cv.wait(lock, [this]
+  {
+    return !pending && running == 0;
+  });
+}
+
+void command_runner::schedule()
+{
+  unique_lock<mutex> lock(runner_mutex);
+
+  for (;;)
+  {
+    if (!pending || running >= jobs)
+    {
+      runner_cv.wait(lock);
+      continue;
+    }
+
+    // Postpone the run while batches keep coming.
+    const steady_clock::time_point start = last_batch + debounce;
+
+    if (steady_clock::now() < start)
+    {
+      runner_cv.wait_until(lock, start);
+      continue;
+    }
+
+    vector<string> run_paths;
+    run_paths.swap(paths);
+    path_set.clear();
+    pending = false;
+    ++running;
+
+    lock.unlock();
+    const bool started = start_run(run_paths);
+    lock.lock();
+
+    if (!started)
+    {
+      --running;
+      runner_cv.notify_all();
+    }
+  }
+}
+
+static bool write_all(int fd, const string &data)
+{
+  size_t written = 0;
+
+  while (written < data.size())
+  {
+    ssize_t rc = ::write(fd, data.data() + written, data.size() - written);
+
+    if (rc < 0)
+    {
+      if (errno == EINTR) continue;
+      return false;
+    }
+
+    written += rc;
+  }
+
+  return true;
+}
+
+bool command_runner::start_run(const vector<string> &run_paths)
+{
+  string data;
+
+  if (mode != exec_paths_none)
+  {
+    for (const string &path : run_paths)
+    {
+      data += path;
+      data += separator;
+    }
+  }
+
+  posix_spawn_file_actions_t actions;
+  posix_spawnattr_t attributes;
+  posix_spawn_file_actions_init(&actions);
+  posix_spawnattr_init(&attributes);
+
+  // fsw ignores SIGPIPE while running commands and this thread blocks all
+  // signals; the command must do neither.
+  sigset_t default_signals;
+  sigset_t no_signals;
+  sigemptyset(&default_signals);
+  sigaddset(&default_signals, SIGPIPE);
+  sigemptyset(&no_signals);
+  posix_spawnattr_setsigdefault(&attributes, &default_signals);
+  posix_spawnattr_setsigmask(&attributes, &no_signals);
+  posix_spawnattr_setflags(&attributes, POSIX_SPAWN_SETSIGDEF | POSIX_SPAWN_SETSIGMASK);
+
+  int input = -1;
+  int child_input = -1;
+  string paths_file;
+  string paths_variable;
+  vector<char *> env;
+  int rc = 0;
+
+  if (mode == exec_paths_stdin)
+  {
+    int fds[2];
+
+    if (::pipe(fds) != 0)
+    {
+      rc = errno;
+    }
+    else
+    {
+      ::fcntl(fds[0], F_SETFD, FD_CLOEXEC);
+      ::fcntl(fds[1], F_SETFD, FD_CLOEXEC);
+      posix_spawn_file_actions_adddup2(&actions, fds[0], STDIN_FILENO);
+      child_input = fds[0];
+      input = fds[1];
+    }
+  }
+  else if (mode == exec_paths_file)
+  {
+    const char * tmpdir = getenv("TMPDIR");
+    paths_file = string(tmpdir && *tmpdir ? tmpdir : "/tmp") + "/fsw-paths-XXXXXX";
+
+    vector<char> name(paths_file.begin(), paths_file.end());
+    name.push_back('\0');
+
+    int fd = ::mkstemp(name.data());
+
+    if (fd < 0)
+    {
+      rc = errno;
+      paths_file.clear();
+    }
+    else
+    {
+      paths_file = name.data();
+
+      if (!write_all(fd, data)) rc = errno;
+      ::close(fd);
+    }
+
+    paths_variable = string(PATHS_FILE_VARIABLE) + "=" + paths_file;
+    const size_t name_length = sizeof (PATHS_FILE_VARIABLE) - 1;
+
+    for (char ** var = environ; *var; ++var)
+    {
+      if (strncmp(*var, PATHS_FILE_VARIABLE, name_length) == 0
+          && (*var)[name_length] == '=')
+        continue;
+
+      env.push_back(*var);
+    }
+
+    env.push_back(&paths_variable[0]);
+    env.push_back(nullptr);
+  }
+
+  pid_t pid = -1;
+
+  if (rc == 0)
+  {
+    char ** envp = env.empty() ? environ : env.data();
+
+    if (words.empty())
+    {
+      const char * argv[] = {"/bin/sh", "-c", command.c_str(), nullptr};
+
+      rc = posix_spawn(&pid, "/bin/sh", &actions, &attributes,
+                       const_cast<char * const *> (argv), envp);
+    }
+    else
+    {
+      vector<char *> argv;
+
+      for (string &word : words) argv.push_back(&word[0]);
+      argv.push_back(nullptr);
+
+      rc = posix_spawnp(&pid, argv[0], &actions, &attributes, argv.data(), envp);
+    }
+  }
+
+  posix_spawn_file_actions_destroy(&actions);
+  posix_spawnattr_destroy(&attributes);
+
+  // The read end of the pipe now belongs to the child.
+  if (child_input >= 0) ::close(child_input);
+
+  if (rc != 0)
+  {
+    cerr << "Cannot run " << command << ": " << strerror(rc) << endl;
+
+    if (input >= 0) ::close(input);
+    if (!paths_file.empty()) ::unlink(paths_file.c_str());
+
+    return false;
+  }
+
+  thread(&command_runner::finish_run, this, pid, input, move(data), paths_file).detach();
+
+  return true;
+}
+
+void command_runner::finish_run(pid_t pid, int input, string data, string paths_file)
+{
+  // A command which exits without reading all the paths makes the write
+  // fail with EPIPE, which is ignored.
+  if (input >= 0)
+  {
+    write_all(input, data);
+    ::close(input);
+  }
+
+  int status = 0;
+
+  while (::waitpid(pid, &status, 0) < 0 && errno == EINTR)
+  {
+  }
+
+  if (!paths_file.empty()) ::unlink(paths_file.c_str());
+
+  if (WIFEXITED(status) && WEXITSTATUS(status) != 0)
+  {
+    string message = "Command exited with status ";
+    message += to_string(WEXITSTATUS(status));
+    message += ".\n";
+    fsw_log(message.c_str());
+  }
+  else if (WIFSIGNALED(status))
+  {
+    string message = "Command terminated by signal ";
+    message += to_string(WTERMSIG(status));
+    message += ".\n";
+    fsw_log(message.c_str());
+  }
+
+  lock_guard<mutex> lock(runner_mutex);
+  --running;
+  runner_cv.notify_all();
+}
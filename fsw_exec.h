@@ -0,0 +1,100 @@
+/* 
+ * Copyright (C) 2014, Enrico M. Crisostomo
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 3, or (at your option)
+ * any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+#ifndef FSW_EXEC_H
+#  define FSW_EXEC_H
+
+#  include <chrono>
+#  include <condition_variable>
+#  include <mutex>
+#  include <string>
+#  include <unordered_set>
+#  include <vector>
+#  include <sys/types.h>
+#  include "libfsw/c++/event_batch.h"
+
+/*
+ * How the paths which changed are passed to the command: not at all, on its
+ * standard input, or in a file whose name is stored in the FSW_PATHS_FILE
+ * environment variable.  The paths are separated by a newline or, with -0,
+ * by a NUL character.
+ */
+enum exec_paths_mode
+{
+  exec_paths_none = 0,
+  exec_paths_stdin,
+  exec_paths_file
+};
+
+/*
+ * Runs a command when events are received, replacing a pipeline like
+ * fsw -o | xargs, which forks a shell for every batch.
+ *
+ * Batches received while the command is running are coalesced: at most one
+ * run is queued and it receives the paths of all the batches received since
+ * the previous run started.  A run starts once no batch has been received
+ * for the debounce time and as long as fewer than the maximum number of jobs
+ * are running.  The command is spawned with posix_spawn, directly if it
+ * contains no shell syntax and through /bin/sh -c otherwise.
+ *
+ * A runner is never destroyed: its threads may outlive the main thread
+ * until the program exits.
+ */
+class command_runner
+{
+public:
+  command_runner(const std::string &command,
+                 exec_paths_mode mode,
+                 char separator,
+                 double debounce,
+                 unsigned int jobs);
+  command_runner(const command_runner &orig) = delete;
+  command_runner& operator=(const command_runner &that) = delete;
+
+  /*
+   * Queue a run for the paths of a batch.
+   */
+  void add_batch(const fsw::event_batch &events);
+
+  /*
+   * Wait until no run is queued or running.
+   */
+  void wait();
+
+  static bool needs_shell(const std::string &command);
+
+private:
+  void schedule();
+  bool start_run(const std::vector<std::string> &run_paths);
+  void finish_run(pid_t pid, int input, std::string data, std::string paths_file);
+
+  std::string command;
+  std::vector<std::string> words;
+  exec_paths_mode mode;
+  char separator;
+  std::chrono::steady_clock::duration debounce;
+  unsigned int jobs;
+
+  std::mutex runner_mutex;
+  std::condition_variable runner_cv;
+  std::vector<std::string> paths;
+  std::unordered_set<std::string> path_set;
+  std::chrono::steady_clock::time_point last_batch;
+  bool pending = false;
+  unsigned int running = 0;
+};
+
+#endif  /* FSW_EXEC_H */
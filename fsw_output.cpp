@@ -0,0 +1,235 @@
+/* 
+ * Copyright (C) 2014, Enrico M. Crisostomo
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 3, or (at your option)
+ * any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+#include "fsw_output.h"
+#include <cerrno>
+#include <unistd.h>
+
+using namespace std;
+
+output_buffer::output_buffer(int fd) : fd(fd)
+{
+}
+
+void output_buffer::set_flush_policy(output_flush_policy policy, size_t bytes)
+{
+  this->policy = policy;
+  flush_bytes = bytes;
+}
+
+void output_buffer::append_uint(uint64_t value)
+{
+  char digits[20];
+  size_t length = 0;
+
+  do
+  {
+    digits[sizeof (digits) - ++length] = '0' + value % 10;
+    value /= 10;
+  }
+  while (value);
+
+  append(digits + sizeof (digits) - length, length);
+}
+
+/*
+ * Returns the length of the valid UTF-8 sequence (RFC 3629) starting at s,
+ * or 0 if the bytes are not one: overlong encodings, surrogates and code
+ * points above U+10FFFF are rejected.
+ */
+static size_t get_utf8_length(const unsigned char * s, size_t length)
+{
+  size_t sequence;
+  unsigned char min = 0x80;
+  unsigned char max = 0xbf;
+
+  if (s[0] >= 0xc2 && s[0] <= 0xdf) sequence = 2;
+  else if (s[0] >= 0xe0 && s[0] <= 0xef)
+  {
+    sequence = 3;
+    if (s[0] == 0xe0) min = 0xa0;
+    if (s[0] == 0xed) max = 0x9f;
+  }
+  else if (s[0] >= 0xf0 && s[0] <= 0xf4)
+  {
+    sequence = 4;
+    if (s[0] == 0xf0) min = 0x90;
+    if (s[0] == 0xf4) max = 0x8f;
+  }
+  else return 0;
+
+  if (length < sequence) return 0;
+
+  // Only the second byte has a narrower range.
+  if (s[1] < min || s[1] > max) return 0;
+
+  for (size_t i = 2; i < sequence; ++i)
+  {
+    if (s[i] < 0x80 || s[i] > 0xbf) return 0;
+  }
+
+  return sequence;
+}
+
+bool output_buffer::append_json_string(const char * s, size_t length)
+{
+  static const char hex[] = "0123456789abcdef";
+  bool valid = true;
+
+  append('"');
+
+  // Copy the runs of characters which need no escaping at once.
+  size_t run = 0;
+
+  for (size_t i = 0; i < length; ++i)
+  {
+    const unsigned char c = s[i];
+
+    if (c >= 0x80)
+    {
+      const size_t sequence = get_utf8_length(reinterpret_cast<const unsigned char *> (s + i),
+                                              length - i);
+
+      if (sequence)
+      {
+        i += sequence - 1;
+        continue;
+      }
+    }
+    else if (c >= 0x20 && c != '"' && c != '\\') continue;
+
+    append(s + run, i - run);
+    run = i + 1;
+
+    switch (c)
+    {
+    case '"':
+      append("\\\"", 2);
+      break;
+    case '\\':
+      append("\\\\", 2);
+      break;
+    case '\n':
+      append("\\n", 2);
+      break;
+    case '\r':
+      append("\\r", 2);
+      break;
+    case '\t':
+      append("\\t", 2);
+      break;
+    default:
+      if (c >= 0x80) valid = false;
+      append("\\u00", 4);
+      append(hex[c >> 4]);
+      append(hex[c & 0xf]);
+    }
+  }
+
+  append(s + run, length - run);
+  append('"');
+
+  return valid;
+}
+
+void output_buffer::append_base64(const char * s, size_t length)
+{
+  static const char alphabet[] =
+    "ABCDEFGHIJKLMNOPQRSTUVWXYZabcdefghijklmnopqrstuvwxyz0123456789+/";
+  const unsigned char * bytes = reinterpret_cast<const unsigned char *> (s);
+  size_t i = 0;
+
+  for (; i + 2 < length; i += 3)
+  {
+    const uint32_t group = (bytes[i] << 16) | (bytes[i + 1] << 8) | bytes[i + 2];
+
+    append(alphabet[group >> 18]);
+    append(alphabet[(group >> 12) & 0x3f]);
+    append(alphabet[(group >> 6) & 0x3f]);
+    append(alphabet[group & 0x3f]);
+  }
+
+  if (i == length) return;
+
+  const uint32_t group = (bytes[i] << 16)
+    | (i + 1 < length ? bytes[i + 1] << 8 : 0);
+
+  append(alphabet[group >> 18]);
+  append(alphabet[(group >> 12) & 0x3f]);
+  append(i + 1 < length ? alphabet[(group >> 6) & 0x3f] : '=');
+  append('=');
+}
+
+void output_buffer::append_le32(uint32_t value)
+{
+  for (int i = 0; i < 4; ++i, value >>= 8)
+    append(static_cast<char> (value & 0xff));
+}
+
+void output_buffer::append_le64(uint64_t value)
+{
+  for (int i = 0; i < 8; ++i, value >>= 8)
+    append(static_cast<char> (value & 0xff));
+}
+
+bool output_buffer::end_record()
+{
+  switch (policy)
+  {
+  case flush_per_event:
+    return flush();
+  case flush_per_bytes:
+    return flush_over(flush_bytes);
+  default:
+    return true;
+  }
+}
+
+bool output_buffer::end_batch()
+{
+  return policy == flush_per_bytes ? flush_over(flush_bytes) : flush();
+}
+
+bool output_buffer::flush_over(size_t bytes)
+{
+  return buffer.size() < bytes || flush();
+}
+
+bool output_buffer::flush()
+{
+  const char * data = buffer.data();
+  size_t left = buffer.size();
+
+  while (left)
+  {
+    ssize_t written = ::write(fd, data, left);
+
+    if (written == -1)
+    {
+      if (errno == EINTR) continue;
+
+      buffer.clear();
+      return false;
+    }
+
+    data += written;
+    left -= written;
+  }
+
+  buffer.clear();
+
+  return true;
+}
@@ -0,0 +1,104 @@
+/* 
+ * Copyright (C) 2014, Enrico M. Crisostomo
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 3, or (at your option)
+ * any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+#ifndef FSW_OUTPUT_H
+#  define FSW_OUTPUT_H
+
+#  include <cstddef>
+#  include <cstdint>
+#  include <string>
+#  include <vector>
+
+enum output_flush_policy
+{
+  flush_per_batch = 0,
+  flush_per_event,
+  flush_per_bytes
+};
+
+/*
+ * Buffer in which the events of a batch are formatted before being written
+ * to a file descriptor with a single write(2), instead of one system call
+ * per event.  Depending on the flush policy, the buffer is written at the
+ * end of every batch, at the end of every event, or once it holds at least
+ * a given number of bytes (and when the program exits).  The storage of the
+ * buffer is reused across flushes.
+ */
+class output_buffer
+{
+public:
+  explicit output_buffer(int fd);
+  output_buffer(const output_buffer &orig) = delete;
+  output_buffer& operator=(const output_buffer &that) = delete;
+
+  void set_flush_policy(output_flush_policy policy, size_t bytes = 0);
+
+  void append(char c)
+  {
+    buffer.push_back(c);
+  }
+
+  void append(const char * s, size_t length)
+  {
+    buffer.insert(buffer.end(), s, s + length);
+  }
+
+  void append(const std::string &s)
+  {
+    append(s.data(), s.length());
+  }
+
+  void append_uint(uint64_t value);
+
+  /*
+   * Append a string as a JSON string literal, escaping quotes, backslashes
+   * and control characters.  Valid UTF-8 sequences are copied as they are,
+   * while the bytes which are not part of one are escaped as \u00XX (XX
+   * being the value of the byte), so that the output is valid JSON.  Since
+   * such an escape cannot be told apart from the character it denotes, the
+   * mapping is lossy: false is returned when any byte was escaped this way.
+   */
+  bool append_json_string(const char * s, size_t length);
+
+  /*
+   * Append bytes encoded in base64 (RFC 4648), with padding.
+   */
+  void append_base64(const char * s, size_t length);
+
+  /*
+   * Append an integer in little-endian byte order.
+   */
+  void append_le32(uint32_t value);
+  void append_le64(uint64_t value);
+
+  /*
+   * Mark the end of an event record and of a batch, flushing the buffer if
+   * the flush policy requires it.  They return false if writing failed.
+   */
+  bool end_record();
+  bool end_batch();
+  bool flush();
+
+private:
+  bool flush_over(size_t bytes);
+
+  int fd;
+  std::vector<char> buffer;
+  output_flush_policy policy = flush_per_batch;
+  size_t flush_bytes = 0;
+};
+
+#endif  /* FSW_OUTPUT_H */
@@ -0,0 +1,925 @@
+/* 
+ * Copyright (C) 2014, Enrico M. Crisostomo
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 3, or (at your option)
+ * any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+#ifdef HAVE_CONFIG_H
+#  include "config.h"
+#endif
+#include "fsw_relay.h"
+#include "fsw_log.h"
+#include <iostream>
+#include <algorithm>
+#include <cerrno>
+#include <csignal>
+#include <cstring>
+#include <functional>
+#include <random>
+#include <stdexcept>
+#include <thread>
+#include <fcntl.h>
+#include <netdb.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <poll.h>
+#include <pthread.h>
+#include <sys/socket.h>
+#include <unistd.h>
+#ifdef HAVE_ZLIB
+#  include <zlib.h>
+#endif
+
+using namespace std;
+using namespace std::chrono;
+
+enum relay_frame_type
+{
+  HELLO_FRAME = 1,
+  BATCH_FRAME,
+  WELCOME_FRAME,
+  ACK_FRAME
+};
+
+enum relay_batch_encoding
+{
+  RAW_ENCODING = 0,
+  DEFLATE_ENCODING
+};
+
+static const char RELAY_MAGIC[8] = {'F', 'S', 'W', 'R', 'E', 'L', 'A', 'Y'};
+static const unsigned char RELAY_VERSION = 1;
+
+// Size of the length and of the type of a frame.
+static const size_t FRAME_HEADER_SIZE = 5;
+
+// Frames larger than this are considered corrupt.
+static const uint32_t MAX_FRAME_SIZE = 64 << 20;
+
+// Bytes of frames copied into the output buffer of a connection at once.
+static const size_t MAX_OUTPUT_SIZE = 1 << 18;
+
+// Bytes read from a relay in a round, so that no relay starves the others.
+static const size_t MAX_READ_SIZE = 1 << 20;
+
+// Seconds a relay waits for the answer to its HELLO.
+static const int HELLO_TIMEOUT = 10;
+
+// Seconds the aggregator remembers a relay process once it is disconnected.
+static const int RELAY_EXPIRY = 600;
+
+static const unsigned int MIN_BACKOFF_MS = 100;
+static const unsigned int MAX_BACKOFF_MS = 5000;
+
+/*
+ * Splits a tcp://host:port URL.  The host may be empty, meaning any address
+ * when listening, and IPv6 addresses are enclosed in brackets.
+ */
+static void parse_url(const string &url, string &host, string &port)
+{
+  static const string scheme = "tcp://";
+
+  if (url.compare(0, scheme.size(), scheme) == 0)
+  {
+    const string address = url.substr(scheme.size());
+    size_t colon = address.rfind(':');
+
+    if (!address.empty() && address[0] == '[')
+    {
+      const size_t bracket = address.find(']');
+
+      if (bracket != string::npos && bracket + 1 == colon)
+      {
+        host = address.substr(1, bracket - 1);
+        port = address.substr(colon + 1);
+      }
+    }
+    else if (colon != string::npos)
+    {
+      host = address.substr(0, colon);
+      port = address.substr(colon + 1);
+    }
+  }
+
+  if (port.empty() || port.find_first_not_of("0123456789") != string::npos)
+  {
+    throw invalid_argument("Invalid URL: " + url + " (expected tcp://host:port)");
+  }
+}
+
+static void set_descriptor_flags(int fd, bool nonblocking)
+{
+  if (nonblocking) ::fcntl(fd, F_SETFL, ::fcntl(fd, F_GETFL) | O_NONBLOCK);
+  ::fcntl(fd, F_SETFD, FD_CLOEXEC);
+}
+
+static size_t begin_frame(vector<unsigned char> &out, relay_frame_type type)
+{
+  const size_t start = out.size();
+
+  out.resize(start + 4);
+  out.push_back(type);
+
+  return start;
+}
+
+static void end_frame(vector<unsigned char> &out, size_t start)
+{
+  const uint32_t length = out.size() - start - 4;
+
+  for (int i = 0; i < 4; ++i) out[start + i] = static_cast<unsigned char> (length >> (8 * i));
+}
+
+static uint32_t get_frame_length(const unsigned char * p)
+{
+  return p[0] | p[1] << 8 | p[2] << 16 | static_cast<uint32_t> (p[3]) << 24;
+}
+
+static bool write_fully(int fd, const unsigned char * data, size_t size)
+{
+  while (size)
+  {
+    ssize_t written = ::write(fd, data, size);
+
+    if (written < 0)
+    {
+      if (errno == EINTR) continue;
+      return false;
+    }
+
+    data += written;
+    size -= written;
+  }
+
+  return true;
+}
+
+static bool read_fully(int fd, unsigned char * data, size_t size)
+{
+  while (size)
+  {
+    ssize_t rc = ::read(fd, data, size);
+
+    if (rc < 0 && errno == EINTR) continue;
+    if (rc <= 0) return false;
+
+    data += rc;
+    size -= rc;
+  }
+
+  return true;
+}
+
+/*
+ * Starts a detached thread which does not receive the signals handled by
+ * the main thread.
+ */
+static void start_thread(function<void()> body)
+{
+  sigset_t all_signals;
+  sigset_t previous_signals;
+  sigfillset(&all_signals);
+  pthread_sigmask(SIG_BLOCK, &all_signals, &previous_signals);
+
+  thread(body).detach();
+
+  pthread_sigmask(SIG_SETMASK, &previous_signals, nullptr);
+}
+
+event_relay::event_relay(const string &url, bool compress) :
+  url(url), compress(compress)
+{
+  parse_url(url, host, port);
+
+  char host_name[256];
+
+  if (::gethostname(host_name, sizeof (host_name)) != 0) strcpy(host_name, "localhost");
+  host_name[sizeof (host_name) - 1] = '\0';
+  name = host_name;
+
+  // Tells the aggregator a restarted relay from the one it replaces.
+  random_device random;
+  instance = (static_cast<uint64_t> (random()) << 32) | random();
+
+  if (::pipe(wake_pipe) != 0)
+  {
+    throw runtime_error(string("Cannot create a pipe: ") + strerror(errno));
+  }
+
+  set_descriptor_flags(wake_pipe[0], true);
+  set_descriptor_flags(wake_pipe[1], true);
+
+  start_thread([this]
+  {
+    run();
+  });
+}
+
+void event_relay::send_batch(const fsw::event_batch &events)
+{
+  // Batches are sent by a single thread: the frame is built without lock.
+  vector<unsigned char> frame;
+  const size_t start = begin_frame(frame, BATCH_FRAME);
+  const uint64_t sequence = next_sequence++;
+
+  fsw::put_varint(frame, sequence);
+
+  // Every batch is encoded on its own, so that it can be resent alone.
+  encoded.clear();
+  encoder.reset();
+  encoder.encode(events, encoded);
+
+  const size_t header_size = frame.size();
+  bool deflated = false;
+
+#ifdef HAVE_ZLIB
+  if (compress)
+  {
+    frame.push_back(DEFLATE_ENCODING);
+    fsw::put_varint(frame, encoded.size());
+
+    const size_t offset = frame.size();
+    uLongf size = ::compressBound(encoded.size());
+    frame.resize(offset + size);
+
+    deflated = ::compress2(&frame[offset], &size, encoded.data(), encoded.size(), Z_BEST_SPEED) == Z_OK
+      && size < encoded.size();
+
+    if (deflated) frame.resize(offset + size);
+  }
+#endif
+
+  if (!deflated)
+  {
+    frame.resize(header_size);
+    frame.push_back(RAW_ENCODING);
+    frame.insert(frame.end(), encoded.begin(), encoded.end());
+  }
+
+  end_frame(frame, start);
+
+  {
+    lock_guard<mutex> relay_lock(relay_mutex);
+
+    queued_bytes += frame.size();
+    queue.push_back({sequence, move(frame)});
+
+    // The oldest batches are lost if the aggregator is unreachable for too
+    // long: the aggregator notices the gap in the sequence numbers.
+    while (queued_bytes > queue_limit && queue.size() > 1)
+    {
+      queued_bytes -= queue.front().data.size();
+      queue.pop_front();
+    }
+  }
+
+  const char wakeup = 0;
+
+  if (::write(wake_pipe[1], &wakeup, 1) < 0 && errno != EAGAIN)
+  {
+    perror("write");
+  }
+}
+
+void event_relay::wait()
+{
+  unique_lock<mutex> relay_lock(relay_mutex);
+
+  relay_cv.wait(relay_lock, [this]
+  {
+    return queue.empty();
+  });
+}
+
+bool event_relay::connect_aggregator()
+{
+  struct addrinfo hints;
+  memset(&hints, 0, sizeof (hints));
+  hints.ai_family = AF_UNSPEC;
+  hints.ai_socktype = SOCK_STREAM;
+
+  struct addrinfo * addresses;
+  const int rc = ::getaddrinfo(host.empty() ? nullptr : host.c_str(), port.c_str(), &hints, &addresses);
+
+  if (rc != 0)
+  {
+    fsw_log(("Cannot resolve " + url + ": " + gai_strerror(rc) + "\n").c_str());
+    return false;
+  }
+
+  for (struct addrinfo * address = addresses; address; address = address->ai_next)
+  {
+    fd = ::socket(address->ai_family, address->ai_socktype, address->ai_protocol);
+
+    if (fd < 0) continue;
+
+    if (::connect(fd, address->ai_addr, address->ai_addrlen) == 0) break;
+
+    ::close(fd);
+    fd = -1;
+  }
+
+  ::freeaddrinfo(addresses);
+
+  if (fd < 0)
+  {
+    fsw_log(("Cannot connect to " + url + ": " + strerror(errno) + "\n").c_str());
+    return false;
+  }
+
+  set_descriptor_flags(fd, false);
+
+  const int enable = 1;
+  ::setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &enable, sizeof (enable));
+
+  struct timeval timeout = {HELLO_TIMEOUT, 0};
+  ::setsockopt(fd, SOL_SOCKET, SO_RCVTIMEO, &timeout, sizeof (timeout));
+
+  vector<unsigned char> hello;
+  const size_t start = begin_frame(hello, HELLO_FRAME);
+  hello.insert(hello.end(), RELAY_MAGIC, RELAY_MAGIC + sizeof (RELAY_MAGIC));
+  hello.push_back(RELAY_VERSION);
+  fsw::put_varint(hello, instance);
+  fsw::put_varint(hello, name.size());
+  hello.insert(hello.end(), name.begin(), name.end());
+  end_frame(hello, start);
+
+  unsigned char welcome[FRAME_HEADER_SIZE + fsw::MAX_VARINT_SIZE];
+  uint32_t length = 0;
+  uint64_t received = 0;
+
+  if (write_fully(fd, hello.data(), hello.size())
+      && read_fully(fd, welcome, FRAME_HEADER_SIZE)
+      && (length = get_frame_length(welcome)) > 1
+      && length <= 1 + fsw::MAX_VARINT_SIZE
+      && welcome[4] == WELCOME_FRAME
+      && read_fully(fd, welcome + FRAME_HEADER_SIZE, length - 1))
+  {
+    const unsigned char * p = welcome + FRAME_HEADER_SIZE;
+
+    if (fsw::get_varint(p, welcome + 4 + length, received))
+    {
+      set_descriptor_flags(fd, true);
+
+      // The batches the aggregator received before are not resent.
+      lock_guard<mutex> relay_lock(relay_mutex);
+
+      while (!queue.empty() && queue.front().sequence <= received)
+      {
+        queued_bytes -= queue.front().data.size();
+        queue.pop_front();
+      }
+
+      sent_sequence = received;
+      input.clear();
+      output.clear();
+      output_offset = 0;
+      relay_cv.notify_all();
+
+      fsw_log(("Connected to " + url + ".\n").c_str());
+
+      return true;
+    }
+  }
+
+  cerr << "Cannot connect to " << url << ": the aggregator did not answer." << endl;
+  ::close(fd);
+  fd = -1;
+
+  return false;
+}
+
+void event_relay::disconnect()
+{
+  cerr << "Connection to " << url << " lost, reconnecting." << endl;
+
+  ::close(fd);
+  fd = -1;
+}
+
+bool event_relay::read_acks()
+{
+  unsigned char buffer[4096];
+
+  for (;;)
+  {
+    const ssize_t length = ::read(fd, buffer, sizeof (buffer));
+
+    if (length == 0) return false;
+
+    if (length < 0)
+    {
+      if (errno == EINTR) continue;
+      if (errno == EAGAIN || errno == EWOULDBLOCK) break;
+
+      return false;
+    }
+
+    input.insert(input.end(), buffer, buffer + length);
+  }
+
+  size_t offset = 0;
+  uint64_t acknowledged = 0;
+
+  while (input.size() - offset >= FRAME_HEADER_SIZE)
+  {
+    const uint32_t length = get_frame_length(&input[offset]);
+
+    if (length < 2 || length > 1 + fsw::MAX_VARINT_SIZE || input[offset + 4] != ACK_FRAME)
+      return false;
+
+    if (input.size() - offset < 4 + length) break;
+
+    const unsigned char * p = &input[offset + FRAME_HEADER_SIZE];
+
+    if (!fsw::get_varint(p, &input[offset] + 4 + length, acknowledged)) return false;
+
+    offset += 4 + length;
+  }
+
+  input.erase(input.begin(), input.begin() + offset);
+
+  if (acknowledged)
+  {
+    lock_guard<mutex> relay_lock(relay_mutex);
+
+    while (!queue.empty() && queue.front().sequence <= acknowledged)
+    {
+      queued_bytes -= queue.front().data.size();
+      queue.pop_front();
+    }
+
+    relay_cv.notify_all();
+  }
+
+  return true;
+}
+
+bool event_relay::write_frames()
+{
+  for (;;)
+  {
+    if (output_offset == output.size())
+    {
+      output.clear();
+      output_offset = 0;
+
+      lock_guard<mutex> relay_lock(relay_mutex);
+
+      // The sequence numbers of the queue are increasing.
+      auto next = upper_bound(queue.begin(), queue.end(), sent_sequence,
+                              [](uint64_t sequence, const relay_frame &frame)
+      {
+        return sequence < frame.sequence;
+      });
+
+      for (; next != queue.end() && output.size() < MAX_OUTPUT_SIZE; ++next)
+      {
+        output.insert(output.end(), next->data.begin(), next->data.end());
+        sent_sequence = next->sequence;
+      }
+
+      if (output.empty()) return true;
+    }
+
+    const ssize_t written = ::write(fd, output.data() + output_offset, output.size() - output_offset);
+
+    if (written < 0)
+    {
+      if (errno == EINTR) continue;
+
+      return errno == EAGAIN || errno == EWOULDBLOCK;
+    }
+
+    output_offset += written;
+  }
+}
+
+void event_relay::run()
+{
+  unsigned int backoff_ms = MIN_BACKOFF_MS;
+
+  for (;;)
+  {
+    if (fd < 0)
+    {
+      if (!connect_aggregator())
+      {
+        unique_lock<mutex> relay_lock(relay_mutex);
+        relay_cv.wait_for(relay_lock, milliseconds(backoff_ms));
+        backoff_ms = min(backoff_ms * 2, MAX_BACKOFF_MS);
+
+        continue;
+      }
+
+      backoff_ms = MIN_BACKOFF_MS;
+    }
+
+    if (!write_frames())
+    {
+      disconnect();
+      continue;
+    }
+
+    struct pollfd fds[] = {
+      {fd, POLLIN, 0},
+      {wake_pipe[0], POLLIN, 0}
+    };
+
+    if (output_offset < output.size()) fds[0].events |= POLLOUT;
+
+    if (::poll(fds, 2, -1) < 0)
+    {
+      if (errno == EINTR) continue;
+
+      perror("poll");
+      disconnect();
+      continue;
+    }
+
+    if (fds[1].revents & POLLIN)
+    {
+      char drain[256];
+      while (::read(wake_pipe[0], drain, sizeof (drain)) > 0);
+    }
+
+    if ((fds[0].revents & (POLLIN | POLLHUP | POLLERR)) && !read_acks()) disconnect();
+  }
+}
+
+event_aggregator::event_aggregator(const string &url,
+                                   fsw::FSW_EVENT_BATCH_CALLBACK * callback,
+                                   void * context) :
+  callback(callback), context(context)
+{
+  string host;
+  string port;
+  parse_url(url, host, port);
+
+  struct addrinfo hints;
+  memset(&hints, 0, sizeof (hints));
+  hints.ai_family = AF_UNSPEC;
+  hints.ai_socktype = SOCK_STREAM;
+  hints.ai_flags = AI_PASSIVE;
+
+  struct addrinfo * addresses;
+  const int rc = ::getaddrinfo(host.empty() ? nullptr : host.c_str(), port.c_str(), &hints, &addresses);
+
+  if (rc != 0)
+  {
+    throw runtime_error("Cannot resolve " + url + ": " + gai_strerror(rc));
+  }
+
+  string error = "no address";
+
+  for (struct addrinfo * address = addresses; address; address = address->ai_next)
+  {
+    listen_fd = ::socket(address->ai_family, address->ai_socktype, address->ai_protocol);
+
+    if (listen_fd < 0) continue;
+
+    const int enable = 1;
+    ::setsockopt(listen_fd, SOL_SOCKET, SO_REUSEADDR, &enable, sizeof (enable));
+
+    if (::bind(listen_fd, address->ai_addr, address->ai_addrlen) == 0
+        && ::listen(listen_fd, SOMAXCONN) == 0)
+      break;
+
+    error = strerror(errno);
+    ::close(listen_fd);
+    listen_fd = -1;
+  }
+
+  ::freeaddrinfo(addresses);
+
+  if (listen_fd < 0)
+  {
+    throw runtime_error("Cannot listen on " + url + ": " + error);
+  }
+
+  set_descriptor_flags(listen_fd, true);
+}
+
+void event_aggregator::accept_relays()
+{
+  for (;;)
+  {
+    const int fd = ::accept(listen_fd, nullptr, nullptr);
+
+    if (fd < 0)
+    {
+      if (errno == EINTR || errno == ECONNABORTED) continue;
+      if (errno != EAGAIN && errno != EWOULDBLOCK) perror("accept");
+
+      return;
+    }
+
+    set_descriptor_flags(fd, true);
+
+    const int enable = 1;
+    ::setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &enable, sizeof (enable));
+
+    unique_ptr<relay_connection> relay(new relay_connection);
+    relay->fd = fd;
+    relays.push_back(move(relay));
+  }
+}
+
+bool event_aggregator::process_frame(relay_connection &relay,
+                                     unsigned char type,
+                                     const unsigned char * p,
+                                     const unsigned char * end)
+{
+  // A relay introduces itself first.
+  if (!relay.state)
+  {
+    uint64_t instance;
+    uint64_t name_length;
+
+    if (type != HELLO_FRAME
+        || static_cast<size_t> (end - p) < sizeof (RELAY_MAGIC) + 1
+        || memcmp(p, RELAY_MAGIC, sizeof (RELAY_MAGIC)) != 0
+        || p[sizeof (RELAY_MAGIC)] != RELAY_VERSION)
+      return false;
+
+    p += sizeof (RELAY_MAGIC) + 1;
+
+    if (!fsw::get_varint(p, end, instance)
+        || !fsw::get_varint(p, end, name_length)
+        || name_length != static_cast<uint64_t> (end - p))
+      return false;
+
+    relay.name.assign(reinterpret_cast<const char *> (p), name_length);
+    relay.state = &relay_states[relay_key(relay.name, instance)];
+    ++relay.state->connections;
+    relay.acknowledged = relay.state->last_sequence;
+
+    const size_t start = begin_frame(relay.output, WELCOME_FRAME);
+    fsw::put_varint(relay.output, relay.state->last_sequence);
+    end_frame(relay.output, start);
+
+    fsw_log(("Relay " + relay.name + " connected.\n").c_str());
+
+    return true;
+  }
+
+  uint64_t sequence;
+
+  if (type != BATCH_FRAME || !fsw::get_varint(p, end, sequence) || p == end) return false;
+
+  const unsigned char encoding = *p++;
+
+  // Batches received before the relay reconnected are resent only if they
+  // were not acknowledged yet.
+  if (sequence <= relay.state->last_sequence) return true;
+
+  if (encoding == DEFLATE_ENCODING)
+  {
+#ifdef HAVE_ZLIB
+    uint64_t size;
+
+    if (!fsw::get_varint(p, end, size) || size > MAX_FRAME_SIZE) return false;
+
+    uLongf inflated_size = size;
+    inflated.resize(size);
+
+    if (::uncompress(inflated.data(), &inflated_size, p, end - p) != Z_OK
+        || inflated_size != size)
+      return false;
+
+    p = inflated.data();
+    end = p + size;
+#else
+    cerr << "Relay " << relay.name << " sends compressed batches, which are not supported." << endl;
+    return false;
+#endif
+  }
+  else if (encoding != RAW_ENCODING)
+  {
+    return false;
+  }
+
+  received.clear();
+  decoder.reset();
+
+  if (!decoder.decode(p, end, received) || p != end) return false;
+
+  // The relay dropped the batches it could not deliver in time.
+  if (sequence != relay.state->last_sequence + 1)
+  {
+    path = relay.name + ":";
+    events.add(path, fsw::get_event_timestamp(), fsw_event_flag::Overflow);
+  }
+
+  for (size_t i = 0; i < received.size(); ++i)
+  {
+    const fsw::compact_event evt = received[i];
+
+    path.assign(relay.name);
+    path += ':';
+    path.append(evt.get_path(), evt.get_path_length());
+
+    events.add(path.data(),
+               path.size(),
+               {evt.get_time_ns(), evt.get_monotonic_time_ns()},
+               evt.get_flags());
+  }
+
+  relay.state->last_sequence = sequence;
+
+  return true;
+}
+
+bool event_aggregator::read_relay(relay_connection &relay)
+{
+  unsigned char buffer[1 << 16];
+  size_t total = 0;
+
+  while (total < MAX_READ_SIZE)
+  {
+    const ssize_t length = ::read(relay.fd, buffer, sizeof (buffer));
+
+    if (length == 0) return false;
+
+    if (length < 0)
+    {
+      if (errno == EINTR) continue;
+      if (errno == EAGAIN || errno == EWOULDBLOCK) break;
+
+      return false;
+    }
+
+    relay.input.insert(relay.input.end(), buffer, buffer + length);
+    total += length;
+  }
+
+  size_t offset = 0;
+
+  while (relay.input.size() - offset >= FRAME_HEADER_SIZE)
+  {
+    const unsigned char * frame = &relay.input[offset];
+    const uint32_t length = get_frame_length(frame);
+
+    if (length == 0 || length > MAX_FRAME_SIZE) return false;
+
+    if (relay.input.size() - offset < 4 + length) break;
+
+    if (!process_frame(relay, frame[4], frame + FRAME_HEADER_SIZE, frame + 4 + length))
+    {
+      cerr << "Invalid frame received from " << (relay.name.empty() ? "a relay" : relay.name) << "." << endl;
+      return false;
+    }
+
+    offset += 4 + length;
+  }
+
+  relay.input.erase(relay.input.begin(), relay.input.begin() + offset);
+
+  return true;
+}
+
+bool event_aggregator::write_relay(relay_connection &relay)
+{
+  if (relay.state && relay.acknowledged < relay.state->last_sequence)
+  {
+    relay.acknowledged = relay.state->last_sequence;
+
+    const size_t start = begin_frame(relay.output, ACK_FRAME);
+    fsw::put_varint(relay.output, relay.acknowledged);
+    end_frame(relay.output, start);
+  }
+
+  while (relay.output_offset < relay.output.size())
+  {
+    const ssize_t written = ::write(relay.fd,
+                                    relay.output.data() + relay.output_offset,
+                                    relay.output.size() - relay.output_offset);
+
+    if (written < 0)
+    {
+      if (errno == EINTR) continue;
+
+      return errno == EAGAIN || errno == EWOULDBLOCK;
+    }
+
+    relay.output_offset += written;
+  }
+
+  relay.output.clear();
+  relay.output_offset = 0;
+
+  return true;
+}
+
+int event_aggregator::expire_relays()
+{
+  const steady_clock::time_point now = steady_clock::now();
+  int timeout_ms = -1;
+
+  for (auto it = relay_states.begin(); it != relay_states.end();)
+  {
+    if (it->second.connections)
+    {
+      ++it;
+      continue;
+    }
+
+    const steady_clock::time_point expiry = it->second.idle_since + seconds(RELAY_EXPIRY);
+
+    if (expiry <= now)
+    {
+      it = relay_states.erase(it);
+      continue;
+    }
+
+    const int64_t remaining = duration_cast<milliseconds> (expiry - now).count() + 1;
+
+    if (timeout_ms < 0 || remaining < timeout_ms) timeout_ms = static_cast<int> (remaining);
+
+    ++it;
+  }
+
+  return timeout_ms;
+}
+
+void event_aggregator::run()
+{
+  vector<struct pollfd> fds;
+
+  for (;;)
+  {
+    const int timeout_ms = expire_relays();
+
+    fds.clear();
+    fds.push_back({listen_fd, POLLIN, 0});
+
+    for (const unique_ptr<relay_connection> &relay : relays)
+    {
+      short events = POLLIN;
+
+      if (relay->output_offset < relay->output.size()) events |= POLLOUT;
+
+      fds.push_back({relay->fd, events, 0});
+    }
+
+    if (::poll(fds.data(), fds.size(), timeout_ms) < 0)
+    {
+      if (errno == EINTR) continue;
+
+      throw runtime_error(string("poll: ") + strerror(errno));
+    }
+
+    vector<bool> open(relays.size(), true);
+
+    for (size_t i = 1; i < fds.size(); ++i)
+    {
+      if (fds[i].revents & (POLLIN | POLLHUP | POLLERR)) open[i - 1] = read_relay(*relays[i - 1]);
+    }
+
+    // The batches are delivered before they are acknowledged.
+    if (!events.empty())
+    {
+      next_sequence = events.assign_sequences(next_sequence);
+      callback(events, context);
+      events.clear();
+    }
+
+    for (size_t i = 0; i < open.size(); ++i)
+    {
+      if (open[i]) open[i] = write_relay(*relays[i]);
+    }
+
+    size_t kept = 0;
+
+    for (size_t i = 0; i < relays.size(); ++i)
+    {
+      if (i < open.size() && !open[i])
+      {
+        if (!relays[i]->name.empty()) fsw_log(("Relay " + relays[i]->name + " disconnected.\n").c_str());
+
+        relay_state * state = relays[i]->state;
+
+        if (state && !--state->connections) state->idle_since = steady_clock::now();
+
+        ::close(relays[i]->fd);
+        continue;
+      }
+
+      relays[kept++] = move(relays[i]);
+    }
+
+    relays.resize(kept);
+
+    if (fds[0].revents & POLLIN) accept_relays();
+  }
+}
@@ -0,0 +1,189 @@
+/* 
+ * Copyright (C) 2014, Enrico M. Crisostomo
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 3, or (at your option)
+ * any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+#ifndef FSW_RELAY_H
+#  define FSW_RELAY_H
+
+#  include <chrono>
+#  include <condition_variable>
+#  include <cstdint>
+#  include <deque>
+#  include <map>
+#  include <memory>
+#  include <mutex>
+#  include <string>
+#  include <utility>
+#  include <vector>
+#  include "libfsw/c++/batch_codec.h"
+#  include "libfsw/c++/monitor.h"
+
+/*
+ * Forwards batches of events to an aggregator over TCP, so that a central
+ * fsw --aggregate receives the events of many hosts.
+ *
+ * Every frame, in both directions, is made of a little-endian uint32 length
+ * of the rest of the frame, a type byte and a payload, whose integers are
+ * unsigned LEB128 varints.  A relay sends:
+ *
+ *   HELLO    the 8 bytes "FSWRELAY", the version byte, the random id of the
+ *            relay process, the length of the name of the relay and the
+ *            name (the host name)
+ *   BATCH    the sequence number of the batch, the encoding byte (raw or
+ *            deflate), the size of the raw batch if deflated and the batch
+ *            encoded as described in libfsw/c++/batch_codec.h, starting
+ *            from an empty previous path in every batch
+ *
+ * and the aggregator answers the HELLO with a WELCOME carrying the sequence
+ * number of the last batch it received from the relay process, or 0, and
+ * acknowledges the batches it has processed with ACK frames carrying the
+ * sequence number of the last of them.
+ *
+ * Batches are numbered from 1 and kept until acknowledged.  When the
+ * connection is lost the relay reconnects, backing off up to 5 seconds, and
+ * resends the batches the aggregator did not receive.  If the aggregator is
+ * unreachable for too long, the oldest batches are dropped once they exceed
+ * the queue limit, and the aggregator reports the gap with an Overflow
+ * event.
+ *
+ * A relay is never destroyed: its thread may outlive the main thread until
+ * the program exits.
+ */
+class event_relay
+{
+public:
+  event_relay(const std::string &url, bool compress);
+  event_relay(const event_relay &orig) = delete;
+  event_relay& operator=(const event_relay &that) = delete;
+
+  /*
+   * Queues a batch to be sent to the aggregator.
+   */
+  void send_batch(const fsw::event_batch &events);
+
+  /*
+   * Waits until the aggregator has acknowledged every queued batch.
+   */
+  void wait();
+
+  static const size_t DEFAULT_QUEUE_LIMIT = 64 << 20;
+
+private:
+  struct relay_frame
+  {
+    uint64_t sequence;
+    std::vector<unsigned char> data;
+  };
+
+  void run();
+  bool connect_aggregator();
+  bool read_acks();
+  bool write_frames();
+  void disconnect();
+
+  std::string url;
+  std::string host;
+  std::string port;
+  std::string name;
+  uint64_t instance;
+  bool compress;
+  size_t queue_limit = DEFAULT_QUEUE_LIMIT;
+  fsw::batch_encoder encoder;
+  std::vector<unsigned char> encoded;
+  uint64_t next_sequence = 1;
+  int fd = -1;
+  int wake_pipe[2] = {-1, -1};
+  std::vector<unsigned char> input;
+  std::vector<unsigned char> output;
+  size_t output_offset = 0;
+
+  // Guards the queue and the sequence numbers.
+  std::mutex relay_mutex;
+  std::condition_variable relay_cv;
+  std::deque<relay_frame> queue;
+  size_t queued_bytes = 0;
+  uint64_t sent_sequence = 0;
+};
+
+/*
+ * Receives the batches of many relays and delivers them to a callback, with
+ * the paths prefixed by the name of the relay and a colon.  All the
+ * connections are served by a single thread; the batches read from every
+ * connection in one round are delivered as one batch.
+ *
+ * The last batch received from a relay process is remembered for 10 minutes
+ * after its last connection is closed.  A relay reconnecting later is
+ * welcomed as a new one: the gap is reported with an Overflow event, and
+ * the batches it resends may be delivered again.
+ */
+class event_aggregator
+{
+public:
+  event_aggregator(const std::string &url,
+                   fsw::FSW_EVENT_BATCH_CALLBACK * callback,
+                   void * context);
+  event_aggregator(const event_aggregator &orig) = delete;
+  event_aggregator& operator=(const event_aggregator &that) = delete;
+
+  /*
+   * Serves the relays until the program exits.
+   */
+  void run();
+
+private:
+  // The name and the process id of a relay.
+  typedef std::pair<std::string, uint64_t> relay_key;
+
+  struct relay_state
+  {
+    uint64_t last_sequence = 0;
+    unsigned int connections = 0;
+    std::chrono::steady_clock::time_point idle_since;
+  };
+
+  struct relay_connection
+  {
+    int fd;
+    std::string name;
+    relay_state * state = nullptr;
+    uint64_t acknowledged = 0;
+    std::vector<unsigned char> input;
+    std::vector<unsigned char> output;
+    size_t output_offset = 0;
+  };
+
+  void accept_relays();
+  bool read_relay(relay_connection &relay);
+  bool process_frame(relay_connection &relay,
+                     unsigned char type,
+                     const unsigned char * p,
+                     const unsigned char * end);
+  bool write_relay(relay_connection &relay);
+  int expire_relays();
+
+  fsw::FSW_EVENT_BATCH_CALLBACK * callback;
+  void * context;
+  int listen_fd = -1;
+  std::vector<std::unique_ptr<relay_connection>> relays;
+  std::map<relay_key, relay_state> relay_states;
+  fsw::batch_decoder decoder;
+  fsw::event_batch received;
+  fsw::event_batch events;
+  std::string path;
+  std::vector<unsigned char> inflated;
+  uint64_t next_sequence = 1;
+};
+
+#endif  /* FSW_RELAY_H */
@@ -0,0 +1,739 @@
+/* 
+ * Copyright (C) 2014, Enrico M. Crisostomo
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 3, or (at your option)
+ * any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+#ifdef HAVE_CONFIG_H
+#  include "config.h"
+#endif
+#include "fsw_serve.h"
+#include "fsw_log.h"
+#include <iostream>
+#include <sstream>
+#include <cerrno>
+#include <climits>
+#include <csignal>
+#include <cstdlib>
+#include <cstring>
+#include <algorithm>
+#include <deque>
+#include <stdexcept>
+#include <thread>
+#include <fcntl.h>
+#include <poll.h>
+#include <pthread.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <unistd.h>
+#ifdef HAVE_REGCOMP
+#  include <regex.h>
+#endif
+
+using namespace std;
+using namespace std::chrono;
+
+// Bytes of frames encoded for a client before they are written.
+static const size_t MAX_OUTPUT_SIZE = 1 << 18;
+
+// Longest request a client can send.
+static const size_t MAX_REQUEST_SIZE = 1 << 16;
+
+typedef pair<shared_ptr<const fsw::event_batch>, size_t> queued_batch;
+
+struct client_filter
+{
+#ifdef HAVE_REGCOMP
+  regex_t regex;
+#endif
+  bool include;
+};
+
+struct watch_set
+{
+  event_server * server;
+  string root;
+  unique_ptr<fsw::monitor> monitor;
+  shared_ptr<fsw::event_batch_pool> pool{new fsw::event_batch_pool()};
+  thread monitor_thread;
+  vector<server_client *> subscribers;
+  steady_clock::time_point idle_since;
+  bool failed = false;
+};
+
+struct server_client
+{
+  explicit server_client(int fd) : fd(fd)
+  {
+  }
+
+  ~server_client()
+  {
+#ifdef HAVE_REGCOMP
+    for (client_filter &filter : filters) ::regfree(&filter.regex);
+#endif
+    ::close(fd);
+  }
+
+  int fd;
+  string request;
+  watch_set * set = nullptr;
+  vector<client_filter> filters;
+  size_t queue_limit = event_server::DEFAULT_QUEUE_LIMIT;
+  deque<queued_batch> queue;
+  size_t queued_bytes = 0;
+  bool overflow = false;
+  vector<char> output;
+  size_t output_offset = 0;
+};
+
+static void set_descriptor_flags(int fd)
+{
+  ::fcntl(fd, F_SETFL, ::fcntl(fd, F_GETFL) | O_NONBLOCK);
+  ::fcntl(fd, F_SETFD, FD_CLOEXEC);
+}
+
+/*
+ * A socket left behind by a server which no longer runs refuses connections
+ * and can be replaced.
+ */
+static bool remove_stale_socket(const struct sockaddr_un &address)
+{
+  int fd = ::socket(AF_UNIX, SOCK_STREAM, 0);
+  if (fd < 0) return false;
+
+  const int rc = ::connect(fd, reinterpret_cast<const struct sockaddr *> (&address), sizeof (address));
+  const int error = errno;
+  ::close(fd);
+
+  if (rc == 0 || error != ECONNREFUSED)
+  {
+    errno = EADDRINUSE;
+    return false;
+  }
+
+  return ::unlink(address.sun_path) == 0;
+}
+
+event_server::event_server(const string &socket_path,
+                           monitor_factory factory,
+                           double idle_timeout) :
+  socket_path(socket_path),
+  factory(factory),
+  idle_timeout(duration_cast<steady_clock::duration> (duration<double>(idle_timeout)))
+{
+  struct sockaddr_un address;
+  memset(&address, 0, sizeof (address));
+  address.sun_family = AF_UNIX;
+
+  if (socket_path.empty() || socket_path.size() >= sizeof (address.sun_path))
+  {
+    throw invalid_argument("Invalid socket path: " + socket_path);
+  }
+
+  memcpy(address.sun_path, socket_path.c_str(), socket_path.size());
+
+  listen_fd = ::socket(AF_UNIX, SOCK_STREAM, 0);
+
+  if (listen_fd < 0)
+  {
+    throw runtime_error(string("Cannot create the socket: ") + strerror(errno));
+  }
+
+  const struct sockaddr * addr = reinterpret_cast<const struct sockaddr *> (&address);
+
+  if ((::bind(listen_fd, addr, sizeof (address)) != 0
+       && (errno != EADDRINUSE
+           || !remove_stale_socket(address)
+           || ::bind(listen_fd, addr, sizeof (address)) != 0))
+      || ::listen(listen_fd, SOMAXCONN) != 0)
+  {
+    const string error = strerror(errno);
+    ::close(listen_fd);
+
+    throw runtime_error("Cannot listen on " + socket_path + ": " + error);
+  }
+
+  if (::pipe(wake_pipe) != 0)
+  {
+    const string error = strerror(errno);
+    ::close(listen_fd);
+    ::unlink(socket_path.c_str());
+
+    throw runtime_error("Cannot create a pipe: " + error);
+  }
+
+  set_descriptor_flags(listen_fd);
+  set_descriptor_flags(wake_pipe[0]);
+  set_descriptor_flags(wake_pipe[1]);
+}
+
+const string & event_server::get_socket_path() const
+{
+  return socket_path;
+}
+
+void event_server::wake()
+{
+  const char wakeup = 0;
+
+  // The pipe is non-blocking: if it is full, a wakeup is pending anyway.
+  if (::write(wake_pipe[1], &wakeup, 1) < 0 && errno != EAGAIN)
+  {
+    perror("write");
+  }
+}
+
+void event_server::publish(fsw::event_batch &events, void * context)
+{
+  watch_set * set = static_cast<watch_set *> (context);
+
+  {
+    lock_guard<mutex> server_lock(set->server->server_mutex);
+
+    if (set->subscribers.empty()) return;
+
+    // The batch is shared by the queues of all the subscribers.
+    shared_ptr<const fsw::event_batch> batch = fsw::share_batch(events, set->pool);
+    const size_t bytes = batch->get_memory_usage();
+
+    for (server_client * client : set->subscribers)
+    {
+      client->queue.push_back({batch, bytes});
+      client->queued_bytes += bytes;
+
+      while (client->queued_bytes > client->queue_limit && client->queue.size() > 1)
+      {
+        client->queued_bytes -= client->queue.front().second;
+        client->queue.pop_front();
+        client->overflow = true;
+      }
+    }
+  }
+
+  set->server->wake();
+}
+
+static bool accept_path(const server_client * client, const char * path)
+{
+#ifdef HAVE_REGCOMP
+  for (const client_filter &filter : client->filters)
+  {
+    if (::regexec(&filter.regex, path, 0, nullptr, 0) == 0) return filter.include;
+  }
+#endif
+
+  return true;
+}
+
+static void put_le32(vector<char> &out, uint32_t value)
+{
+  for (int i = 0; i < 4; ++i) out.push_back(static_cast<char> (value >> (8 * i)));
+}
+
+static void put_le64(vector<char> &out, uint64_t value)
+{
+  for (int i = 0; i < 8; ++i) out.push_back(static_cast<char> (value >> (8 * i)));
+}
+
+static void set_le32(vector<char> &out, size_t offset, uint32_t value)
+{
+  for (int i = 0; i < 4; ++i) out[offset + i] = static_cast<char> (value >> (8 * i));
+}
+
+static void put_event(vector<char> &out,
+                      uint64_t time_ns,
+                      uint64_t sequence,
+                      uint32_t flags,
+                      const char * path,
+                      uint32_t path_length)
+{
+  put_le32(out, 24 + path_length);
+  put_le64(out, time_ns);
+  put_le64(out, sequence);
+  put_le32(out, flags);
+  put_le32(out, path_length);
+  out.insert(out.end(), path, path + path_length);
+}
+
+static void encode_frames(server_client * client,
+                          const vector<queued_batch> &batches,
+                          bool overflow)
+{
+  vector<char> &out = client->output;
+
+  if (overflow)
+  {
+    put_le32(out, 4 + 4 + 24);
+    put_le32(out, 1);
+    put_event(out, fsw::get_event_timestamp().realtime_ns, 0, fsw_event_flag::Overflow, "", 0);
+  }
+
+  for (const queued_batch &queued : batches)
+  {
+    const fsw::event_batch &events = *queued.first;
+    const size_t frame = out.size();
+    uint32_t count = 0;
+
+    put_le32(out, 0);
+    put_le32(out, 0);
+
+    for (size_t i = 0; i < events.size(); ++i)
+    {
+      const fsw::compact_event evt = events[i];
+
+      if (evt.get_path_length() && !accept_path(client, evt.get_path())) continue;
+
+      put_event(out,
+                evt.get_time_ns(),
+                evt.get_sequence(),
+                evt.get_flags(),
+                evt.get_path(),
+                evt.get_path_length());
+      ++count;
+    }
+
+    // Batches filtered out entirely are not sent.
+    if (count == 0)
+    {
+      out.resize(frame);
+      continue;
+    }
+
+    set_le32(out, frame, out.size() - frame - 4);
+    set_le32(out, frame + 4, count);
+  }
+}
+
+bool event_server::send_events(server_client * client)
+{
+  for (;;)
+  {
+    if (client->output_offset == client->output.size())
+    {
+      vector<queued_batch> batches;
+      bool overflow;
+
+      {
+        lock_guard<mutex> server_lock(server_mutex);
+        size_t bytes = 0;
+
+        while (!client->queue.empty() && bytes < MAX_OUTPUT_SIZE)
+        {
+          bytes += client->queue.front().second;
+          client->queued_bytes -= client->queue.front().second;
+          batches.push_back(move(client->queue.front()));
+          client->queue.pop_front();
+        }
+
+        overflow = client->overflow;
+        client->overflow = false;
+      }
+
+      client->output.clear();
+      client->output_offset = 0;
+      encode_frames(client, batches, overflow);
+
+      if (client->output.empty())
+      {
+        if (batches.empty()) return true;
+        continue;
+      }
+    }
+
+    const ssize_t written = ::write(client->fd,
+                                    client->output.data() + client->output_offset,
+                                    client->output.size() - client->output_offset);
+
+    if (written < 0)
+    {
+      if (errno == EINTR) continue;
+
+      return errno == EAGAIN || errno == EWOULDBLOCK;
+    }
+
+    client->output_offset += written;
+  }
+}
+
+bool event_server::subscribe(server_client * client, string &error)
+{
+  istringstream lines(client->request);
+  string line;
+  string path;
+  bool recursive = false;
+  int regex_flags = 0;
+  vector<pair<bool, string>> filters;
+
+  while (getline(lines, line) && !line.empty())
+  {
+    const size_t space = line.find(' ');
+    const string keyword = line.substr(0, space);
+    const string argument = space == string::npos ? "" : line.substr(space + 1);
+
+    if (keyword == "WATCH" && !argument.empty())
+    {
+      path = argument;
+    }
+    else if (keyword == "RECURSIVE")
+    {
+      recursive = true;
+    }
+    else if (keyword == "INCLUDE" || keyword == "EXCLUDE")
+    {
+      filters.push_back({keyword == "INCLUDE", argument});
+    }
+#ifdef HAVE_REGCOMP
+    else if (keyword == "EXTENDED")
+    {
+      regex_flags |= REG_EXTENDED;
+    }
+    else if (keyword == "INSENSITIVE")
+    {
+      regex_flags |= REG_ICASE;
+    }
+#endif
+    else if (keyword == "QUEUE")
+    {
+      char * end;
+      errno = 0;
+      const unsigned long long limit = strtoull(argument.c_str(), &end, 10);
+
+      if (argument.empty() || *end != '\0' || limit == 0 || errno == ERANGE)
+      {
+        error = "Invalid queue limit: " + argument;
+        return false;
+      }
+
+      client->queue_limit = limit > SIZE_MAX ? SIZE_MAX : limit;
+    }
+    else
+    {
+      error = "Invalid request: " + line;
+      return false;
+    }
+  }
+
+  if (path.empty())
+  {
+    error = "No path to watch.";
+    return false;
+  }
+
+  for (const pair<bool, string> &filter : filters)
+  {
+#ifdef HAVE_REGCOMP
+    client_filter compiled;
+    compiled.include = filter.first;
+
+    if (::regcomp(&compiled.regex, filter.second.c_str(), regex_flags) != 0)
+    {
+      error = "Invalid regular expression: " + filter.second;
+      return false;
+    }
+
+    client->filters.push_back(compiled);
+#else
+    error = "Filters are not supported.";
+    return false;
+#endif
+  }
+
+  char * real_path = ::realpath(path.c_str(), nullptr);
+
+  if (!real_path)
+  {
+    error = path + ": " + strerror(errno);
+    return false;
+  }
+
+  const watch_key key(real_path, recursive);
+  ::free(real_path);
+
+  // Only this thread adds and removes watch sets.
+  auto found = watch_sets.find(key);
+
+  if (found == watch_sets.end())
+  {
+    unique_ptr<watch_set> set(new watch_set);
+    set->server = this;
+    set->root = key.first;
+
+    try
+    {
+      set->monitor.reset(factory({key.first}, recursive, publish, set.get()));
+    }
+    catch (exception &ex)
+    {
+      error = ex.what();
+      return false;
+    }
+
+    // Signals are handled by the thread of the server, not by the
+    // monitors, which inherit this mask.
+    sigset_t all_signals;
+    sigset_t previous_signals;
+    sigfillset(&all_signals);
+    pthread_sigmask(SIG_BLOCK, &all_signals, &previous_signals);
+
+    watch_set * started = set.get();
+
+    set->monitor_thread = thread([this, started]
+    {
+      try
+      {
+        started->monitor->start();
+      }
+      catch (exception &ex)
+      {
+        cerr << "Cannot watch " << started->root << ": " << ex.what() << endl;
+      }
+
+      // A monitor only returns when it is released or when it fails.
+      {
+        lock_guard<mutex> server_lock(server_mutex);
+        started->failed = true;
+      }
+
+      wake();
+    });
+
+    pthread_sigmask(SIG_SETMASK, &previous_signals, nullptr);
+
+    fsw_log(("Watching " + key.first + ".\n").c_str());
+
+    found = watch_sets.insert(make_pair(key, move(set))).first;
+  }
+
+  lock_guard<mutex> server_lock(server_mutex);
+  client->set = found->second.get();
+  client->set->subscribers.push_back(client);
+
+  return true;
+}
+
+bool event_server::read_client(server_client * client)
+{
+  char buffer[4096];
+
+  for (;;)
+  {
+    const ssize_t length = ::read(client->fd, buffer, sizeof (buffer));
+
+    if (length == 0) return false;
+
+    if (length < 0)
+    {
+      if (errno == EINTR) continue;
+
+      return errno == EAGAIN || errno == EWOULDBLOCK;
+    }
+
+    // Anything sent after the request is ignored.
+    if (client->set) continue;
+
+    client->request.append(buffer, length);
+
+    const bool complete = client->request[0] == '\n'
+      || client->request.find("\n\n") != string::npos;
+    string error;
+
+    if (!complete && client->request.size() <= MAX_REQUEST_SIZE) continue;
+
+    if (!complete)
+    {
+      error = "Request too long.";
+    }
+    else if (subscribe(client, error))
+    {
+      static const char ok[] = "OK\n";
+
+      client->request.clear();
+      client->request.shrink_to_fit();
+      client->output.assign(ok, ok + sizeof (ok) - 1);
+      client->output_offset = 0;
+
+      continue;
+    }
+
+    const string reply = "ERR " + error + "\n";
+
+    if (::write(client->fd, reply.data(), reply.size()) < 0)
+    {
+      // The connection is closed anyway.
+    }
+
+    return false;
+  }
+}
+
+void event_server::accept_clients()
+{
+  for (;;)
+  {
+    const int fd = ::accept(listen_fd, nullptr, nullptr);
+
+    if (fd < 0)
+    {
+      if (errno == EINTR || errno == ECONNABORTED) continue;
+      if (errno != EAGAIN && errno != EWOULDBLOCK) perror("accept");
+
+      return;
+    }
+
+    set_descriptor_flags(fd);
+    clients.emplace_back(new server_client(fd));
+  }
+}
+
+void event_server::close_client(server_client * client)
+{
+  if (client->set)
+  {
+    lock_guard<mutex> server_lock(server_mutex);
+    vector<server_client *> &subscribers = client->set->subscribers;
+
+    subscribers.erase(find(subscribers.begin(), subscribers.end(), client));
+
+    if (subscribers.empty()) client->set->idle_since = steady_clock::now();
+  }
+
+  for (auto it = clients.begin(); it != clients.end(); ++it)
+  {
+    if (it->get() != client) continue;
+
+    clients.erase(it);
+    break;
+  }
+}
+
+int event_server::release_watch_sets()
+{
+  vector<server_client *> orphans;
+
+  {
+    lock_guard<mutex> server_lock(server_mutex);
+
+    for (auto &entry : watch_sets)
+    {
+      if (entry.second->failed)
+      {
+        orphans.insert(orphans.end(),
+                       entry.second->subscribers.begin(),
+                       entry.second->subscribers.end());
+      }
+    }
+  }
+
+  // The clients of a monitor which failed are disconnected.
+  for (server_client * client : orphans) close_client(client);
+
+  const steady_clock::time_point now = steady_clock::now();
+  vector<unique_ptr<watch_set>> released;
+  int timeout_ms = -1;
+
+  {
+    lock_guard<mutex> server_lock(server_mutex);
+
+    for (auto it = watch_sets.begin(); it != watch_sets.end();)
+    {
+      watch_set * set = it->second.get();
+
+      if (!set->subscribers.empty())
+      {
+        ++it;
+        continue;
+      }
+
+      const steady_clock::time_point expiry = set->idle_since + idle_timeout;
+
+      if (set->failed || expiry <= now)
+      {
+        released.push_back(move(it->second));
+        it = watch_sets.erase(it);
+        continue;
+      }
+
+      const int64_t remaining = duration_cast<milliseconds> (expiry - now).count() + 1;
+
+      if (timeout_ms < 0 || remaining < timeout_ms)
+        timeout_ms = remaining > INT_MAX ? INT_MAX : static_cast<int> (remaining);
+
+      ++it;
+    }
+  }
+
+  // The monitors are stopped without holding the lock their callback takes.
+  for (unique_ptr<watch_set> &set : released)
+  {
+    fsw_log(("Releasing " + set->root + ".\n").c_str());
+
+    set->monitor->stop();
+    set->monitor_thread.join();
+  }
+
+  return timeout_ms;
+}
+
+void event_server::run()
+{
+  vector<struct pollfd> fds;
+
+  for (;;)
+  {
+    const int timeout_ms = release_watch_sets();
+
+    fds.clear();
+    fds.push_back({listen_fd, POLLIN, 0});
+    fds.push_back({wake_pipe[0], POLLIN, 0});
+
+    for (const unique_ptr<server_client> &client : clients)
+    {
+      short events = POLLIN;
+
+      if (client->output_offset < client->output.size()) events |= POLLOUT;
+
+      fds.push_back({client->fd, events, 0});
+    }
+
+    if (::poll(fds.data(), fds.size(), timeout_ms) < 0)
+    {
+      if (errno == EINTR) continue;
+
+      throw runtime_error(string("poll: ") + strerror(errno));
+    }
+
+    if (fds[1].revents & POLLIN)
+    {
+      char drain[256];
+      while (::read(wake_pipe[0], drain, sizeof (drain)) > 0);
+    }
+
+    // The descriptors polled are those of the first clients, in order.
+    vector<server_client *> closing;
+
+    for (size_t i = 2; i < fds.size(); ++i)
+    {
+      server_client * client = clients[i - 2].get();
+      bool open = true;
+
+      if (fds[i].revents & (POLLIN | POLLHUP | POLLERR)) open = read_client(client);
+      if (open && client->set) open = send_events(client);
+      if (!open) closing.push_back(client);
+    }
+
+    for (server_client * client : closing) close_client(client);
+
+    if (fds[0].revents & POLLIN) accept_clients();
+  }
+}
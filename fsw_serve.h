@@ -0,0 +1,115 @@
+/* 
+ * Copyright (C) 2014, Enrico M. Crisostomo
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 3, or (at your option)
+ * any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+#ifndef FSW_SERVE_H
+#  define FSW_SERVE_H
+
+#  include <chrono>
+#  include <functional>
+#  include <map>
+#  include <memory>
+#  include <mutex>
+#  include <string>
+#  include <utility>
+#  include <vector>
+#  include "libfsw/c++/monitor.h"
+
+/*
+ * Creates a monitor configured with the options of fsw for the given paths.
+ */
+typedef std::function<fsw::monitor * (const std::vector<std::string> &paths,
+                                      bool recursive,
+                                      fsw::FSW_EVENT_BATCH_CALLBACK * callback,
+                                      void * context)> monitor_factory;
+
+struct watch_set;
+struct server_client;
+
+/*
+ * Daemon serving events to the clients of a Unix domain socket, so that
+ * many consumers watching the same tree share a single monitor.
+ *
+ * A client connects and sends a request made of text lines, terminated by an
+ * empty line:
+ *
+ *   WATCH path        the root to watch (required)
+ *   RECURSIVE         watch the root recursively
+ *   INCLUDE regex     include the paths matching regex
+ *   EXCLUDE regex     exclude the paths matching regex
+ *   EXTENDED          use extended regular expressions
+ *   INSENSITIVE       use case insensitive regular expressions
+ *   QUEUE bytes       memory the client may hold in queued batches
+ *
+ * The server answers with a line, either OK or ERR followed by a message (in
+ * which case it closes the connection), and then sends the events as
+ * frames, all integers being little-endian:
+ *
+ *   uint32  length of the rest of the frame
+ *   uint32  number of events
+ *   events  records in the format of fsw --format binary
+ *
+ * The server runs one monitor per distinct root and recursion, shared by all
+ * the clients watching it, and releases it once it has had no client for
+ * the idle timeout.  The batches of a monitor are queued by reference for
+ * each of its clients, which filter them as they are sent.  A client which
+ * does not keep up loses its oldest queued batches once they exceed its
+ * queue limit, and then receives an event with the Overflow flag, without
+ * slowing down the monitor or the other clients.
+ */
+class event_server
+{
+public:
+  event_server(const std::string &socket_path,
+               monitor_factory factory,
+               double idle_timeout);
+  event_server(const event_server &orig) = delete;
+  event_server& operator=(const event_server &that) = delete;
+
+  const std::string & get_socket_path() const;
+
+  /*
+   * Serves the clients until the program exits.
+   */
+  void run();
+
+  static const size_t DEFAULT_QUEUE_LIMIT = 16 << 20;
+
+private:
+  typedef std::pair<std::string, bool> watch_key;
+
+  static void publish(fsw::event_batch &events, void * context);
+
+  void wake();
+  void accept_clients();
+  bool read_client(server_client * client);
+  bool subscribe(server_client * client, std::string &error);
+  bool send_events(server_client * client);
+  void close_client(server_client * client);
+  int release_watch_sets();
+
+  std::string socket_path;
+  monitor_factory factory;
+  std::chrono::steady_clock::duration idle_timeout;
+  int listen_fd = -1;
+  int wake_pipe[2] = {-1, -1};
+
+  // Guards the subscribers of the watch sets and the queues of the clients.
+  std::mutex server_mutex;
+  std::map<watch_key, std::unique_ptr<watch_set>> watch_sets;
+  std::vector<std::unique_ptr<server_client>> clients;
+};
+
+#endif  /* FSW_SERVE_H */
@@ -0,0 +1,159 @@
+/* 
+ * Copyright (C) 2014, Enrico M. Crisostomo
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 3, or (at your option)
+ * any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+#ifdef HAVE_CONFIG_H
+#  include "libfsw_config.h"
+#endif
+
+#include <algorithm>
+#include "batch_codec.h"
+
+using namespace std;
+
+namespace fsw
+{
+
+  static uint64_t zigzag(int64_t value)
+  {
+    return (static_cast<uint64_t> (value) << 1) ^ static_cast<uint64_t> (value >> 63);
+  }
+
+  static int64_t unzigzag(uint64_t value)
+  {
+    return static_cast<int64_t> (value >> 1) ^ -static_cast<int64_t> (value & 1);
+  }
+
+  void put_varint(vector<unsigned char> &out, uint64_t value)
+  {
+    while (value >= 0x80)
+    {
+      out.push_back(static_cast<unsigned char> (value | 0x80));
+      value >>= 7;
+    }
+
+    out.push_back(static_cast<unsigned char> (value));
+  }
+
+  size_t put_varint(unsigned char * out, uint64_t value)
+  {
+    size_t size = 0;
+
+    while (value >= 0x80)
+    {
+      out[size++] = static_cast<unsigned char> (value | 0x80);
+      value >>= 7;
+    }
+
+    out[size++] = static_cast<unsigned char> (value);
+
+    return size;
+  }
+
+  bool get_varint(const unsigned char *& p,
+                  const unsigned char * end,
+                  uint64_t &value)
+  {
+    value = 0;
+
+    for (unsigned int shift = 0; p < end && shift < 64; shift += 7)
+    {
+      const unsigned char byte = *p++;
+      value |= static_cast<uint64_t> (byte & 0x7f) << shift;
+
+      if (!(byte & 0x80)) return true;
+    }
+
+    return false;
+  }
+
+  void batch_encoder::encode(const event_batch &events, vector<unsigned char> &out)
+  {
+    put_varint(out, events.size());
+
+    for (size_t i = 0; i < events.size(); ++i)
+    {
+      const compact_event evt = events[i];
+      const uint64_t time = evt.get_time_ns();
+      const char * path = evt.get_path();
+      const size_t length = evt.get_path_length();
+      const size_t max_prefix = min(length, last_path.size());
+      size_t prefix = 0;
+
+      while (prefix < max_prefix && path[prefix] == last_path[prefix]) ++prefix;
+
+      put_varint(out, zigzag(static_cast<int64_t> (time - last_time)));
+      put_varint(out, evt.get_flags());
+      put_varint(out, prefix);
+      put_varint(out, length - prefix);
+      out.insert(out.end(), path + prefix, path + length);
+
+      last_time = time;
+      last_path.replace(prefix, string::npos, path + prefix, length - prefix);
+    }
+  }
+
+  void batch_encoder::reset()
+  {
+    last_time = 0;
+    last_path.clear();
+  }
+
+  bool batch_decoder::decode(const unsigned char *& p,
+                             const unsigned char * end,
+                             event_batch &events)
+  {
+    uint64_t count;
+
+    // Every event takes at least 4 bytes.
+    if (!get_varint(p, end, count) || count > static_cast<uint64_t> (end - p) / 4)
+      return false;
+
+    const uint64_t monotonic_ns = get_monotonic_time_ns();
+
+    for (uint64_t i = 0; i < count; ++i)
+    {
+      uint64_t time_delta;
+      uint64_t flags;
+      uint64_t prefix;
+      uint64_t suffix;
+
+      if (!get_varint(p, end, time_delta)
+          || !get_varint(p, end, flags)
+          || !get_varint(p, end, prefix)
+          || !get_varint(p, end, suffix)
+          || prefix > last_path.size()
+          || suffix > static_cast<uint64_t> (end - p))
+        return false;
+
+      last_path.replace(prefix, string::npos, reinterpret_cast<const char *> (p), suffix);
+      last_time += unzigzag(time_delta);
+      p += suffix;
+
+      events.add(last_path.data(),
+                 last_path.size(),
+                 {last_time, monotonic_ns},
+                 static_cast<uint32_t> (flags));
+    }
+
+    return true;
+  }
+
+  void batch_decoder::reset()
+  {
+    last_time = 0;
+    last_path.clear();
+  }
+}
@@ -0,0 +1,106 @@
+/* 
+ * Copyright (C) 2014, Enrico M. Crisostomo
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 3, or (at your option)
+ * any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+#ifndef FSW_BATCH_CODEC_H
+#  define FSW_BATCH_CODEC_H
+
+#  include <cstdint>
+#  include <string>
+#  include <vector>
+#  include "event_batch.h"
+
+namespace fsw
+{
+
+  /*
+   * Compact binary encoding of batches of events, used by event logs (see
+   * event_log.h) and by the network relay of fsw.  Integers are unsigned
+   * LEB128 varints; signed values are zigzag-encoded first.
+   *
+   * An encoded batch is made of:
+   *
+   *   varint   number of events
+   *   event*
+   *
+   * An event is made of:
+   *
+   *   varint   signed difference between its time, in nanoseconds since
+   *            the Epoch, and the time of the previous event
+   *   varint   flags
+   *   varint   length of the prefix shared with the path of the previous
+   *            event
+   *   varint   length of the rest of the path
+   *   bytes    rest of the path
+   *
+   * The previous time and path start at 0 and at the empty string and carry
+   * over from one batch to the next, until the encoder or the decoder is
+   * reset.  Sequence numbers, last times and file information are not
+   * encoded.
+   */
+  class batch_encoder
+  {
+  public:
+    /*
+     * Appends the encoding of events to out.
+     */
+    void encode(const event_batch &events, std::vector<unsigned char> &out);
+    void reset();
+
+  private:
+    uint64_t last_time = 0;
+    std::string last_path;
+  };
+
+  class batch_decoder
+  {
+  public:
+    /*
+     * Decodes the batch starting at p, which is advanced past it, appending
+     * its events to events.  The monotonic time of the events is the time
+     * at which they are decoded.  It returns false if the batch is
+     * malformed or does not end before end.
+     */
+    bool decode(const unsigned char *& p,
+                const unsigned char * end,
+                event_batch &events);
+    void reset();
+
+  private:
+    uint64_t last_time = 0;
+    std::string last_path;
+  };
+
+  // Largest encoding of a varint.
+  static const size_t MAX_VARINT_SIZE = 10;
+
+  void put_varint(std::vector<unsigned char> &out, uint64_t value);
+
+  /*
+   * Stores the varint into out, which must have room for MAX_VARINT_SIZE
+   * bytes, and returns its size.
+   */
+  size_t put_varint(unsigned char * out, uint64_t value);
+
+  /*
+   * Reads the varint starting at p into value and advances p past it.  It
+   * returns false if the varint does not end before end.
+   */
+  bool get_varint(const unsigned char *& p,
+                  const unsigned char * end,
+                  uint64_t &value);
+}
+
+#endif  /* FSW_BATCH_CODEC_H */
@@ -18,8 +18,20 @@
 
 using namespace std;
 
-event::event(string path, time_t evt_time, vector<fsw_event_flag> flags) :
-  path(path), evt_time(evt_time), evt_flags(flags)
+event::event(string path,
+             time_t evt_time,
+             vector<fsw_event_flag> flags,
+             uint64_t evt_time_ns,
+             uint64_t monotonic_time_ns,
+             const fsw_event_stat &stat,
+             uint64_t sequence) :
+  path(path),
+  evt_time(evt_time),
+  evt_time_ns(evt_time_ns ? evt_time_ns : static_cast<uint64_t> (evt_time) * 1000000000ULL),
+  monotonic_time_ns(monotonic_time_ns),
+  stat(stat),
+  sequence(sequence),
+  evt_flags(flags)
 {
 }
 
@@ -27,7 +39,7 @@ event::~event()
 {
 }
 
-string event::get_path() const
+const string & event::get_path() const
 {
   return path;
 }
@@ -37,7 +49,56 @@ time_t event::get_time() const
   return evt_time;
 }
 
-vector<fsw_event_flag> event::get_flags() const
+uint64_t event::get_time_ns() const
+{
+  return evt_time_ns;
+}
+
+uint64_t event::get_monotonic_time_ns() const
+{
+  return monotonic_time_ns;
+}
+
+const fsw_event_stat & event::get_stat() const
+{
+  return stat;
+}
+
+uint64_t event::get_sequence() const
+{
+  return sequence;
+}
+
+const vector<fsw_event_flag> & event::get_flags() const
 {
   return evt_flags;
 }
+
+uint32_t event::get_flag_mask() const
+{
+  return encode_flag_mask(evt_flags);
+}
+
+vector<fsw_event_flag> event::decode_flag_mask(uint32_t mask)
+{
+  vector<fsw_event_flag> flags;
+
+  for (uint32_t bit = 1; bit && bit <= mask; bit <<= 1)
+  {
+    if (mask & bit) flags.push_back(static_cast<fsw_event_flag> (bit));
+  }
+
+  return flags;
+}
+
+uint32_t event::encode_flag_mask(const vector<fsw_event_flag> &flags)
+{
+  uint32_t mask = 0;
+
+  for (const fsw_event_flag &flag : flags)
+  {
+    mask |= static_cast<uint32_t> (flag);
+  }
+
+  return mask;
+}
@@ -20,20 +20,44 @@
 #  include <string>
 #  include <ctime>
 #  include <vector>
+#  include <cstdint>
 #  include "../c/cevent.h"
 
+/*
+ * Compatibility event type used by FSW_EVENT_CALLBACK.  Monitors internally
+ * produce fsw::event_batch instances (see event_batch.h) and only build
+ * instances of this class when a legacy callback is registered.
+ */
 class event
 {
 public:
-  event(std::string path, time_t evt_time, std::vector<fsw_event_flag> flags);
+  event(std::string path,
+        time_t evt_time,
+        std::vector<fsw_event_flag> flags,
+        uint64_t evt_time_ns = 0,
+        uint64_t monotonic_time_ns = 0,
+        const fsw_event_stat &stat = fsw_event_stat(),
+        uint64_t sequence = 0);
   virtual ~event();
-  std::string get_path() const;
+  const std::string & get_path() const;
   time_t get_time() const;
-  std::vector<fsw_event_flag> get_flags() const;
+  uint64_t get_time_ns() const;
+  uint64_t get_monotonic_time_ns() const;
+  const fsw_event_stat & get_stat() const;
+  uint64_t get_sequence() const;
+  const std::vector<fsw_event_flag> & get_flags() const;
+  uint32_t get_flag_mask() const;
+
+  static std::vector<fsw_event_flag> decode_flag_mask(uint32_t mask);
+  static uint32_t encode_flag_mask(const std::vector<fsw_event_flag> &flags);
 
 private:
   std::string path;
   time_t evt_time;
+  uint64_t evt_time_ns;
+  uint64_t monotonic_time_ns;
+  fsw_event_stat stat;
+  uint64_t sequence;
   std::vector<fsw_event_flag> evt_flags;
 };
 
@@ -0,0 +1,437 @@
+/* 
+ * Copyright (C) 2014, Enrico M. Crisostomo
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 3, or (at your option)
+ * any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+#include "event_batch.h"
+#include <cstring>
+
+using namespace std;
+
+namespace fsw
+{
+
+  compact_event::compact_event(const char * path,
+                               size_t path_length,
+                               uint64_t evt_time_ns,
+                               uint64_t monotonic_time_ns,
+                               uint64_t last_time_ns,
+                               uint32_t flags,
+                               uint64_t sequence,
+                               const fsw_event_stat * stat) :
+    path(path),
+    path_length(path_length),
+    evt_time_ns(evt_time_ns),
+    monotonic_time_ns(monotonic_time_ns),
+    last_time_ns(last_time_ns),
+    flags(flags),
+    sequence(sequence),
+    stat(stat)
+  {
+  }
+
+  // Returned for events without file information.
+  static const fsw_event_stat invalid_stat = fsw_event_stat();
+
+  const char * compact_event::get_path() const
+  {
+    return path;
+  }
+
+  size_t compact_event::get_path_length() const
+  {
+    return path_length;
+  }
+
+  time_t compact_event::get_time() const
+  {
+    return event_timestamp_to_time(evt_time_ns);
+  }
+
+  uint64_t compact_event::get_time_ns() const
+  {
+    return evt_time_ns;
+  }
+
+  uint64_t compact_event::get_monotonic_time_ns() const
+  {
+    return monotonic_time_ns;
+  }
+
+  uint64_t compact_event::get_last_time_ns() const
+  {
+    return last_time_ns;
+  }
+
+  uint32_t compact_event::get_flags() const
+  {
+    return flags;
+  }
+
+  bool compact_event::has_flag(fsw_event_flag flag) const
+  {
+    return (flags & static_cast<uint32_t> (flag)) != 0;
+  }
+
+  uint64_t compact_event::get_sequence() const
+  {
+    return sequence;
+  }
+
+  const fsw_event_stat & compact_event::get_stat() const
+  {
+    return stat ? *stat : invalid_stat;
+  }
+
+  event compact_event::to_event() const
+  {
+    return event(string(path, path_length),
+                 get_time(),
+                 event::decode_flag_mask(flags),
+                 evt_time_ns,
+                 monotonic_time_ns,
+                 get_stat(),
+                 sequence);
+  }
+
+  event_batch::event_batch(event_batch &&orig) noexcept :
+    flags(std::move(orig.flags)),
+    times(std::move(orig.times)),
+    monotonic_times(std::move(orig.monotonic_times)),
+    last_times(std::move(orig.last_times)),
+    sequences(std::move(orig.sequences)),
+    path_offsets(std::move(orig.path_offsets)),
+    paths(std::move(orig.paths)),
+    stats(std::move(orig.stats))
+  {
+    orig.clear();
+  }
+
+  event_batch& event_batch::operator=(event_batch &&that) noexcept
+  {
+    if (this != &that)
+    {
+      flags = std::move(that.flags);
+      times = std::move(that.times);
+      monotonic_times = std::move(that.monotonic_times);
+      last_times = std::move(that.last_times);
+      sequences = std::move(that.sequences);
+      path_offsets = std::move(that.path_offsets);
+      paths = std::move(that.paths);
+      stats = std::move(that.stats);
+      that.clear();
+    }
+
+    return *this;
+  }
+
+  void event_batch::add(const char * path,
+                        size_t path_length,
+                        const event_timestamp &evt_time,
+                        uint32_t flags)
+  {
+    this->flags.push_back(flags);
+    times.push_back(evt_time.realtime_ns);
+    monotonic_times.push_back(evt_time.monotonic_ns);
+    last_times.push_back(evt_time.realtime_ns);
+    sequences.push_back(0);
+    path_offsets.push_back(paths.size());
+    paths.insert(paths.end(), path, path + path_length);
+    paths.push_back('\0');
+  }
+
+  void event_batch::add(const string &path,
+                        const event_timestamp &evt_time,
+                        uint32_t flags)
+  {
+    add(path.c_str(), path.length(), evt_time, flags);
+  }
+
+  void event_batch::add(const string &dir,
+                        const char * name,
+                        const event_timestamp &evt_time,
+                        uint32_t flags)
+  {
+    this->flags.push_back(flags);
+    times.push_back(evt_time.realtime_ns);
+    monotonic_times.push_back(evt_time.monotonic_ns);
+    last_times.push_back(evt_time.realtime_ns);
+    sequences.push_back(0);
+    path_offsets.push_back(paths.size());
+    paths.insert(paths.end(), dir.begin(), dir.end());
+    paths.push_back('/');
+    paths.insert(paths.end(), name, name + ::strlen(name));
+    paths.push_back('\0');
+  }
+
+  void event_batch::add(const event_batch &other, size_t i)
+  {
+    const char * path = other.get_path(i);
+
+    flags.push_back(other.flags[i]);
+    times.push_back(other.times[i]);
+    monotonic_times.push_back(other.monotonic_times[i]);
+    last_times.push_back(other.last_times[i]);
+    sequences.push_back(other.sequences[i]);
+    path_offsets.push_back(paths.size());
+    paths.insert(paths.end(), path, path + other.get_path_length(i) + 1);
+
+    if (i < other.stats.size() && other.stats[i].valid)
+    {
+      set_stat(size() - 1, other.stats[i]);
+    }
+  }
+
+  void event_batch::merge(size_t i, uint32_t flags, uint64_t last_time_ns)
+  {
+    this->flags[i] |= flags;
+
+    if (last_time_ns > last_times[i]) last_times[i] = last_time_ns;
+  }
+
+  void event_batch::set_stat(size_t i, const fsw_event_stat &stat)
+  {
+    if (stats.size() <= i) stats.resize(size());
+
+    stats[i] = stat;
+  }
+
+  uint64_t event_batch::assign_sequences(uint64_t first_sequence)
+  {
+    for (uint64_t &sequence : sequences)
+    {
+      sequence = first_sequence++;
+    }
+
+    return first_sequence;
+  }
+
+  const vector<uint64_t> & event_batch::get_sequences() const
+  {
+    return sequences;
+  }
+
+  const fsw_event_stat & event_batch::get_stat(size_t i) const
+  {
+    return i < stats.size() ? stats[i] : invalid_stat;
+  }
+
+  bool event_batch::has_stats() const
+  {
+    return !stats.empty();
+  }
+
+  size_t event_batch::size() const
+  {
+    return flags.size();
+  }
+
+  bool event_batch::empty() const
+  {
+    return flags.empty();
+  }
+
+  size_t event_batch::capacity() const
+  {
+    return flags.capacity();
+  }
+
+  static const size_t EVENT_SIZE = sizeof (uint32_t)
+    + 4 * sizeof (uint64_t)
+    + sizeof (size_t);
+
+  size_t event_batch::get_memory_usage() const
+  {
+    return flags.size() * EVENT_SIZE
+      + stats.size() * sizeof (fsw_event_stat)
+      + paths.size();
+  }
+
+  size_t event_batch::get_memory_usage(size_t i) const
+  {
+    // Copied to another batch, the event may bring along the file
+    // information of the events preceding it.
+    return EVENT_SIZE
+      + (stats.empty() ? 0 : sizeof (fsw_event_stat))
+      + get_path_length(i) + 1;
+  }
+
+  void event_batch::reserve(size_t events, size_t path_bytes)
+  {
+    flags.reserve(events);
+    times.reserve(events);
+    monotonic_times.reserve(events);
+    last_times.reserve(events);
+    sequences.reserve(events);
+    path_offsets.reserve(events);
+    paths.reserve(path_bytes);
+  }
+
+  void event_batch::clear()
+  {
+    flags.clear();
+    times.clear();
+    monotonic_times.clear();
+    last_times.clear();
+    sequences.clear();
+    path_offsets.clear();
+    paths.clear();
+    stats.clear();
+  }
+
+  void event_batch::swap(event_batch &other) noexcept
+  {
+    flags.swap(other.flags);
+    times.swap(other.times);
+    monotonic_times.swap(other.monotonic_times);
+    last_times.swap(other.last_times);
+    sequences.swap(other.sequences);
+    path_offsets.swap(other.path_offsets);
+    paths.swap(other.paths);
+    stats.swap(other.stats);
+  }
+
+  compact_event event_batch::operator[](size_t i) const
+  {
+    return compact_event(get_path(i),
+                         get_path_length(i),
+                         times[i],
+                         monotonic_times[i],
+                         last_times[i],
+                         flags[i],
+                         sequences[i],
+                         i < stats.size() ? &stats[i] : nullptr);
+  }
+
+  const char * event_batch::get_path(size_t i) const
+  {
+    return &paths[path_offsets[i]];
+  }
+
+  size_t event_batch::get_path_length(size_t i) const
+  {
+    const size_t end = (i + 1 < path_offsets.size()) ? path_offsets[i + 1] : paths.size();
+
+    // Exclude the NUL terminator.
+    return end - path_offsets[i] - 1;
+  }
+
+  const vector<uint32_t> & event_batch::get_flags() const
+  {
+    return flags;
+  }
+
+  const vector<uint64_t> & event_batch::get_times_ns() const
+  {
+    return times;
+  }
+
+  const vector<uint64_t> & event_batch::get_monotonic_times_ns() const
+  {
+    return monotonic_times;
+  }
+
+  const vector<uint64_t> & event_batch::get_last_times_ns() const
+  {
+    return last_times;
+  }
+
+  const vector<size_t> & event_batch::get_path_offsets() const
+  {
+    return path_offsets;
+  }
+
+  const vector<char> & event_batch::get_path_arena() const
+  {
+    return paths;
+  }
+
+  vector<event> event_batch::to_events() const
+  {
+    vector<event> events;
+    events.reserve(size());
+
+    for (size_t i = 0; i < size(); ++i)
+    {
+      events.push_back((*this)[i].to_event());
+    }
+
+    return events;
+  }
+
+  uint64_t hash_path(const char * path, size_t path_length)
+  {
+    uint64_t hash = 14695981039346656037ULL;
+
+    for (size_t i = 0; i < path_length; ++i)
+    {
+      hash ^= static_cast<unsigned char> (path[i]);
+      hash *= 1099511628211ULL;
+    }
+
+    return hash;
+  }
+
+  event_batch_pool::event_batch_pool(size_t max_batches) :
+    max_batches(max_batches)
+  {
+  }
+
+  event_batch event_batch_pool::acquire()
+  {
+    lock_guard<mutex> pool_guard(pool_mutex);
+
+    if (batches.empty()) return event_batch();
+
+    event_batch batch(std::move(batches.back()));
+    batches.pop_back();
+
+    return batch;
+  }
+
+  void event_batch_pool::release(event_batch &&batch)
+  {
+    batch.clear();
+
+    lock_guard<mutex> pool_guard(pool_mutex);
+
+    if (batches.size() < max_batches)
+    {
+      batches.push_back(std::move(batch));
+    }
+  }
+
+  size_t event_batch_pool::size()
+  {
+    lock_guard<mutex> pool_guard(pool_mutex);
+
+    return batches.size();
+  }
+
+  shared_ptr<const event_batch>
+  share_batch(event_batch &events, const shared_ptr<event_batch_pool> &pool)
+  {
+    event_batch * shared = new event_batch(pool->acquire());
+    shared->swap(events);
+
+    shared_ptr<event_batch_pool> batch_pool = pool;
+
+    return shared_ptr<const event_batch>(shared, [batch_pool](const event_batch * b)
+    {
+      event_batch * owned = const_cast<event_batch *> (b);
+      batch_pool->release(std::move(*owned));
+      delete owned;
+    });
+  }
+}
@@ -0,0 +1,191 @@
+/* 
+ * Copyright (C) 2014, Enrico M. Crisostomo
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 3, or (at your option)
+ * any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+#ifndef FSW_EVENT_BATCH_H
+#  define FSW_EVENT_BATCH_H
+
+#  include <string>
+#  include <vector>
+#  include <memory>
+#  include <mutex>
+#  include <ctime>
+#  include <cstddef>
+#  include <cstdint>
+#  include "event.h"
+#  include "event_timestamp.h"
+#  include "../c/cevent.h"
+
+namespace fsw
+{
+
+  /*
+   * Lightweight, non-owning view of an event stored in an event_batch.  The
+   * path points into the arena of the batch the event was obtained from and is
+   * only valid as long as that batch is neither modified nor destroyed.
+   */
+  class compact_event
+  {
+  public:
+    compact_event(const char * path,
+                  size_t path_length,
+                  uint64_t evt_time_ns,
+                  uint64_t monotonic_time_ns,
+                  uint64_t last_time_ns,
+                  uint32_t flags,
+                  uint64_t sequence = 0,
+                  const fsw_event_stat * stat = nullptr);
+    const char * get_path() const;
+    size_t get_path_length() const;
+    time_t get_time() const;
+    uint64_t get_time_ns() const;
+    uint64_t get_monotonic_time_ns() const;
+    uint64_t get_last_time_ns() const;
+    uint32_t get_flags() const;
+    bool has_flag(fsw_event_flag flag) const;
+    uint64_t get_sequence() const;
+    const fsw_event_stat & get_stat() const;
+    event to_event() const;
+
+  private:
+    const char * path;
+    size_t path_length;
+    uint64_t evt_time_ns;
+    uint64_t monotonic_time_ns;
+    uint64_t last_time_ns;
+    uint32_t flags;
+    uint64_t sequence;
+    const fsw_event_stat * stat;
+  };
+
+  /*
+   * Batch of events stored as a structure of arrays: the flags, the
+   * timestamps (in nanoseconds, see event_timestamp.h) and the path
+   * offsets of the events are kept in contiguous arrays indexed by event
+   * number, while paths are stored NUL-terminated in a single character
+   * arena owned by the batch.  The path of event i starts at
+   * get_path_offsets()[i] in get_path_arena().
+   *
+   * The last time of an event is the time of the last event merged into it
+   * when coalescing is enabled (see monitor::set_coalesce_events()), and is
+   * otherwise equal to its time.
+   *
+   * Sequence numbers are 0 until the monitor assigns them, right before
+   * the batch is delivered.
+   *
+   * File information (see stat_enricher.h) is stored in a separate array
+   * which is only populated once the information of an event is set.
+   *
+   * Clearing a batch retains the allocated capacity, so that a batch reused
+   * across notifications performs no heap allocations once it has grown to
+   * its steady-state size.  A batch can be moved to another owner (e.g.
+   * another thread) without copying any of its arrays.  get_memory_usage()
+   * estimates the memory used by the events of the batch, regardless of its
+   * capacity; given an index, it bounds the memory used by a single event.
+   */
+  class event_batch
+  {
+  public:
+    event_batch() = default;
+    event_batch(const event_batch &orig) = default;
+    event_batch(event_batch &&orig) noexcept;
+    event_batch& operator=(const event_batch &that) = default;
+    event_batch& operator=(event_batch &&that) noexcept;
+
+    void add(const char * path,
+             size_t path_length,
+             const event_timestamp &evt_time,
+             uint32_t flags);
+    void add(const std::string &path,
+             const event_timestamp &evt_time,
+             uint32_t flags);
+    void add(const std::string &dir,
+             const char * name,
+             const event_timestamp &evt_time,
+             uint32_t flags);
+    void add(const event_batch &other, size_t i);
+    void merge(size_t i, uint32_t flags, uint64_t last_time_ns);
+    void set_stat(size_t i, const fsw_event_stat &stat);
+    uint64_t assign_sequences(uint64_t first_sequence);
+    size_t size() const;
+    bool empty() const;
+    size_t capacity() const;
+    size_t get_memory_usage() const;
+    size_t get_memory_usage(size_t i) const;
+    void reserve(size_t events, size_t path_bytes);
+    void clear();
+    void swap(event_batch &other) noexcept;
+
+    compact_event operator[](size_t i) const;
+    const char * get_path(size_t i) const;
+    size_t get_path_length(size_t i) const;
+    const std::vector<uint32_t> & get_flags() const;
+    const std::vector<uint64_t> & get_times_ns() const;
+    const std::vector<uint64_t> & get_monotonic_times_ns() const;
+    const std::vector<uint64_t> & get_last_times_ns() const;
+    const std::vector<uint64_t> & get_sequences() const;
+    const fsw_event_stat & get_stat(size_t i) const;
+    bool has_stats() const;
+    const std::vector<size_t> & get_path_offsets() const;
+    const std::vector<char> & get_path_arena() const;
+    std::vector<event> to_events() const;
+
+  private:
+    std::vector<uint32_t> flags;
+    std::vector<uint64_t> times;
+    std::vector<uint64_t> monotonic_times;
+    std::vector<uint64_t> last_times;
+    std::vector<uint64_t> sequences;
+    std::vector<size_t> path_offsets;
+    std::vector<char> paths;
+    std::vector<fsw_event_stat> stats;
+  };
+
+  /*
+   * FNV-1a hash of a path, used to index events by path.
+   */
+  uint64_t hash_path(const char * path, size_t path_length);
+
+  /*
+   * Thread-safe pool of cleared batches.  A consumer that takes ownership of
+   * a batch can give it back to the pool of the monitor it was received from
+   * once it is done, so that the batch storage is recycled instead of being
+   * reallocated by the monitor.
+   */
+  class event_batch_pool
+  {
+  public:
+    explicit event_batch_pool(size_t max_batches = 16);
+    event_batch acquire();
+    void release(event_batch &&batch);
+    size_t size();
+
+  private:
+    std::mutex pool_mutex;
+    std::vector<event_batch> batches;
+    size_t max_batches;
+  };
+
+  /*
+   * Takes over the events of a batch, leaving it with storage recycled from
+   * the pool, and returns them as an immutable batch which can be shared
+   * across threads.  The storage returns to the pool when the last
+   * reference is dropped.
+   */
+  std::shared_ptr<const event_batch>
+  share_batch(event_batch &events, const std::shared_ptr<event_batch_pool> &pool);
+}
+
+#endif  /* FSW_EVENT_BATCH_H */
@@ -0,0 +1,125 @@
+/* 
+ * Copyright (C) 2014, Enrico M. Crisostomo
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 3, or (at your option)
+ * any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+#include "event_coalescer.h"
+#include <algorithm>
+#include <cstring>
+
+using namespace std;
+
+namespace fsw
+{
+
+  // Marks an empty slot of the path index.
+  static const size_t EMPTY_SLOT = static_cast<size_t> (-1);
+
+  // Flags which do not describe a change to the contents of a path and can
+  // therefore be merged into an event which has already been removed.
+  static const uint32_t REMOVED_MERGEABLE_FLAGS =
+    fsw_event_flag::Removed
+    | fsw_event_flag::PlatformSpecific
+    | fsw_event_flag::IsFile
+    | fsw_event_flag::IsDir
+    | fsw_event_flag::IsSymLink;
+
+  static bool can_merge(uint32_t existing, uint32_t incoming)
+  {
+    if (!(existing & fsw_event_flag::Removed)) return true;
+
+    return (incoming & ~REMOVED_MERGEABLE_FLAGS) == 0;
+  }
+
+  size_t event_coalescer::find_slot(const event_batch &out,
+                                    const char * path,
+                                    size_t path_length,
+                                    uint64_t hash) const
+  {
+    const size_t mask = table_size - 1;
+    size_t slot = static_cast<size_t> (hash) & mask;
+
+    while (slots[slot] != EMPTY_SLOT)
+    {
+      const size_t i = slots[slot];
+
+      if (hashes[slot] == hash
+          && out.get_path_length(i) == path_length
+          && ::memcmp(out.get_path(i), path, path_length) == 0)
+      {
+        break;
+      }
+
+      slot = (slot + 1) & mask;
+    }
+
+    return slot;
+  }
+
+  void event_coalescer::coalesce(const event_batch &in, event_batch &out)
+  {
+    out.clear();
+
+    // Keep the load factor of the table below 50%.  Only the part of the
+    // table needed by the current batch is used and reset.
+    table_size = 16;
+    while (table_size < in.size() * 2) table_size <<= 1;
+
+    if (slots.size() < table_size)
+    {
+      slots.resize(table_size);
+      hashes.resize(table_size);
+    }
+
+    fill(slots.begin(), slots.begin() + table_size, EMPTY_SLOT);
+
+    const vector<uint32_t> &flags = in.get_flags();
+    const vector<uint64_t> &last_times = in.get_last_times_ns();
+
+    for (size_t i = 0; i < in.size(); ++i)
+    {
+      const char * path = in.get_path(i);
+      const size_t path_length = in.get_path_length(i);
+      const uint64_t hash = hash_path(path, path_length);
+      const size_t slot = find_slot(out, path, path_length, hash);
+
+      if (slots[slot] != EMPTY_SLOT
+          && can_merge(out.get_flags()[slots[slot]], flags[i]))
+      {
+        out.merge(slots[slot], flags[i], last_times[i]);
+
+        // Keep the most recent file information known for the path.
+        if (in.get_stat(i).valid) out.set_stat(slots[slot], in.get_stat(i));
+
+        continue;
+      }
+
+      // Later events for this path are merged into the new event.
+      slots[slot] = out.size();
+      hashes[slot] = hash;
+      out.add(in, i);
+    }
+
+    events_in.fetch_add(in.size(), memory_order_relaxed);
+    events_out.fetch_add(out.size(), memory_order_relaxed);
+    batches.fetch_add(1, memory_order_relaxed);
+  }
+
+  coalescing_stats event_coalescer::get_stats() const
+  {
+    return {events_in.load(memory_order_relaxed),
+            events_out.load(memory_order_relaxed),
+            batches.load(memory_order_relaxed)};
+  }
+}
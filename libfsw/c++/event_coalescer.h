@@ -0,0 +1,72 @@
+/* 
+ * Copyright (C) 2014, Enrico M. Crisostomo
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 3, or (at your option)
+ * any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+#ifndef FSW_EVENT_COALESCER_H
+#  define FSW_EVENT_COALESCER_H
+
+#  include <atomic>
+#  include <cstdint>
+#  include <vector>
+#  include "event_batch.h"
+
+namespace fsw
+{
+
+  typedef struct coalescing_stats
+  {
+    uint64_t events_in;
+    uint64_t events_out;
+    uint64_t batches;
+  } coalescing_stats;
+
+  /*
+   * Merges the events of a batch which refer to the same path into a single
+   * event whose flags are the union of the flags of the merged events, whose
+   * time is the time of the first one and whose last time is the time of the
+   * last one.  Coalesced events keep the position of the first event of the
+   * path.
+   *
+   * Once an event contains the Removed flag, only events which do not
+   * describe a change (Removed, PlatformSpecific and the type flags) are
+   * merged into it: a path which is removed and then created again produces
+   * two events, so that the union of the flags of an event always describes
+   * a create -> update -> delete sequence.
+   *
+   * The path index is an open addressing table reused across batches, so that
+   * coalescing performs no heap allocation once the table has grown.
+   */
+  class event_coalescer
+  {
+  public:
+    void coalesce(const event_batch &in, event_batch &out);
+    coalescing_stats get_stats() const;
+
+  private:
+    size_t find_slot(const event_batch &out,
+                     const char * path,
+                     size_t path_length,
+                     uint64_t hash) const;
+
+    std::vector<size_t> slots;
+    std::vector<uint64_t> hashes;
+    size_t table_size = 0;
+    std::atomic<uint64_t> events_in{0};
+    std::atomic<uint64_t> events_out{0};
+    std::atomic<uint64_t> batches{0};
+  };
+}
+
+#endif  /* FSW_EVENT_COALESCER_H */
@@ -0,0 +1,392 @@
+/* 
+ * Copyright (C) 2014, Enrico M. Crisostomo
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 3, or (at your option)
+ * any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+#include "event_debouncer.h"
+#include <chrono>
+#include <cstring>
+
+using namespace std;
+
+namespace fsw
+{
+
+  // Timer of the settle time; key entries start from 1.
+  static const uint32_t SETTLE_TIMER = 0;
+
+  // Marks an empty slot of the key table.
+  static const uint32_t EMPTY_SLOT = 0;
+
+  event_debouncer::event_debouncer(emit_function emit) :
+    emit(emit),
+    entries(1),
+    table(16, EMPTY_SLOT),
+    wheel(TICK_NS, get_monotonic_time_ns())
+  {
+  }
+
+  event_debouncer::~event_debouncer()
+  {
+    stop();
+  }
+
+  void event_debouncer::set_debounce(uint64_t debounce_ns)
+  {
+    this->debounce_ns = debounce_ns;
+  }
+
+  void event_debouncer::set_throttle(uint64_t throttle_ns)
+  {
+    this->throttle_ns = throttle_ns;
+  }
+
+  void event_debouncer::set_settle_time(uint64_t settle_ns)
+  {
+    this->settle_ns = settle_ns;
+  }
+
+  void event_debouncer::set_key_depth(unsigned int depth)
+  {
+    key_depth = depth;
+  }
+
+  bool event_debouncer::is_enabled() const
+  {
+    return debounce_ns || throttle_ns || settle_ns;
+  }
+
+  void event_debouncer::start()
+  {
+    if (timer_thread.joinable()) return;
+
+    stopping = false;
+    timer_thread = thread(&event_debouncer::run_timers, this);
+  }
+
+  void event_debouncer::stop()
+  {
+    if (!timer_thread.joinable()) return;
+
+    {
+      lock_guard<mutex> state_guard(state_mutex);
+      stopping = true;
+      timer_cv.notify_one();
+    }
+
+    timer_thread.join();
+  }
+
+  size_t event_debouncer::get_key_length(const char * path, size_t length) const
+  {
+    if (!key_depth) return length;
+
+    // Count the components of the path, ignoring the leading separator.
+    unsigned int components = 0;
+    size_t i = (length && path[0] == '/') ? 1 : 0;
+
+    for (; i < length; ++i)
+    {
+      if (path[i] != '/') continue;
+      if (++components == key_depth) return i;
+    }
+
+    return length;
+  }
+
+  size_t event_debouncer::find_slot(const char * key,
+                                    size_t length,
+                                    uint64_t hash) const
+  {
+    const size_t mask = table.size() - 1;
+    size_t slot = static_cast<size_t> (hash) & mask;
+
+    while (table[slot] != EMPTY_SLOT)
+    {
+      const entry &e = entries[table[slot]];
+
+      if (e.hash == hash
+          && e.key.length() == length
+          && ::memcmp(e.key.data(), key, length) == 0)
+      {
+        break;
+      }
+
+      slot = (slot + 1) & mask;
+    }
+
+    return slot;
+  }
+
+  void event_debouncer::grow()
+  {
+    vector<uint32_t> old_table(table.size() * 2, EMPTY_SLOT);
+    old_table.swap(table);
+
+    const size_t mask = table.size() - 1;
+
+    for (uint32_t id : old_table)
+    {
+      if (id == EMPTY_SLOT) continue;
+
+      size_t slot = static_cast<size_t> (entries[id].hash) & mask;
+      while (table[slot] != EMPTY_SLOT) slot = (slot + 1) & mask;
+
+      table[slot] = id;
+    }
+  }
+
+  uint32_t event_debouncer::insert(size_t slot,
+                                   const char * key,
+                                   size_t length,
+                                   uint64_t hash)
+  {
+    uint32_t id;
+
+    if (free_entries.empty())
+    {
+      id = static_cast<uint32_t> (entries.size());
+      entries.push_back(entry());
+    }
+    else
+    {
+      id = free_entries.back();
+      free_entries.pop_back();
+    }
+
+    entry &e = entries[id];
+    e.key.assign(key, length);
+    e.hash = hash;
+    e.flags = 0;
+    e.pending = false;
+
+    table[slot] = id;
+
+    // Keep the load factor of the table below 50%.
+    if (++used * 2 > table.size()) grow();
+
+    return id;
+  }
+
+  void event_debouncer::erase(uint32_t id)
+  {
+    const entry &e = entries[id];
+    const size_t mask = table.size() - 1;
+    size_t hole = find_slot(e.key.data(), e.key.length(), e.hash);
+
+    // Backward shift deletion: move back the entries of the probe sequence
+    // which would no longer be reachable through the hole.
+    for (size_t slot = (hole + 1) & mask; table[slot] != EMPTY_SLOT; slot = (slot + 1) & mask)
+    {
+      const size_t home = static_cast<size_t> (entries[table[slot]].hash) & mask;
+      const bool reachable = (hole <= slot)
+        ? (hole < home && home <= slot)
+        : (hole < home || home <= slot);
+
+      if (reachable) continue;
+
+      table[hole] = table[slot];
+      hole = slot;
+    }
+
+    table[hole] = EMPTY_SLOT;
+    --used;
+    free_entries.push_back(id);
+  }
+
+  void event_debouncer::add(const event_batch &events)
+  {
+    unique_lock<mutex> state_lock(state_mutex);
+
+    const uint64_t now = get_monotonic_time_ns();
+    const vector<uint32_t> &flags = events.get_flags();
+    const vector<uint64_t> &times = events.get_times_ns();
+    const vector<uint64_t> &monotonic_times = events.get_monotonic_times_ns();
+    const vector<uint64_t> &last_times = events.get_last_times_ns();
+
+    for (size_t i = 0; i < events.size(); ++i)
+    {
+      const char * path = events.get_path(i);
+      const size_t path_length = events.get_path_length(i);
+
+      if ((!debounce_ns && !throttle_ns)
+          || (flags[i] & (fsw_event_flag::Overflow | fsw_event_flag::Settled))
+          || !path_length)
+      {
+        ready.add(events, i);
+        continue;
+      }
+
+      const size_t key_length = get_key_length(path, path_length);
+      const uint64_t hash = hash_path(path, key_length);
+      const size_t slot = find_slot(path, key_length, hash);
+
+      if (table[slot] == EMPTY_SLOT)
+      {
+        const uint32_t id = insert(slot, path, key_length, hash);
+        entry &e = entries[id];
+
+        if (throttle_ns)
+        {
+          // Leading edge: emit now and suppress until the throttle time
+          // (or, if debouncing, the debounce time) has elapsed.
+          if (key_length == path_length) ready.add(events, i);
+          else ready.add(path, key_length, {times[i], monotonic_times[i]}, flags[i]);
+
+          wheel.schedule(id, now + (debounce_ns ? debounce_ns : throttle_ns));
+          continue;
+        }
+
+        e.pending = true;
+        e.flags = flags[i];
+        e.first_time = {times[i], monotonic_times[i]};
+        e.last_time_ns = last_times[i];
+        wheel.schedule(id, now + debounce_ns);
+        continue;
+      }
+
+      entry &e = entries[table[slot]];
+
+      if (!e.pending)
+      {
+        e.pending = true;
+        e.flags = 0;
+        e.first_time = {times[i], monotonic_times[i]};
+      }
+
+      e.flags |= flags[i];
+      e.last_time_ns = last_times[i];
+      ++suppressed;
+
+      if (debounce_ns) wheel.schedule(table[slot], now + debounce_ns);
+    }
+
+    if (settle_ns && !events.empty())
+    {
+      wheel.schedule(SETTLE_TIMER, now + settle_ns);
+    }
+
+    timer_cv.notify_one();
+    emit_ready(state_lock);
+  }
+
+  void event_debouncer::expire(uint32_t id)
+  {
+    if (id == SETTLE_TIMER)
+    {
+      ready.add("", 0, get_event_timestamp(), fsw_event_flag::Settled);
+      return;
+    }
+
+    const entry &e = entries[id];
+
+    // Events suppressed by a throttle are only emitted when debouncing.
+    if (e.pending && debounce_ns)
+    {
+      ready.add(e.key.data(), e.key.length(), e.first_time, e.flags);
+      ready.merge(ready.size() - 1, 0, e.last_time_ns);
+    }
+
+    erase(id);
+  }
+
+  void event_debouncer::run_timers()
+  {
+    unique_lock<mutex> state_lock(state_mutex);
+
+    while (!stopping)
+    {
+      const uint64_t wakeup = wheel.get_next_wakeup();
+
+      if (wakeup == timing_wheel::NEVER)
+      {
+        timer_cv.wait(state_lock);
+      }
+      else
+      {
+        const uint64_t now = get_monotonic_time_ns();
+        if (wakeup > now) timer_cv.wait_for(state_lock, chrono::nanoseconds(wakeup - now));
+      }
+
+      wheel.advance(get_monotonic_time_ns(), [this](uint32_t id)
+      {
+        expire(id);
+      });
+
+      emit_ready(state_lock);
+    }
+
+    flush();
+    emit_ready(state_lock);
+  }
+
+  void event_debouncer::emit_ready(unique_lock<mutex> &state_lock)
+  {
+    // The thread already emitting, possibly this one if emit() added
+    // events, picks up the ready events once it is done with its own.
+    if (emitting) return;
+
+    emitting = true;
+
+    while (!ready.empty())
+    {
+      emitted += ready.size();
+      ready.swap(emitting_events);
+
+      state_lock.unlock();
+
+      try
+      {
+        emit(emitting_events);
+      }
+      catch (...)
+      {
+        emitting_events.clear();
+        state_lock.lock();
+        emitting = false;
+        throw;
+      }
+
+      emitting_events.clear();
+      state_lock.lock();
+    }
+
+    emitting = false;
+  }
+
+  void event_debouncer::flush()
+  {
+    for (uint32_t id = 1; id < entries.size(); ++id)
+    {
+      if (!wheel.is_scheduled(id)) continue;
+
+      wheel.cancel(id);
+      expire(id);
+    }
+
+    wheel.cancel(SETTLE_TIMER);
+  }
+
+  debounce_stats event_debouncer::get_stats() const
+  {
+    lock_guard<mutex> state_guard(state_mutex);
+
+    debounce_stats stats;
+    stats.pending = used;
+    stats.emitted = emitted;
+    stats.suppressed = suppressed;
+
+    return stats;
+  }
+}
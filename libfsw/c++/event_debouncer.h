@@ -0,0 +1,142 @@
+/* 
+ * Copyright (C) 2014, Enrico M. Crisostomo
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 3, or (at your option)
+ * any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+#ifndef FSW_EVENT_DEBOUNCER_H
+#  define FSW_EVENT_DEBOUNCER_H
+
+#  include <atomic>
+#  include <condition_variable>
+#  include <cstdint>
+#  include <functional>
+#  include <mutex>
+#  include <string>
+#  include <thread>
+#  include <vector>
+#  include "event_batch.h"
+#  include "timing_wheel.h"
+
+namespace fsw
+{
+
+  /*
+   * suppressed counts the events which were not emitted on their own, i.e.
+   * merged into a pending event or discarded by a throttle.
+   */
+  typedef struct debounce_stats
+  {
+    uint64_t pending;
+    uint64_t emitted;
+    uint64_t suppressed;
+  } debounce_stats;
+
+  /*
+   * Delays and merges events per path (or per subtree) before they are
+   * delivered:
+   *
+   *   - With a debounce time, the events of a key are merged and emitted
+   *     once no event has been received for the key for the debounce time
+   *     (trailing debounce).
+   *   - With a throttle time, the first event of a key is emitted
+   *     immediately and the following ones are suppressed until the
+   *     throttle time has elapsed (leading-edge throttle).  If a debounce
+   *     time is set too, the suppressed events are merged and emitted once
+   *     the key has settled.
+   *   - With a settle time, an event with the Settled flag and an empty path
+   *     is emitted once no event at all has been received for the settle
+   *     time.
+   *
+   * The key of an event is its path or, if a key depth is set, the first
+   * key depth components of its path: the merged event then has the key as
+   * path.  Overflow events are never delayed.
+   *
+   * Pending keys are kept in an open addressing table and their timers in a
+   * hierarchical timing wheel with a resolution of TICK_NS, so that the cost
+   * per event does not depend on the number of pending keys.  Timers are
+   * run by a thread started by start(); stop() emits the events which are
+   * still pending.  Events are emitted through the emit function without
+   * the lock of the debouncer held, so that it may call get_stats() or
+   * add().  Emissions are serialized: while a thread is emitting, the
+   * events made ready by other threads are emitted by it, in order.
+   */
+  class event_debouncer
+  {
+  public:
+    typedef std::function<void(event_batch &)> emit_function;
+
+    explicit event_debouncer(emit_function emit);
+    ~event_debouncer();
+    event_debouncer(const event_debouncer& orig) = delete;
+    event_debouncer& operator=(const event_debouncer & that) = delete;
+
+    void set_debounce(uint64_t debounce_ns);
+    void set_throttle(uint64_t throttle_ns);
+    void set_settle_time(uint64_t settle_ns);
+    void set_key_depth(unsigned int depth);
+    bool is_enabled() const;
+    void start();
+    void stop();
+    void add(const event_batch &events);
+    debounce_stats get_stats() const;
+
+    static const uint64_t TICK_NS = 1000000;
+
+  private:
+    struct entry
+    {
+      std::string key;
+      uint64_t hash;
+      uint32_t flags;
+      event_timestamp first_time;
+      uint64_t last_time_ns;
+      bool pending;
+    };
+
+    size_t get_key_length(const char * path, size_t length) const;
+    size_t find_slot(const char * key, size_t length, uint64_t hash) const;
+    uint32_t insert(size_t slot, const char * key, size_t length, uint64_t hash);
+    void erase(uint32_t id);
+    void grow();
+    void expire(uint32_t id);
+    void run_timers();
+    void flush();
+    void emit_ready(std::unique_lock<std::mutex> &state_lock);
+
+    emit_function emit;
+    uint64_t debounce_ns = 0;
+    uint64_t throttle_ns = 0;
+    uint64_t settle_ns = 0;
+    unsigned int key_depth = 0;
+
+    std::vector<entry> entries;
+    std::vector<uint32_t> free_entries;
+    std::vector<uint32_t> table;
+    size_t used = 0;
+    timing_wheel wheel;
+    event_batch ready;
+    event_batch emitting_events;
+    bool emitting = false;
+
+    mutable std::mutex state_mutex;
+    std::condition_variable timer_cv;
+    std::thread timer_thread;
+    bool stopping = false;
+
+    uint64_t emitted = 0;
+    uint64_t suppressed = 0;
+  };
+}
+
+#endif  /* FSW_EVENT_DEBOUNCER_H */
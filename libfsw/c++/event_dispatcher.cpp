@@ -0,0 +1,423 @@
+/* 
+ * Copyright (C) 2014, Enrico M. Crisostomo
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 3, or (at your option)
+ * any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+#include "event_dispatcher.h"
+#include "event_timestamp.h"
+
+using namespace std;
+
+namespace fsw
+{
+
+  // Marks the absence of a pending gap.
+  static const size_t NO_GAP = static_cast<size_t> (-1);
+
+  // Set in head while the producer takes all the queued batches.
+  static const size_t HEAD_LOCKED = ~(static_cast<size_t> (-1) >> 1);
+
+  static size_t ring_size(size_t capacity)
+  {
+    size_t size = 2;
+    while (size < capacity) size <<= 1;
+
+    return size;
+  }
+
+  event_dispatcher::event_dispatcher(size_t capacity,
+                                     delivery_function deliver) :
+    capacity(ring_size(capacity)),
+    mask(ring_size(capacity) - 1),
+    deliver(deliver),
+    gap_position(NO_GAP)
+  {
+    slots.reset(new slot[this->capacity]);
+
+    for (size_t i = 0; i < this->capacity; ++i)
+    {
+      slots[i].sequence.store(i, memory_order_relaxed);
+      slots[i].bytes = 0;
+    }
+  }
+
+  event_dispatcher::~event_dispatcher()
+  {
+    stop();
+  }
+
+  void event_dispatcher::set_policy(fsw_backpressure_policy policy)
+  {
+    this->policy = policy;
+  }
+
+  void event_dispatcher::set_memory_limit(size_t bytes)
+  {
+    memory_limit = bytes;
+  }
+
+  void event_dispatcher::start()
+  {
+    if (consumer.joinable()) return;
+
+    stopping.store(false);
+    consumer = thread(&event_dispatcher::consumer_loop, this);
+  }
+
+  void event_dispatcher::stop()
+  {
+    if (!consumer.joinable()) return;
+
+    // The delivery thread drains the ring before exiting.
+    stopping.store(true);
+
+    {
+      lock_guard<mutex> wait_guard(wait_mutex);
+      consumer_cv.notify_one();
+    }
+
+    consumer.join();
+  }
+
+  void event_dispatcher::wake(const atomic<bool> &waiting,
+                              condition_variable &cv)
+  {
+    // Pairs with the store of the waiting flag before the predicate is
+    // checked: either the waiter sees the new state, or we see the flag.
+    if (!waiting.load()) return;
+
+    lock_guard<mutex> wait_guard(wait_mutex);
+    cv.notify_one();
+  }
+
+  bool event_dispatcher::try_enqueue(event_batch &batch, size_t bytes)
+  {
+    const size_t position = tail.load(memory_order_relaxed);
+    slot &s = slots[position & mask];
+
+    if (s.sequence.load(memory_order_acquire) != position) return false;
+
+    batch.swap(s.batch);
+    s.bytes = bytes;
+    pending_bytes.fetch_add(bytes);
+    s.sequence.store(position + 1, memory_order_release);
+    tail.store(position + 1);
+
+    return true;
+  }
+
+  bool event_dispatcher::try_dequeue(event_batch &batch, size_t &position)
+  {
+    position = head.load(memory_order_relaxed);
+    slot * s;
+
+    for (;;)
+    {
+      if (position & HEAD_LOCKED) return false;
+
+      s = &slots[position & mask];
+      const size_t sequence = s->sequence.load(memory_order_acquire);
+
+      if (sequence == position + 1)
+      {
+        if (head.compare_exchange_weak(position, position + 1)) break;
+      }
+      else if (sequence == position)
+      {
+        return false;
+      }
+      else
+      {
+        position = head.load(memory_order_relaxed);
+      }
+    }
+
+    batch.swap(s->batch);
+    pending_bytes.fetch_sub(s->bytes);
+    s->sequence.store(position + capacity);
+
+    wake(producer_waiting, producer_cv);
+
+    return true;
+  }
+
+  bool event_dispatcher::is_overloaded(size_t bytes) const
+  {
+    const size_t position = tail.load(memory_order_relaxed);
+
+    if (slots[position & mask].sequence.load() != position) return true;
+    if (!memory_limit || position == head.load()) return false;
+
+    return pending_bytes.load() + bytes > memory_limit;
+  }
+
+  bool event_dispatcher::is_above_threshold(size_t bytes) const
+  {
+    const size_t depth = tail.load(memory_order_relaxed) - head.load();
+
+    if (!depth) return false;
+    if (depth * 2 >= capacity) return true;
+
+    return memory_limit && (pending_bytes.load() + bytes) * 2 > memory_limit;
+  }
+
+  void event_dispatcher::wait_while_overloaded(size_t bytes)
+  {
+    if (!is_overloaded(bytes)) return;
+
+    const uint64_t stall_start = get_monotonic_time_ns();
+    stalls.fetch_add(1, memory_order_relaxed);
+
+    {
+      unique_lock<mutex> wait_lock(wait_mutex);
+      producer_waiting.store(true);
+
+      producer_cv.wait(wait_lock, [&]
+      {
+        return !is_overloaded(bytes);
+      });
+
+      producer_waiting.store(false);
+    }
+
+    stall_time_ns.fetch_add(get_monotonic_time_ns() - stall_start,
+                            memory_order_relaxed);
+  }
+
+  void event_dispatcher::mark_gap(size_t position)
+  {
+    // Only the earliest gap is kept: a single Overflow event reports all the
+    // events discarded since the last one was delivered.
+    size_t current = gap_position.load();
+
+    while (position < current
+           && !gap_position.compare_exchange_weak(current, position))
+    {
+    }
+  }
+
+  void event_dispatcher::drop_oldest(size_t bytes)
+  {
+    size_t position;
+
+    while (is_overloaded(bytes) && try_dequeue(scratch, position))
+    {
+      dropped_batches.fetch_add(1, memory_order_relaxed);
+      dropped_events.fetch_add(scratch.size(), memory_order_relaxed);
+      mark_gap(position + 1);
+      scratch.clear();
+    }
+  }
+
+  void event_dispatcher::coalesce_queued(event_batch &batch)
+  {
+    // Lock head so that the delivery thread cannot take a batch newer than
+    // the ones being coalesced, and deliver it before them.
+    size_t position = head.load();
+    while (!head.compare_exchange_weak(position, position | HEAD_LOCKED))
+    {
+    }
+
+    const size_t end = tail.load(memory_order_relaxed);
+    merged.clear();
+
+    for (; position != end; ++position)
+    {
+      slot &s = slots[position & mask];
+
+      for (size_t i = 0; i < s.batch.size(); ++i) merged.add(s.batch, i);
+      s.batch.clear();
+      pending_bytes.fetch_sub(s.bytes);
+      s.sequence.store(position + capacity);
+    }
+
+    head.store(end);
+
+    // The delivery thread may have taken all of them in the meantime.
+    if (merged.empty()) return;
+
+    for (size_t i = 0; i < batch.size(); ++i) merged.add(batch, i);
+
+    coalescer.coalesce(merged, batch);
+
+    // No event is lost: the events merged into others are only counted.
+    coalesced_events.fetch_add(merged.size() - batch.size(),
+                               memory_order_relaxed);
+  }
+
+  void event_dispatcher::push(event_batch &batch)
+  {
+    if (batch.empty()) return;
+
+    events.fetch_add(batch.size(), memory_order_relaxed);
+
+    if (policy == backpressure_coalesce
+        && is_above_threshold(batch.get_memory_usage()))
+    {
+      coalesce_queued(batch);
+    }
+
+    const size_t bytes = batch.get_memory_usage();
+
+    if (!memory_limit || bytes <= memory_limit)
+    {
+      enqueue(batch, bytes);
+      return;
+    }
+
+    // A batch larger than the memory limit is queued in parts which fit in
+    // it, so that the limit holds even when the ring is empty.
+    size_t i = 0;
+
+    while (i < batch.size())
+    {
+      size_t part_bytes = 0;
+
+      for (; i < batch.size(); ++i)
+      {
+        const size_t event_bytes = batch.get_memory_usage(i);
+
+        if (!part.empty() && part_bytes + event_bytes > memory_limit) break;
+
+        part.add(batch, i);
+        part_bytes += event_bytes;
+      }
+
+      enqueue(part, part.get_memory_usage());
+      part.clear();
+    }
+
+    batch.clear();
+  }
+
+  void event_dispatcher::enqueue(event_batch &batch, size_t bytes)
+  {
+    if (is_overloaded(bytes))
+    {
+      switch (policy)
+      {
+      case backpressure_drop_newest:
+        dropped_batches.fetch_add(1, memory_order_relaxed);
+        dropped_events.fetch_add(batch.size(), memory_order_relaxed);
+        mark_gap(tail.load(memory_order_relaxed));
+        batch.clear();
+        wake(consumer_waiting, consumer_cv);
+        return;
+
+      case backpressure_drop_oldest:
+        drop_oldest(bytes);
+        break;
+
+      default:
+        break;
+      }
+
+      // The delivery thread may still be releasing the slot we need.
+      wait_while_overloaded(bytes);
+    }
+
+    try_enqueue(batch, bytes);
+
+    const uint64_t depth = tail.load(memory_order_relaxed) - head.load();
+    if (depth > high_water_mark.load(memory_order_relaxed))
+    {
+      high_water_mark.store(depth, memory_order_relaxed);
+    }
+
+    wake(consumer_waiting, consumer_cv);
+  }
+
+  void event_dispatcher::deliver_gap(size_t position)
+  {
+    size_t gap = gap_position.load();
+
+    if (gap > position) return;
+    if (!gap_position.compare_exchange_strong(gap, NO_GAP)) return;
+
+    gap_batch.add("", 0, get_event_timestamp(), fsw_event_flag::Overflow);
+    deliver(gap_batch);
+    gap_batch.clear();
+  }
+
+  bool event_dispatcher::is_delivery_thread() const
+  {
+    return this_thread::get_id() == consumer.get_id();
+  }
+
+  void event_dispatcher::consumer_loop()
+  {
+    event_batch batch;
+
+    for (;;)
+    {
+      size_t position;
+
+      if (try_dequeue(batch, position))
+      {
+        // Report discarded events before the first batch following them.
+        deliver_gap(position);
+
+        deliver(batch);
+        batch.clear();
+        batches.fetch_add(1, memory_order_relaxed);
+        continue;
+      }
+
+      const size_t current_head = head.load();
+      if (current_head & HEAD_LOCKED)
+      {
+        this_thread::yield();
+        continue;
+      }
+
+      deliver_gap(current_head);
+
+      if (stopping.load() && tail.load() == current_head) return;
+
+      unique_lock<mutex> wait_lock(wait_mutex);
+      consumer_waiting.store(true);
+
+      consumer_cv.wait(wait_lock, [&]
+      {
+        const size_t current_head = head.load();
+
+        return (current_head & HEAD_LOCKED)
+          || tail.load() != current_head
+          || gap_position.load() <= current_head
+          || stopping.load();
+      });
+
+      consumer_waiting.store(false);
+    }
+  }
+
+  dispatch_stats event_dispatcher::get_stats() const
+  {
+    dispatch_stats stats;
+    const size_t current_head = head.load() & ~HEAD_LOCKED;
+    stats.depth = tail.load() - current_head;
+    stats.high_water_mark = high_water_mark.load(memory_order_relaxed);
+    stats.capacity = capacity;
+    stats.batches = batches.load(memory_order_relaxed);
+    stats.events = events.load(memory_order_relaxed);
+    stats.stalls = stalls.load(memory_order_relaxed);
+    stats.stall_time_ns = stall_time_ns.load(memory_order_relaxed);
+    stats.pending_bytes = pending_bytes.load(memory_order_relaxed);
+    stats.dropped_batches = dropped_batches.load(memory_order_relaxed);
+    stats.dropped_events = dropped_events.load(memory_order_relaxed);
+    stats.coalesced_events = coalesced_events.load(memory_order_relaxed);
+
+    return stats;
+  }
+}
@@ -0,0 +1,167 @@
+/* 
+ * Copyright (C) 2014, Enrico M. Crisostomo
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 3, or (at your option)
+ * any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+#ifndef FSW_EVENT_DISPATCHER_H
+#  define FSW_EVENT_DISPATCHER_H
+
+#  include <atomic>
+#  include <condition_variable>
+#  include <cstdint>
+#  include <functional>
+#  include <memory>
+#  include <mutex>
+#  include <thread>
+#  include "event_batch.h"
+#  include "event_coalescer.h"
+#  include "../c/cmonitor.h"
+
+namespace fsw
+{
+
+  typedef struct dispatch_stats
+  {
+    uint64_t depth;
+    uint64_t high_water_mark;
+    uint64_t capacity;
+    uint64_t batches;
+    uint64_t events;
+    uint64_t stalls;
+    uint64_t stall_time_ns;
+    uint64_t pending_bytes;
+    uint64_t dropped_batches;
+    uint64_t dropped_events;
+    uint64_t coalesced_events;
+  } dispatch_stats;
+
+  /*
+   * Decouples the thread producing events from the thread running the
+   * callback.  Batches are handed over through a bounded ring whose slots
+   * carry a sequence number telling whether they are free or full (as in
+   * Vyukov's bounded queue): push() swaps the batch with the cleared batch
+   * stored in a free slot, so that the producer keeps recycling the storage
+   * of already delivered batches, and the delivery thread swaps a full slot
+   * with the batch it has just delivered.  There is a single producer, but
+   * slots can be taken both by the delivery thread and by the producer
+   * itself, when it discards or coalesces queued batches.
+   *
+   * The ring is overloaded when it is full or when the memory used by the
+   * queued events (see event_batch::get_memory_usage()) would exceed the
+   * memory limit, if one is set.  A batch larger than the memory limit is
+   * split and queued in parts which fit in it, and a part is always accepted
+   * by an empty ring: the limit is only exceeded by a single event larger
+   * than it.  When the ring is overloaded, the policy decides what happens:
+   *
+   *   - backpressure_block: the producer waits for the delivery thread.
+   *   - backpressure_drop_oldest: the oldest queued batches are discarded.
+   *   - backpressure_drop_newest: the new batch is discarded.
+   *   - backpressure_coalesce: once the ring is half full (or half its
+   *     memory limit is used), the queued batches are coalesced by path
+   *     into the new one (see event_coalescer.h); the producer waits if the
+   *     ring is still overloaded.
+   *
+   * Discarded events leave holes in the sequence numbers and are reported by
+   * an event with the Overflow flag, an empty path and sequence number 0,
+   * delivered in place of the missing events.  Coalesced events are only
+   * counted in coalesced_events.
+   *
+   * The producer and the delivery thread only synchronize through atomic
+   * indexes; the mutex is used to sleep when the ring is empty (delivery
+   * thread) or overloaded (producer), and is only touched when the other
+   * side is waiting.  Depth and high water mark are measured in batches;
+   * stalls count the times the producer had to wait and stall_time_ns the
+   * total time spent waiting.
+   *
+   * The policy and the memory limit must be set before start().
+   */
+  class event_dispatcher
+  {
+  public:
+    typedef std::function<void(event_batch &)> delivery_function;
+
+    event_dispatcher(size_t capacity, delivery_function deliver);
+    ~event_dispatcher();
+    event_dispatcher(const event_dispatcher& orig) = delete;
+    event_dispatcher& operator=(const event_dispatcher & that) = delete;
+
+    void set_policy(fsw_backpressure_policy policy);
+    void set_memory_limit(size_t bytes);
+    void start();
+    void stop();
+    void push(event_batch &batch);
+    bool is_delivery_thread() const;
+    dispatch_stats get_stats() const;
+
+  private:
+    struct slot
+    {
+      std::atomic<size_t> sequence;
+      event_batch batch;
+      size_t bytes;
+    };
+
+    void enqueue(event_batch &batch, size_t bytes);
+    bool try_enqueue(event_batch &batch, size_t bytes);
+    bool try_dequeue(event_batch &batch, size_t &position);
+    bool is_overloaded(size_t bytes) const;
+    bool is_above_threshold(size_t bytes) const;
+    void wait_while_overloaded(size_t bytes);
+    void drop_oldest(size_t bytes);
+    void coalesce_queued(event_batch &batch);
+    void mark_gap(size_t position);
+    void deliver_gap(size_t position);
+    void consumer_loop();
+    void wake(const std::atomic<bool> &waiting, std::condition_variable &cv);
+
+    std::unique_ptr<slot[]> slots;
+    size_t capacity;
+    size_t mask;
+    delivery_function deliver;
+    fsw_backpressure_policy policy = backpressure_block;
+    size_t memory_limit = 0;
+
+    std::atomic<size_t> head{0};
+    std::atomic<size_t> tail{0};
+    std::atomic<size_t> pending_bytes{0};
+    std::atomic<size_t> gap_position;
+    std::atomic<bool> consumer_waiting{false};
+    std::atomic<bool> producer_waiting{false};
+    std::atomic<bool> stopping{false};
+    std::mutex wait_mutex;
+    std::condition_variable consumer_cv;
+    std::condition_variable producer_cv;
+    std::thread consumer;
+
+    // Used by the delivery thread only.
+    event_batch gap_batch;
+
+    // Used by the producer only.
+    event_batch scratch;
+    event_batch merged;
+    event_batch part;
+    event_coalescer coalescer;
+
+    std::atomic<uint64_t> high_water_mark{0};
+    std::atomic<uint64_t> batches{0};
+    std::atomic<uint64_t> events{0};
+    std::atomic<uint64_t> stalls{0};
+    std::atomic<uint64_t> stall_time_ns{0};
+    std::atomic<uint64_t> dropped_batches{0};
+    std::atomic<uint64_t> dropped_events{0};
+    std::atomic<uint64_t> coalesced_events{0};
+  };
+}
+
+#endif  /* FSW_EVENT_DISPATCHER_H */
@@ -0,0 +1,370 @@
+/* 
+ * Copyright (C) 2014, Enrico M. Crisostomo
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 3, or (at your option)
+ * any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+#ifdef HAVE_CONFIG_H
+#  include "libfsw_config.h"
+#endif
+#include "event_fanout.h"
+#include "libfsw_exception.h"
+#include <algorithm>
+#include <cstring>
+#ifdef HAVE_REGCOMP
+#  include <regex.h>
+#endif
+
+using namespace std;
+
+namespace fsw
+{
+
+  struct fanout_filter
+  {
+#ifdef HAVE_REGCOMP
+    regex_t regex;
+    fsw_filter_type type;
+#endif
+  };
+
+  struct fanout_subscriber
+  {
+    unsigned int id;
+    string prefix;
+    FSW_SUBSCRIPTION_CALLBACK * callback;
+    void * context;
+    vector<fanout_filter> filters;
+
+    ~fanout_subscriber()
+    {
+#ifdef HAVE_REGCOMP
+      for (fanout_filter &filter : filters)
+      {
+        ::regfree(&filter.regex);
+      }
+#endif
+    }
+
+    bool accept_path(const char * path) const
+    {
+#ifdef HAVE_REGCOMP
+      for (const fanout_filter &filter : filters)
+      {
+        if (::regexec(&filter.regex, path, 0, nullptr, 0) == 0)
+        {
+          return filter.type == fsw_filter_type::filter_include;
+        }
+      }
+#endif
+
+      return true;
+    }
+  };
+
+  struct subscription_node
+  {
+    string component;
+    uint64_t hash;
+    vector<size_t> children;
+    vector<size_t> subscribers;
+  };
+
+  /*
+   * Trie of the path components of the subscribed prefixes.  Node 0 is the
+   * root, holding the subscribers with an empty prefix; the subscribers of a
+   * node are positions in subscribers.
+   */
+  struct subscription_index
+  {
+    vector<subscription_node> nodes;
+    vector<shared_ptr<const fanout_subscriber>> subscribers;
+  };
+
+  /*
+   * Calls fn(start, length) for each component of a path.  Empty components
+   * are skipped, except the first one, which distinguishes absolute paths
+   * from relative ones.
+   */
+  template <typename F>
+  static void for_each_component(const char * path, size_t length, F fn)
+  {
+    size_t start = 0;
+
+    while (start <= length)
+    {
+      const char * separator = static_cast<const char *> (
+        ::memchr(path + start, '/', length - start));
+      const size_t end = separator ? separator - path : length;
+
+      if (end > start || start == 0)
+      {
+        if (!fn(path + start, end - start)) return;
+      }
+
+      start = end + 1;
+    }
+  }
+
+  static size_t find_child(const subscription_index &index,
+                           size_t node,
+                           const char * component,
+                           size_t length,
+                           uint64_t hash)
+  {
+    for (size_t child : index.nodes[node].children)
+    {
+      const subscription_node &candidate = index.nodes[child];
+
+      if (candidate.hash == hash
+          && candidate.component.length() == length
+          && ::memcmp(candidate.component.data(), component, length) == 0)
+      {
+        return child;
+      }
+    }
+
+    return 0;
+  }
+
+  size_t event_selection::size() const
+  {
+    return indexes.size();
+  }
+
+  bool event_selection::empty() const
+  {
+    return indexes.empty();
+  }
+
+  compact_event event_selection::operator[](size_t i) const
+  {
+    return (*batch)[indexes[i]];
+  }
+
+  const shared_ptr<const event_batch> & event_selection::get_batch() const
+  {
+    return batch;
+  }
+
+  const vector<size_t> & event_selection::get_indexes() const
+  {
+    return indexes;
+  }
+
+  event_fanout::event_fanout() :
+    pool(make_shared<event_batch_pool>())
+  {
+    rebuild_index();
+  }
+
+  event_fanout::~event_fanout()
+  {
+  }
+
+  unsigned int event_fanout::subscribe(const string &prefix,
+                                       const vector<monitor_filter> &filters,
+                                       FSW_SUBSCRIPTION_CALLBACK * callback,
+                                       void * context)
+  {
+    if (callback == nullptr)
+    {
+      throw libfsw_exception("Callback cannot be null.", FSW_ERR_CALLBACK_NOT_SET);
+    }
+
+    shared_ptr<fanout_subscriber> subscriber = make_shared<fanout_subscriber>();
+    subscriber->prefix = prefix;
+    subscriber->callback = callback;
+    subscriber->context = context;
+
+#ifdef HAVE_REGCOMP
+    for (const monitor_filter &filter : filters)
+    {
+      regex_t regex;
+      int flags = 0;
+
+      if (!filter.case_sensitive) flags |= REG_ICASE;
+      if (filter.extended) flags |= REG_EXTENDED;
+
+      if (::regcomp(&regex, filter.text.c_str(), flags))
+      {
+        string err = "An error occurred during the compilation of " + filter.text;
+        throw libfsw_exception(err, FSW_ERR_INVALID_REGEX);
+      }
+
+      subscriber->filters.push_back({regex, filter.type});
+    }
+#endif
+
+    lock_guard<mutex> subscription_guard(subscription_mutex);
+    subscriber->id = ++last_id;
+    subscribers.push_back(subscriber);
+    rebuild_index();
+
+    return subscriber->id;
+  }
+
+  bool event_fanout::unsubscribe(unsigned int id)
+  {
+    lock_guard<mutex> subscription_guard(subscription_mutex);
+
+    auto it = find_if(subscribers.begin(),
+                      subscribers.end(),
+                      [id](const shared_ptr<const fanout_subscriber> &s)
+                      {
+                        return s->id == id;
+                      });
+
+    if (it == subscribers.end()) return false;
+
+    subscribers.erase(it);
+    rebuild_index();
+
+    return true;
+  }
+
+  size_t event_fanout::get_subscriber_count() const
+  {
+    lock_guard<mutex> subscription_guard(subscription_mutex);
+
+    return subscribers.size();
+  }
+
+  void event_fanout::rebuild_index()
+  {
+    shared_ptr<subscription_index> rebuilt = make_shared<subscription_index>();
+    rebuilt->nodes.push_back(subscription_node());
+    rebuilt->subscribers = subscribers;
+
+    for (size_t s = 0; s < subscribers.size(); ++s)
+    {
+      const string &prefix = subscribers[s]->prefix;
+      size_t node = 0;
+
+      // An empty prefix matches every path, relative ones included, and is
+      // attached to the root rather than to the empty leading component of
+      // absolute paths.
+      if (prefix.empty())
+      {
+        rebuilt->nodes[0].subscribers.push_back(s);
+        continue;
+      }
+
+      for_each_component(prefix.c_str(), prefix.length(),
+                         [&](const char * component, size_t length)
+                         {
+                           const uint64_t hash = hash_path(component, length);
+                           size_t child = find_child(*rebuilt, node, component, length, hash);
+
+                           if (!child)
+                           {
+                             child = rebuilt->nodes.size();
+                             rebuilt->nodes.push_back({string(component, length), hash, {}, {}});
+                             rebuilt->nodes[node].children.push_back(child);
+                           }
+
+                           node = child;
+                           return true;
+                         });
+
+      rebuilt->nodes[node].subscribers.push_back(s);
+    }
+
+    atomic_store(&index, shared_ptr<const subscription_index>(rebuilt));
+  }
+
+  shared_ptr<const subscription_index> event_fanout::get_index() const
+  {
+    return atomic_load(&index);
+  }
+
+  void event_fanout::publish(event_batch &events)
+  {
+    if (events.empty()) return;
+
+    shared_ptr<const subscription_index> current = get_index();
+    if (current->subscribers.empty()) return;
+
+    lock_guard<mutex> publish_guard(publish_mutex);
+
+    shared_ptr<const event_batch> batch = share_batch(events, pool);
+
+    selections.resize(current->subscribers.size());
+
+    for (event_selection &selection : selections)
+    {
+      selection.batch = batch;
+      selection.indexes.clear();
+    }
+
+    const vector<uint32_t> &flags = batch->get_flags();
+
+    for (size_t i = 0; i < batch->size(); ++i)
+    {
+      if (flags[i] & fsw_event_flag::Overflow)
+      {
+        for (event_selection &selection : selections)
+        {
+          selection.indexes.push_back(i);
+        }
+
+        continue;
+      }
+
+      const char * path = batch->get_path(i);
+      size_t node = 0;
+
+      matches.assign(current->nodes[0].subscribers.begin(),
+                     current->nodes[0].subscribers.end());
+
+      for_each_component(path, batch->get_path_length(i),
+                         [&](const char * component, size_t length)
+                         {
+                           node = find_child(*current, node, component, length,
+                                             hash_path(component, length));
+                           if (!node) return false;
+
+                           const vector<size_t> &subscribed = current->nodes[node].subscribers;
+                           matches.insert(matches.end(), subscribed.begin(), subscribed.end());
+
+                           return true;
+                         });
+
+      for (size_t s : matches)
+      {
+        if (current->subscribers[s]->accept_path(path))
+        {
+          selections[s].indexes.push_back(i);
+        }
+      }
+    }
+
+    for (size_t s = 0; s < selections.size(); ++s)
+    {
+      if (selections[s].empty()) continue;
+
+      const fanout_subscriber &subscriber = *current->subscribers[s];
+      subscriber.callback(selections[s], subscriber.context);
+    }
+
+    for (event_selection &selection : selections)
+    {
+      selection.batch.reset();
+    }
+  }
+
+  void event_fanout::monitor_callback(event_batch &events, void * fanout)
+  {
+    static_cast<event_fanout *> (fanout)->publish(events);
+  }
+}
@@ -0,0 +1,115 @@
+/* 
+ * Copyright (C) 2014, Enrico M. Crisostomo
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 3, or (at your option)
+ * any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+#ifndef FSW_EVENT_FANOUT_H
+#  define FSW_EVENT_FANOUT_H
+
+#  include <memory>
+#  include <mutex>
+#  include <string>
+#  include <vector>
+#  include "event_batch.h"
+#  include "filter.h"
+
+namespace fsw
+{
+
+  /*
+   * The events of a shared batch selected for a subscriber.  The batch is
+   * immutable and shared by all the subscribers it is routed to: a subscriber
+   * which needs the events after its callback returns keeps a copy of the
+   * selection (or of get_batch()), which only copies the indexes.
+   */
+  class event_selection
+  {
+  public:
+    size_t size() const;
+    bool empty() const;
+    compact_event operator[](size_t i) const;
+    const std::shared_ptr<const event_batch> & get_batch() const;
+    const std::vector<size_t> & get_indexes() const;
+
+  private:
+    friend class event_fanout;
+    friend class parallel_dispatcher;
+
+    std::shared_ptr<const event_batch> batch;
+    std::vector<size_t> indexes;
+  };
+
+  typedef void FSW_SUBSCRIPTION_CALLBACK(const event_selection &, void *);
+
+  struct fanout_subscriber;
+  struct subscription_index;
+
+  /*
+   * Routes the events of a single monitor to many subscribers, each with
+   * its own path prefix, filters and callback, so that the watches and the
+   * scans of the monitor are shared by all of them.  The fan-out is
+   * installed as the batch callback of the monitor:
+   *
+   *   event_fanout fanout;
+   *   monitor * m = monitor::create_default_monitor(paths,
+   *                                                 event_fanout::monitor_callback,
+   *                                                 &fanout);
+   *   fanout.subscribe("/var/log", {}, callback, context);
+   *
+   * A prefix matches whole path components: "/var/log" matches "/var/log"
+   * and "/var/log/syslog" but not "/var/logs"; an empty prefix matches every
+   * path.  Filters have the same semantics as the filters of a monitor.
+   * Events with the Overflow flag are routed to every subscriber.
+   *
+   * Subscribers are indexed in a trie of path components which is rebuilt
+   * when subscriptions change and swapped atomically, so that publishing
+   * never waits for subscribe() or unsubscribe().  The batches passed to
+   * subscribers are taken over from the monitor without copying and are
+   * recycled once the last reference to them is dropped.
+   */
+  class event_fanout
+  {
+  public:
+    event_fanout();
+    ~event_fanout();
+    event_fanout(const event_fanout& orig) = delete;
+    event_fanout& operator=(const event_fanout & that) = delete;
+
+    unsigned int subscribe(const std::string &prefix,
+                           const std::vector<monitor_filter> &filters,
+                           FSW_SUBSCRIPTION_CALLBACK * callback,
+                           void * context = nullptr);
+    bool unsubscribe(unsigned int id);
+    size_t get_subscriber_count() const;
+    void publish(event_batch &events);
+
+    static void monitor_callback(event_batch &events, void * fanout);
+
+  private:
+    std::shared_ptr<const subscription_index> get_index() const;
+    void rebuild_index();
+
+    mutable std::mutex subscription_mutex;
+    std::vector<std::shared_ptr<const fanout_subscriber>> subscribers;
+    std::shared_ptr<const subscription_index> index;
+    unsigned int last_id = 0;
+
+    std::mutex publish_mutex;
+    std::vector<event_selection> selections;
+    std::vector<size_t> matches;
+    std::shared_ptr<event_batch_pool> pool;
+  };
+}
+
+#endif  /* FSW_EVENT_FANOUT_H */
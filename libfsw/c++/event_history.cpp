@@ -0,0 +1,103 @@
+/* 
+ * Copyright (C) 2014, Enrico M. Crisostomo
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 3, or (at your option)
+ * any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+#include "event_history.h"
+#include <algorithm>
+
+using namespace std;
+
+namespace fsw
+{
+
+  event_history::event_history(event_batch_pool &pool) : pool(pool)
+  {
+  }
+
+  void event_history::set_capacity(size_t events)
+  {
+    capacity = events;
+
+    while (event_count > capacity && !batches.empty())
+    {
+      event_count -= batches.front().size();
+      last_dropped_sequence = batches.front().get_sequences().back();
+      pool.release(std::move(batches.front()));
+      batches.pop_front();
+    }
+  }
+
+  size_t event_history::get_capacity() const
+  {
+    return capacity;
+  }
+
+  void event_history::record(const event_batch &batch)
+  {
+    if (batch.empty()) return;
+
+    if (!capacity)
+    {
+      last_dropped_sequence = batch.get_sequences().back();
+      return;
+    }
+
+    // Only the newest events of a batch larger than the history are kept.
+    const size_t first = batch.size() > capacity ? batch.size() - capacity : 0;
+
+    // Batches dropped from the history are recycled through the pool.
+    event_batch copy = pool.acquire();
+    copy.reserve(batch.size() - first, batch.get_path_arena().size());
+
+    for (size_t i = first; i < batch.size(); ++i)
+    {
+      copy.add(batch, i);
+    }
+
+    event_count += copy.size();
+    batches.push_back(std::move(copy));
+
+    set_capacity(capacity);
+
+    // The older batches dropped above have lower sequence numbers.
+    if (first) last_dropped_sequence = batch.get_sequences()[first - 1];
+  }
+
+  uint64_t event_history::get_last_dropped_sequence() const
+  {
+    return last_dropped_sequence;
+  }
+
+  bool event_history::replay(uint64_t from_sequence, event_batch &out) const
+  {
+    for (const event_batch &batch : batches)
+    {
+      const vector<uint64_t> &sequences = batch.get_sequences();
+
+      if (sequences.back() < from_sequence) continue;
+
+      auto first = lower_bound(sequences.begin(), sequences.end(), from_sequence);
+
+      for (size_t i = first - sequences.begin(); i < batch.size(); ++i)
+      {
+        out.add(batch, i);
+      }
+    }
+
+    // Sequence numbers start from 1: nothing is missing until an event has
+    // been dropped, whatever from_sequence.
+    return from_sequence > last_dropped_sequence || last_dropped_sequence == 0;
+  }
+}
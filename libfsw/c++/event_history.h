@@ -0,0 +1,59 @@
+/* 
+ * Copyright (C) 2014, Enrico M. Crisostomo
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 3, or (at your option)
+ * any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+#ifndef FSW_EVENT_HISTORY_H
+#  define FSW_EVENT_HISTORY_H
+
+#  include <cstdint>
+#  include <deque>
+#  include "event_batch.h"
+
+namespace fsw
+{
+
+  /*
+   * A bounded, in-memory history of the events delivered by a monitor, used
+   * to let a consumer resume from a known sequence number.  The history keeps
+   * copies of whole batches and drops the oldest ones when it holds more than
+   * capacity events; batches which are dropped are returned to the pool.  Of
+   * a batch larger than capacity, only the newest capacity events are kept.
+   *
+   * replay() appends to out the retained events whose sequence number is
+   * greater than or equal to from_sequence and returns false if some of the
+   * requested events are no longer available.
+   *
+   * The history is not synchronized: the monitor serializes access to it.
+   */
+  class event_history
+  {
+  public:
+    explicit event_history(event_batch_pool &pool);
+    void set_capacity(size_t events);
+    size_t get_capacity() const;
+    void record(const event_batch &batch);
+    bool replay(uint64_t from_sequence, event_batch &out) const;
+    uint64_t get_last_dropped_sequence() const;
+
+  private:
+    event_batch_pool &pool;
+    std::deque<event_batch> batches;
+    size_t capacity = 0;
+    size_t event_count = 0;
+    uint64_t last_dropped_sequence = 0;
+  };
+}
+
+#endif  /* FSW_EVENT_HISTORY_H */
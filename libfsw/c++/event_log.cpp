@@ -0,0 +1,196 @@
+/* 
+ * Copyright (C) 2014, Enrico M. Crisostomo
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 3, or (at your option)
+ * any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+#ifdef HAVE_CONFIG_H
+#  include "libfsw_config.h"
+#endif
+
+#include <algorithm>
+#include <cerrno>
+#include <cstring>
+#include <fcntl.h>
+#include <unistd.h>
+#include "event_log.h"
+#include "libfsw_exception.h"
+
+using namespace std;
+
+namespace fsw
+{
+
+  // Size of the header of a log: the magic string and the version.
+  static const size_t HEADER_SIZE = sizeof (EVENT_LOG_MAGIC) + 1;
+
+  // Batch records larger than this are considered corrupt.
+  static const uint64_t MAX_RECORD_SIZE = 1 << 30;
+
+  static bool write_fully(int fd, const unsigned char * data, size_t size)
+  {
+    while (size)
+    {
+      ssize_t written = ::write(fd, data, size);
+
+      if (written < 0)
+      {
+        if (errno == EINTR) continue;
+        return false;
+      }
+
+      data += written;
+      size -= written;
+    }
+
+    return true;
+  }
+
+  event_log_writer::event_log_writer(const string &path)
+  {
+    fd = ::open(path.c_str(), O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0666);
+
+    if (fd < 0)
+    {
+      throw libfsw_exception("Cannot create the event log " + path + ": " + strerror(errno),
+                             FSW_ERR_INVALID_PATH);
+    }
+
+    unsigned char header[HEADER_SIZE];
+    memcpy(header, EVENT_LOG_MAGIC, sizeof (EVENT_LOG_MAGIC));
+    header[sizeof (EVENT_LOG_MAGIC)] = EVENT_LOG_VERSION;
+
+    if (!write_fully(fd, header, sizeof (header)))
+    {
+      const string error = strerror(errno);
+      ::close(fd);
+
+      throw libfsw_exception("Cannot write the event log " + path + ": " + error,
+                             FSW_ERR_INVALID_PATH);
+    }
+  }
+
+  event_log_writer::~event_log_writer()
+  {
+    ::close(fd);
+  }
+
+  bool event_log_writer::write_batch(const event_batch &events)
+  {
+    const uint64_t now = get_monotonic_time_ns();
+
+    // The record is encoded after room for its size, which is stored right
+    // before it once known, so that the record is written without copying.
+    record.assign(MAX_VARINT_SIZE, 0);
+    put_varint(record, last_batch_time ? now - last_batch_time : 0);
+    encoder.encode(events, record);
+    last_batch_time = now;
+
+    unsigned char size[MAX_VARINT_SIZE];
+    const size_t size_length = put_varint(size, record.size() - MAX_VARINT_SIZE);
+
+    const size_t start = MAX_VARINT_SIZE - size_length;
+    memcpy(record.data() + start, size, size_length);
+
+    return write_fully(fd, record.data() + start, record.size() - start);
+  }
+
+  event_log_reader::event_log_reader(const string &path) :
+    path(path), buffer(1 << 16)
+  {
+    fd = ::open(path.c_str(), O_RDONLY | O_CLOEXEC);
+
+    if (fd < 0)
+    {
+      throw libfsw_exception("Cannot open the event log " + path + ": " + strerror(errno),
+                             FSW_ERR_INVALID_PATH);
+    }
+
+    if (!fill(HEADER_SIZE)
+        || memcmp(&buffer[begin], EVENT_LOG_MAGIC, sizeof (EVENT_LOG_MAGIC)) != 0
+        || buffer[begin + sizeof (EVENT_LOG_MAGIC)] != EVENT_LOG_VERSION)
+    {
+      ::close(fd);
+      throw libfsw_exception("Invalid event log: " + path, FSW_ERR_INVALID_EVENT_LOG);
+    }
+
+    begin += HEADER_SIZE;
+  }
+
+  event_log_reader::~event_log_reader()
+  {
+    ::close(fd);
+  }
+
+  bool event_log_reader::fill(size_t bytes)
+  {
+    if (end - begin >= bytes) return true;
+
+    // Move the unread bytes to the start of the buffer and grow it if needed.
+    memmove(buffer.data(), buffer.data() + begin, end - begin);
+    end -= begin;
+    begin = 0;
+
+    if (buffer.size() < bytes) buffer.resize(bytes);
+
+    while (end < bytes)
+    {
+      ssize_t rc = ::read(fd, buffer.data() + end, buffer.size() - end);
+
+      if (rc < 0)
+      {
+        if (errno == EINTR) continue;
+
+        throw libfsw_exception("Cannot read the event log " + path + ": " + strerror(errno),
+                               FSW_ERR_INVALID_EVENT_LOG);
+      }
+
+      if (rc == 0) return false;
+
+      end += rc;
+    }
+
+    return true;
+  }
+
+  bool event_log_reader::read_batch(event_batch &events, uint64_t &interval_ns)
+  {
+    events.clear();
+
+    // Fewer bytes than the longest varint are left at the end of the log.
+    fill(MAX_VARINT_SIZE);
+
+    const unsigned char * p = buffer.data() + begin;
+    uint64_t size;
+
+    if (!get_varint(p, buffer.data() + end, size)) return false;
+
+    if (size > MAX_RECORD_SIZE)
+      throw libfsw_exception("Invalid event log: " + path, FSW_ERR_INVALID_EVENT_LOG);
+
+    begin = p - buffer.data();
+
+    if (!fill(size)) return false;
+
+    p = buffer.data() + begin;
+    const unsigned char * record_end = p + size;
+
+    if (!get_varint(p, record_end, interval_ns)
+        || !decoder.decode(p, record_end, events))
+      throw libfsw_exception("Invalid event log: " + path, FSW_ERR_INVALID_EVENT_LOG);
+
+    begin += size;
+
+    return true;
+  }
+}
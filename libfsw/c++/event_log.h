@@ -0,0 +1,105 @@
+/* 
+ * Copyright (C) 2014, Enrico M. Crisostomo
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 3, or (at your option)
+ * any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+#ifndef FSW_EVENT_LOG_H
+#  define FSW_EVENT_LOG_H
+
+#  include <cstddef>
+#  include <cstdint>
+#  include <string>
+#  include <vector>
+#  include "batch_codec.h"
+#  include "event_batch.h"
+
+namespace fsw
+{
+
+  /*
+   * An event log records the batches delivered by a monitor in a compact
+   * binary file, so that they can be replayed later (see replay_monitor.h).
+   *
+   * Format of a log (version 1).  Integers are unsigned LEB128 varints.
+   *
+   *   header   the 8 bytes "FSWLOG\0" followed by the version byte
+   *   batch*   one record per batch, up to the end of the file
+   *
+   * A batch record is made of:
+   *
+   *   varint   size in bytes of the rest of the record
+   *   varint   nanoseconds elapsed since the previous batch was recorded
+   *   batch    the batch encoded as described in batch_codec.h, the
+   *            previous time and path carrying over from one batch to the
+   *            next
+   */
+  static const char EVENT_LOG_MAGIC[7] = {'F', 'S', 'W', 'L', 'O', 'G', '\0'};
+  static const unsigned char EVENT_LOG_VERSION = 1;
+
+  class event_log_writer
+  {
+  public:
+    /*
+     * Creates (or truncates) the log at path.
+     */
+    explicit event_log_writer(const std::string &path);
+    event_log_writer(const event_log_writer &orig) = delete;
+    event_log_writer& operator=(const event_log_writer &that) = delete;
+    virtual ~event_log_writer();
+
+    /*
+     * Appends a batch to the log with a single write.  It returns false,
+     * with errno set, if writing failed.
+     */
+    bool write_batch(const event_batch &events);
+
+  private:
+    int fd = -1;
+    std::vector<unsigned char> record;
+    uint64_t last_batch_time = 0;
+    batch_encoder encoder;
+  };
+
+  class event_log_reader
+  {
+  public:
+    explicit event_log_reader(const std::string &path);
+    event_log_reader(const event_log_reader &orig) = delete;
+    event_log_reader& operator=(const event_log_reader &that) = delete;
+    virtual ~event_log_reader();
+
+    /*
+     * Reads the next batch of the log into events, which is cleared first,
+     * and stores in interval_ns the time elapsed between the recording of
+     * the previous batch and of this one.  The monotonic time of the events
+     * is the time at which they are read.  It returns false at the end of
+     * the log, including when the last batch was left incomplete by a
+     * writer which was killed, and throws a libfsw_exception if the log is
+     * corrupt.
+     */
+    bool read_batch(event_batch &events, uint64_t &interval_ns);
+
+  private:
+    bool fill(size_t bytes);
+
+    int fd = -1;
+    std::string path;
+    std::vector<unsigned char> buffer;
+    size_t begin = 0;
+    size_t end = 0;
+    batch_decoder decoder;
+  };
+}
+
+#endif  /* FSW_EVENT_LOG_H */
@@ -0,0 +1,67 @@
+/* 
+ * Copyright (C) 2014, Enrico M. Crisostomo
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 3, or (at your option)
+ * any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+#ifdef HAVE_CONFIG_H
+#  include "libfsw_config.h"
+#endif
+
+#include "event_timestamp.h"
+#include <sys/time.h>
+
+namespace fsw
+{
+
+  static const uint64_t NANOSECONDS_PER_SECOND = 1000000000ULL;
+
+  static uint64_t get_clock_ns(bool monotonic)
+  {
+#ifdef HAVE_CLOCK_GETTIME
+    struct timespec ts;
+
+    if (::clock_gettime(monotonic ? CLOCK_MONOTONIC : CLOCK_REALTIME, &ts) == 0)
+    {
+      return static_cast<uint64_t> (ts.tv_sec) * NANOSECONDS_PER_SECOND + ts.tv_nsec;
+    }
+#endif
+
+    // Fall back to the wall clock with microsecond resolution.
+    struct timeval tv;
+    ::gettimeofday(&tv, nullptr);
+
+    return static_cast<uint64_t> (tv.tv_sec) * NANOSECONDS_PER_SECOND
+      + static_cast<uint64_t> (tv.tv_usec) * 1000;
+  }
+
+  event_timestamp get_event_timestamp()
+  {
+    return {get_clock_ns(false), get_clock_ns(true)};
+  }
+
+  event_timestamp make_event_timestamp(time_t evt_time)
+  {
+    return {static_cast<uint64_t> (evt_time) * NANOSECONDS_PER_SECOND, 0};
+  }
+
+  uint64_t get_monotonic_time_ns()
+  {
+    return get_clock_ns(true);
+  }
+
+  time_t event_timestamp_to_time(uint64_t realtime_ns)
+  {
+    return static_cast<time_t> (realtime_ns / NANOSECONDS_PER_SECOND);
+  }
+}
@@ -0,0 +1,45 @@
+/* 
+ * Copyright (C) 2014, Enrico M. Crisostomo
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 3, or (at your option)
+ * any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+#ifndef FSW_EVENT_TIMESTAMP_H
+#  define FSW_EVENT_TIMESTAMP_H
+
+#  include <cstdint>
+#  include <ctime>
+
+namespace fsw
+{
+
+  /*
+   * Time at which an event was captured by a monitor.  realtime_ns is the
+   * CLOCK_REALTIME time in nanoseconds since the Epoch and is the time
+   * reported to the user.  monotonic_ns is the CLOCK_MONOTONIC time at which
+   * the event was read from the underlying API, and can be compared with
+   * the result of get_monotonic_time_ns() to measure notification latency.
+   */
+  typedef struct event_timestamp
+  {
+    uint64_t realtime_ns;
+    uint64_t monotonic_ns;
+  } event_timestamp;
+
+  event_timestamp get_event_timestamp();
+  event_timestamp make_event_timestamp(time_t evt_time);
+  uint64_t get_monotonic_time_ns();
+  time_t event_timestamp_to_time(uint64_t realtime_ns);
+}
+
+#endif  /* FSW_EVENT_TIMESTAMP_H */
@@ -23,6 +23,7 @@
 #  include "libfsw_exception.h"
 #  include "c/libfsw_log.h"
 #  include <iostream>
+#  include <cstring>
 #  include "event.h"
 
 using namespace std;
@@ -44,8 +45,8 @@ namespace fsw
     vector<FSEventFlagType> flags;
     flags.push_back({kFSEventStreamEventFlagNone, fsw_event_flag::PlatformSpecific});
     flags.push_back({kFSEventStreamEventFlagMustScanSubDirs, fsw_event_flag::PlatformSpecific});
-    flags.push_back({kFSEventStreamEventFlagUserDropped, fsw_event_flag::PlatformSpecific});
-    flags.push_back({kFSEventStreamEventFlagKernelDropped, fsw_event_flag::PlatformSpecific});
+    flags.push_back({kFSEventStreamEventFlagUserDropped, fsw_event_flag::Overflow});
+    flags.push_back({kFSEventStreamEventFlagKernelDropped, fsw_event_flag::Overflow});
     flags.push_back({kFSEventStreamEventFlagEventIdsWrapped, fsw_event_flag::PlatformSpecific});
     flags.push_back({kFSEventStreamEventFlagHistoryDone, fsw_event_flag::PlatformSpecific});
     flags.push_back({kFSEventStreamEventFlagRootChanged, fsw_event_flag::PlatformSpecific});
@@ -73,7 +74,19 @@ namespace fsw
   {
   }
 
+  fsevent_monitor::fsevent_monitor(vector<string> paths_to_monitor,
+                                   FSW_EVENT_BATCH_CALLBACK * callback,
+                                   void * context) :
+    monitor(paths_to_monitor, callback, context)
+  {
+  }
+
   fsevent_monitor::~fsevent_monitor()
+  {
+    close_stream();
+  }
+
+  void fsevent_monitor::close_stream()
   {
     if (stream)
     {
@@ -111,6 +124,8 @@ namespace fsw
 
     if (dirs.size() == 0) return;
 
+    set_watch_count(dirs.size());
+
     CFArrayRef pathsToWatch =
       CFArrayCreate(NULL,
                     reinterpret_cast<const void **> (&dirs[0]),
@@ -147,18 +162,35 @@ namespace fsw
     FSEventStreamStart(stream);
 
     libfsw_log("Starting run loop...\n");
-    CFRunLoopRun();
+    run_loop.store(CFRunLoopGetCurrent());
+
+    // The run loop runs for bounded periods, so that a stop() which comes
+    // before the run loop is running is noticed as well.
+    while (!is_stopping())
+    {
+      CFRunLoopRunInMode(kCFRunLoopDefaultMode, 1.0, false);
+    }
+
+    run_loop.store(nullptr);
+    close_stream();
   }
 
-  static vector<fsw_event_flag> decode_flags(FSEventStreamEventFlags flag)
+  void fsevent_monitor::on_stop()
   {
-    vector<fsw_event_flag> evt_flags;
+    CFRunLoopRef loop = run_loop.load();
 
-    for (FSEventFlagType type : event_flag_type)
+    if (loop) CFRunLoopStop(loop);
+  }
+
+  static uint32_t decode_flags(FSEventStreamEventFlags flag)
+  {
+    uint32_t evt_flags = 0;
+
+    for (const FSEventFlagType &type : event_flag_type)
     {
       if (flag & type.flag)
       {
-        evt_flags.push_back(type.type);
+        evt_flags |= type.type;
       }
     }
 
@@ -180,23 +212,23 @@ namespace fsw
       throw libfsw_exception("The callback info cannot be cast to fsevent_monitor.");
     }
 
-    vector<event> events;
-
-    time_t curr_time;
-    time(&curr_time);
+    const event_timestamp curr_time = get_event_timestamp();
 
     for (size_t i = 0; i < numEvents; ++i)
     {
       const char * path = ((char **) eventPaths)[i];
+      const uint32_t flags = decode_flags(eventFlags[i]);
+
+      if (flags & fsw_event_flag::Overflow) fse_monitor->record_overflow();
 
       if (!fse_monitor->accept_path(path)) continue;
 
-      events.push_back({path, curr_time, decode_flags(eventFlags[i])});
+      fse_monitor->events.add(path,
+                              ::strlen(path),
+                              curr_time,
+                              flags);
     }
 
-    if (events.size() > 0)
-    {
-      fse_monitor->callback(events, fse_monitor->context);
-    }
+    fse_monitor->notify_events(fse_monitor->events);
   }
 }
@@ -18,6 +18,7 @@
 #  define FSW_FSEVENT_MONITOR_H
 
 #  include "monitor.h"
+#  include <atomic>
 #  include <CoreServices/CoreServices.h>
 
 namespace fsw
@@ -29,11 +30,17 @@ namespace fsw
     fsevent_monitor(std::vector<std::string> paths,
                     FSW_EVENT_CALLBACK * callback,
                     void * context = nullptr);
+    fsevent_monitor(std::vector<std::string> paths,
+                    FSW_EVENT_BATCH_CALLBACK * callback,
+                    void * context = nullptr);
     virtual ~fsevent_monitor();
 
     void run();
     void set_numeric_event(bool numeric);
 
+  protected:
+    void on_stop();
+
   private:
     fsevent_monitor(const fsevent_monitor& orig) = delete;
     fsevent_monitor& operator=(const fsevent_monitor & that) = delete;
@@ -44,9 +51,12 @@ namespace fsw
                                  void *eventPaths,
                                  const FSEventStreamEventFlags eventFlags[],
                                  const FSEventStreamEventId eventIds[]);
+    void close_stream();
 
     FSEventStreamRef stream = nullptr;
+    std::atomic<CFRunLoopRef> run_loop{nullptr};
     bool numeric_event = false;
+    event_batch events;
   };
 }
 
@@ -21,12 +21,15 @@
 #include "inotify_monitor.h"
 #include <limits.h>
 #include <unistd.h>
+#include <poll.h>
+#include <errno.h>
+#include <fcntl.h>
 #include <stdio.h>
 #include <iostream>
 #include <sstream>
 #include <ctime>
 #include "libfsw_exception.h"
-#include "libfsw_log.h"
+#include "../c/libfsw_log.h"
 #include "libfsw_map.h"
 
 using namespace std;
@@ -37,9 +40,11 @@ namespace fsw
   struct inotify_monitor_load
   {
     int inotify_monitor_handle = -1;
-    std::vector<event> events;
+    // Written by stop() to wake up the monitor waiting for events.
+    int stop_pipe[2] = {-1, -1};
+    event_batch events;
     fsw_hash_map<int, std::string> file_names_by_descriptor;
-    time_t curr_time;
+    event_timestamp curr_time;
   };
 
   static const unsigned int BUFFER_SIZE = (10 * ((sizeof (struct inotify_event)) + NAME_MAX + 1));
@@ -48,6 +53,19 @@ namespace fsw
                                    FSW_EVENT_CALLBACK * callback,
                                    void * context) :
     monitor(paths_to_monitor, callback, context), load(new inotify_monitor_load())
+  {
+    initialize_inotify();
+  }
+
+  inotify_monitor::inotify_monitor(vector<string> paths_to_monitor,
+                                   FSW_EVENT_BATCH_CALLBACK * callback,
+                                   void * context) :
+    monitor(paths_to_monitor, callback, context), load(new inotify_monitor_load())
+  {
+    initialize_inotify();
+  }
+
+  void inotify_monitor::initialize_inotify()
   {
     load->inotify_monitor_handle = ::inotify_init();
 
@@ -56,6 +74,13 @@ namespace fsw
       ::perror("inotify_init");
       throw libfsw_exception("Cannot initialize inotify.");
     }
+
+    if (::pipe2(load->stop_pipe, O_CLOEXEC | O_NONBLOCK) == -1)
+    {
+      ::perror("pipe2");
+      ::close(load->inotify_monitor_handle);
+      throw libfsw_exception("Cannot initialize inotify.");
+    }
   }
 
   inotify_monitor::~inotify_monitor()
@@ -75,6 +100,9 @@ namespace fsw
       ::close(load->inotify_monitor_handle);
     }
 
+    ::close(load->stop_pipe[0]);
+    ::close(load->stop_pipe[1]);
+
     delete load;
   }
 
@@ -108,104 +136,161 @@ namespace fsw
 
   void inotify_monitor::preprocess_dir_event(struct inotify_event * event)
   {
-    vector<fsw_event_flag> flags;
+    uint32_t flags = 0;
 
-    if (event->mask & IN_DELETE_SELF) flags.push_back(fsw_event_flag::Removed);
-    if (event->mask & IN_ISDIR) flags.push_back(fsw_event_flag::IsDir);
-    if (event->mask & IN_MOVE_SELF) flags.push_back(fsw_event_flag::Updated);
-    if (event->mask & IN_UNMOUNT) flags.push_back(fsw_event_flag::PlatformSpecific);
+    if (event->mask & IN_DELETE_SELF) flags |= fsw_event_flag::Removed;
+    if (event->mask & IN_ISDIR) flags |= fsw_event_flag::IsDir;
+    if (event->mask & IN_MOVE_SELF) flags |= fsw_event_flag::Updated;
+    if (event->mask & IN_UNMOUNT) flags |= fsw_event_flag::PlatformSpecific;
 
-    if (flags.size())
+    if (flags)
     {
-      load->events.push_back({load->file_names_by_descriptor[event->wd], load->curr_time, flags});
+      load->events.add(load->file_names_by_descriptor[event->wd], load->curr_time, flags);
     }
   }
 
   void inotify_monitor::preprocess_node_event(struct inotify_event * event)
   {
-    vector<fsw_event_flag> flags;
-
-    if (event->mask & IN_ACCESS) flags.push_back(fsw_event_flag::PlatformSpecific);
-    if (event->mask & IN_ATTRIB) flags.push_back(fsw_event_flag::AttributeModified);
-    if (event->mask & IN_CLOSE_NOWRITE) flags.push_back(fsw_event_flag::PlatformSpecific);
-    if (event->mask & IN_CLOSE_WRITE) flags.push_back(fsw_event_flag::Updated);
-    if (event->mask & IN_CREATE) flags.push_back(fsw_event_flag::Created);
-    if (event->mask & IN_DELETE) flags.push_back(fsw_event_flag::Removed);
-    if (event->mask & IN_MODIFY) flags.push_back(fsw_event_flag::Updated);
-    if (event->mask & IN_MOVED_FROM) flags.push_back(fsw_event_flag::Updated);
-    if (event->mask & IN_MOVED_TO) flags.push_back(fsw_event_flag::Updated);
-    if (event->mask & IN_OPEN) flags.push_back(fsw_event_flag::PlatformSpecific);
-
-    if (flags.size())
+    uint32_t flags = 0;
+
+    if (event->mask & IN_ACCESS) flags |= fsw_event_flag::PlatformSpecific;
+    if (event->mask & IN_ATTRIB) flags |= fsw_event_flag::AttributeModified;
+    if (event->mask & IN_CLOSE_NOWRITE) flags |= fsw_event_flag::PlatformSpecific;
+    if (event->mask & IN_CLOSE_WRITE) flags |= fsw_event_flag::Updated;
+    if (event->mask & IN_CREATE) flags |= fsw_event_flag::Created;
+    if (event->mask & IN_DELETE) flags |= fsw_event_flag::Removed;
+    if (event->mask & IN_MODIFY) flags |= fsw_event_flag::Updated;
+    if (event->mask & IN_MOVED_FROM) flags |= fsw_event_flag::Updated;
+    if (event->mask & IN_MOVED_TO) flags |= fsw_event_flag::Updated;
+    if (event->mask & IN_OPEN) flags |= fsw_event_flag::PlatformSpecific;
+
+    // IN_ISDIR tells the type of the subject of the event for free.
+    if (flags && (event->mask & IN_ISDIR)) flags |= fsw_event_flag::IsDir;
+
+    if (flags)
     {
-      ostringstream path_stream;
-      path_stream << load->file_names_by_descriptor[event->wd];
+      // The path is assembled directly into the arena of the batch.
+      const string &dir = load->file_names_by_descriptor[event->wd];
 
       if (event->len > 1)
       {
-        path_stream << "/";
-        path_stream << event->name;
+        load->events.add(dir, event->name, load->curr_time, flags);
+      }
+      else
+      {
+        load->events.add(dir, load->curr_time, flags);
       }
-
-      load->events.push_back({path_stream.str(), load->curr_time, flags});
     }
   }
 
   void inotify_monitor::preprocess_event(struct inotify_event * event)
   {
+    // Events were lost: report the gap instead of giving up.
     if (event->mask & IN_Q_OVERFLOW)
     {
-      throw libfsw_exception("Event queue overflowed.");
+      libfsw_log("Event queue overflowed.\n");
+      add_overflow_event(load->events, load->curr_time);
+      return;
     }
 
     preprocess_dir_event(event);
     preprocess_node_event(event);
   }
 
-  void inotify_monitor::notify_events()
-  {
-    if (load->events.size())
-    {
-      callback(load->events);
-      load->events.clear();
-    }
-  }
-
   void inotify_monitor::run()
   {
     collect_initial_data();
 
     char buffer[BUFFER_SIZE];
 
-    while (true)
+    while (!is_stopping())
     {
-      ssize_t record_num = ::read(load->inotify_monitor_handle,
-                                  buffer,
-                                  BUFFER_SIZE);
+      set_watch_count(load->file_names_by_descriptor.size());
 
-      if (!record_num)
-      {
-        throw libfsw_exception("::read() on inotify descriptor read 0 records.");
-      }
+      if (!wait_for_events(-1)) continue;
+
+      read_events(buffer);
 
-      if (record_num == -1)
+      // When coalescing, keep on reading for the duration of the latency so
+      // that the events of the whole window are merged into one batch.
+      if (coalesce_events)
       {
-        ::perror("read()");
-        throw libfsw_exception("::read() on inotify descriptor returned -1.");
+        const uint64_t window_end = get_monotonic_time_ns() + latency * 1000000000;
+        uint64_t now;
+
+        while (!is_stopping()
+               && (now = get_monotonic_time_ns()) < window_end
+               && wait_for_events((window_end - now + 999999) / 1000000))
+        {
+          read_events(buffer);
+        }
       }
 
-      time(&load->curr_time);
+      notify_events(load->events);
+    }
+  }
+
+  void inotify_monitor::read_events(char * buffer)
+  {
+    ssize_t record_num = ::read(load->inotify_monitor_handle,
+                                buffer,
+                                BUFFER_SIZE);
 
-      for (char *p = buffer; p < buffer + record_num;)
-      {
-        struct inotify_event * event = reinterpret_cast<struct inotify_event *> (p);
+    if (!record_num)
+    {
+      throw libfsw_exception("::read() on inotify descriptor read 0 records.");
+    }
 
-        preprocess_event(event);
+    if (record_num == -1)
+    {
+      ::perror("read()");
+      throw libfsw_exception("::read() on inotify descriptor returned -1.");
+    }
 
-        p += (sizeof (struct inotify_event)) + event->len;
-      }
+    load->curr_time = get_event_timestamp();
+
+    for (char *p = buffer; p < buffer + record_num;)
+    {
+      struct inotify_event * event = reinterpret_cast<struct inotify_event *> (p);
+
+      preprocess_event(event);
+
+      p += (sizeof (struct inotify_event)) + event->len;
+    }
+  }
 
-      notify_events();
+  bool inotify_monitor::wait_for_events(int timeout_ms)
+  {
+    struct pollfd fds[] = {
+      {load->inotify_monitor_handle, POLLIN, 0},
+      {load->stop_pipe[0], POLLIN, 0}
+    };
+
+    int ret = ::poll(fds, 2, timeout_ms);
+
+    if (ret == -1 && errno != EINTR)
+    {
+      ::perror("poll()");
+      throw libfsw_exception("::poll() on inotify descriptor returned -1.");
+    }
+
+    if (ret > 0 && (fds[1].revents & POLLIN))
+    {
+      char drain[64];
+      while (::read(load->stop_pipe[0], drain, sizeof (drain)) > 0);
+    }
+
+    return ret > 0 && (fds[0].revents & POLLIN);
+  }
+
+  void inotify_monitor::on_stop()
+  {
+    const char wakeup = 0;
+
+    // The pipe is non-blocking: if it is full, a wakeup is pending anyway.
+    if (::write(load->stop_pipe[1], &wakeup, 1) == -1 && errno != EAGAIN)
+    {
+      ::perror("write()");
     }
   }
 }
\ No newline at end of file
@@ -32,16 +32,24 @@ namespace fsw
     inotify_monitor(std::vector<std::string> paths,
                     FSW_EVENT_CALLBACK * callback,
                     void * context = nullptr);
+    inotify_monitor(std::vector<std::string> paths,
+                    FSW_EVENT_BATCH_CALLBACK * callback,
+                    void * context = nullptr);
     virtual ~inotify_monitor();
 
     void run();
 
+  protected:
+    void on_stop();
+
   private:
     inotify_monitor(const inotify_monitor& orig) = delete;
     inotify_monitor& operator=(const inotify_monitor & that) = delete;
 
+    void initialize_inotify();
     void collect_initial_data();
-    void notify_events();
+    void read_events(char * buffer);
+    bool wait_for_events(int timeout_ms);
     void preprocess_dir_event(struct inotify_event * event);
     void preprocess_event(struct inotify_event * event);
     void preprocess_node_event(struct inotify_event * event);
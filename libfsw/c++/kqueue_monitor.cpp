@@ -46,6 +46,7 @@ namespace fsw
     fsw_hash_set<int> descriptors_to_remove;
     fsw_hash_set<int> descriptors_to_rescan;
     fsw_hash_map<int, mode_t> file_modes;
+    event_batch events;
   };
 
   typedef struct KqueueFlagType
@@ -78,21 +79,28 @@ namespace fsw
   {
   }
 
+  kqueue_monitor::kqueue_monitor(vector<string> paths_to_monitor,
+                                 FSW_EVENT_BATCH_CALLBACK * callback,
+                                 void * context) :
+    monitor(paths_to_monitor, callback, context), load(new kqueue_monitor_load())
+  {
+  }
+
   kqueue_monitor::~kqueue_monitor()
   {
     if (kq != -1) ::close(kq);
     delete load;
   }
 
-  static vector<fsw_event_flag> decode_flags(uint32_t flag)
+  static uint32_t decode_flags(uint32_t flag)
   {
-    vector<fsw_event_flag> evt_flags;
+    uint32_t evt_flags = 0;
 
     for (const KqueueFlagType &type : event_flag_type)
     {
       if (flag & type.flag)
       {
-        evt_flags.push_back(type.type);
+        evt_flags |= type.type;
       }
     }
 
@@ -295,9 +303,7 @@ namespace fsw
                                       const vector<struct ::kevent> &event_list,
                                       int event_num)
   {
-    time_t curr_time;
-    time(&curr_time);
-    vector<event> events;
+    const event_timestamp curr_time = get_event_timestamp();
 
     for (auto i = 0; i < event_num; ++i)
     {
@@ -337,24 +343,22 @@ namespace fsw
       {
         if (accept_path(load->file_names_by_descriptor[e.ident]))
         {
-          events.push_back({load->file_names_by_descriptor[e.ident],
+          load->events.add(load->file_names_by_descriptor[e.ident],
                            curr_time,
-                           decode_flags(e.fflags)});
+                           decode_flags(e.fflags));
         }
       }
     }
 
-    if (events.size())
-    {
-      callback(events, context);
-    }
+    notify_events(load->events);
   }
 
   void kqueue_monitor::run()
   {
     initialize_kqueue();
 
-    while (true)
+    // kevent() waits at most for the latency: stop() needs no wakeup.
+    while (!is_stopping())
     {
       // remove the deleted descriptors
       remove_deleted();
@@ -364,6 +368,7 @@ namespace fsw
 
       // scan the root paths to check whether someone is missing
       scan_root_paths();
+      set_watch_count(load->file_names_by_descriptor.size());
 
       vector<struct ::kevent> changes;
       vector<struct kevent> event_list;
@@ -387,13 +392,18 @@ namespace fsw
 
       if (!changes.size())
       {
-        ::sleep(latency > MIN_SPIN_LATENCY ? latency : MIN_SPIN_LATENCY);
+        const unsigned int seconds = latency > MIN_SPIN_LATENCY ? latency : MIN_SPIN_LATENCY;
+        wait_for_stop(seconds * 1000000000ULL);
         continue;
       }
 
       const int event_num = wait_for_events(changes, event_list);
       process_events(changes, event_list, event_num);
     }
+
+    // A stopped monitor can be started again with a new kqueue.
+    ::close(kq);
+    kq = -1;
   }
 }
 
@@ -34,6 +34,9 @@ namespace fsw
     kqueue_monitor(std::vector<std::string> paths,
                    FSW_EVENT_CALLBACK * callback,
                    void * context = nullptr);
+    kqueue_monitor(std::vector<std::string> paths,
+                   FSW_EVENT_BATCH_CALLBACK * callback,
+                   void * context = nullptr);
     virtual ~kqueue_monitor();
 
     void run();
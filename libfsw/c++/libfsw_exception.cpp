@@ -21,14 +21,16 @@ using namespace std;
 namespace fsw
 {
 
+  // The message is formatted once: what() must not return the buffer of a
+  // temporary string.
   libfsw_exception::libfsw_exception(string cause, int code) :
-    cause(cause), code(code)
+    cause("Error: " + cause), code(code)
   {
   }
 
   const char * libfsw_exception::what() const noexcept
   {
-    return (string("Error: ") + this->cause).c_str();
+    return cause.c_str();
   }
 
   int libfsw_exception::error_code() const noexcept
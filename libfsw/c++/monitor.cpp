@@ -19,6 +19,7 @@
 #endif
 #include "monitor.h"
 #include "libfsw_exception.h"
+#include <chrono>
 #include <cstdlib>
 #ifdef HAVE_REGCOMP
 #  include <regex.h>
@@ -38,6 +39,7 @@
 #  include "inotify_monitor.h"
 #endif
 #include "poll_monitor.h"
+#include "replay_monitor.h"
 
 using namespace std;
 
@@ -63,6 +65,17 @@ namespace fsw
     }
   }
 
+  monitor::monitor(std::vector<std::string> paths,
+                   FSW_EVENT_BATCH_CALLBACK * callback,
+                   void * context) :
+    paths(paths), batch_callback(callback), context(context)
+  {
+    if (callback == nullptr)
+    {
+      throw libfsw_exception("Callback cannot be null.", FSW_ERR_CALLBACK_NOT_SET);
+    }
+  }
+
   void monitor::set_latency(double latency)
   {
     if (latency < 0)
@@ -98,6 +111,15 @@ namespace fsw
   void monitor::set_filters(const std::vector<monitor_filter> &filters)
   {
 #ifdef HAVE_REGCOMP
+    // The filters replace the current ones, so that setting them again
+    // before restarting a monitor does not accumulate them.
+    for (auto &re : this->filters)
+    {
+      ::regfree(&re.regex);
+    }
+
+    this->filters.clear();
+
     for (const monitor_filter &filter : filters)
     {
       add_filter(filter);
@@ -122,14 +144,363 @@ namespace fsw
     {
       if (::regexec(&filter.regex, path, 0, nullptr, 0) == 0)
       {
-        return filter.type == fsw_filter_type::filter_include;
+        const bool accepted = filter.type == fsw_filter_type::filter_include;
+        (accepted ? accepted_paths : rejected_paths).add();
+
+        return accepted;
       }
     }
 #endif
 
+    accepted_paths.add();
+
     return true;
   }
 
+  void monitor::set_coalesce_events(bool coalesce)
+  {
+    coalesce_events = coalesce;
+  }
+
+  coalescing_stats monitor::get_coalescing_stats() const
+  {
+    return coalescer.get_stats();
+  }
+
+  void monitor::set_enrich_events(bool enrich)
+  {
+    enrich_events = enrich;
+  }
+
+  void monitor::set_enrichment_threads(unsigned int threads)
+  {
+    enricher.set_threads(threads);
+  }
+
+  void monitor::set_history_size(size_t events)
+  {
+    lock_guard<mutex> delivery_guard(delivery_mutex);
+    history.set_capacity(events);
+  }
+
+  bool monitor::replay_events(uint64_t from_sequence)
+  {
+    unique_lock<mutex> delivery_lock(delivery_mutex);
+
+    event_batch replayed = batch_pool.acquire();
+    bool complete = history.replay(from_sequence, replayed);
+
+    if (!complete)
+    {
+      event_batch gap = batch_pool.acquire();
+      gap.add("", 0, get_event_timestamp(), fsw_event_flag::Overflow);
+
+      for (size_t i = 0; i < replayed.size(); ++i)
+      {
+        gap.add(replayed, i);
+      }
+
+      replayed.swap(gap);
+      batch_pool.release(std::move(gap));
+    }
+
+    if (!replayed.empty())
+    {
+      // The dispatcher thread cannot push into its own queue: the replayed
+      // events are delivered by deliver_dispatched() after the callback.
+      if (dispatcher && dispatcher->is_delivery_thread())
+      {
+        for (size_t i = 0; i < replayed.size(); ++i)
+        {
+          dispatched_replays.add(replayed, i);
+        }
+      }
+      else
+      {
+        deliver_in_order(replayed, delivery_lock);
+      }
+    }
+
+    batch_pool.release(std::move(replayed));
+
+    return complete;
+  }
+
+  void monitor::set_dispatch_queue_size(size_t batches)
+  {
+    if (!batches)
+    {
+      dispatcher.reset();
+      return;
+    }
+
+    dispatcher.reset(new event_dispatcher(batches, [this](event_batch &events)
+    {
+      deliver_dispatched(events);
+    }));
+    dispatcher->set_policy(backpressure_policy);
+    dispatcher->set_memory_limit(dispatch_memory_limit);
+  }
+
+  void monitor::set_backpressure_policy(fsw_backpressure_policy policy)
+  {
+    backpressure_policy = policy;
+    if (dispatcher) dispatcher->set_policy(policy);
+  }
+
+  void monitor::set_dispatch_memory_limit(size_t bytes)
+  {
+    dispatch_memory_limit = bytes;
+    if (dispatcher) dispatcher->set_memory_limit(bytes);
+  }
+
+  dispatch_stats monitor::get_dispatch_stats() const
+  {
+    if (!dispatcher) return dispatch_stats();
+
+    return dispatcher->get_stats();
+  }
+
+  static uint64_t seconds_to_ns(double seconds)
+  {
+    return static_cast<uint64_t> (seconds * 1000000000.0);
+  }
+
+  void monitor::set_debounce(double debounce)
+  {
+    if (debounce < 0)
+    {
+      throw libfsw_exception("Debounce time cannot be negative.", FSW_ERR_INVALID_DEBOUNCE);
+    }
+
+    debouncer.set_debounce(seconds_to_ns(debounce));
+  }
+
+  void monitor::set_throttle(double throttle)
+  {
+    if (throttle < 0)
+    {
+      throw libfsw_exception("Throttle time cannot be negative.", FSW_ERR_INVALID_DEBOUNCE);
+    }
+
+    debouncer.set_throttle(seconds_to_ns(throttle));
+  }
+
+  void monitor::set_settle_time(double settle)
+  {
+    if (settle < 0)
+    {
+      throw libfsw_exception("Settle time cannot be negative.", FSW_ERR_INVALID_DEBOUNCE);
+    }
+
+    debouncer.set_settle_time(seconds_to_ns(settle));
+  }
+
+  void monitor::set_debounce_depth(unsigned int depth)
+  {
+    debouncer.set_key_depth(depth);
+  }
+
+  debounce_stats monitor::get_debounce_stats() const
+  {
+    return debouncer.get_stats();
+  }
+
+  void monitor::add_overflow_event(event_batch &events,
+                                   const event_timestamp &time)
+  {
+    events.add("", 0, time, fsw_event_flag::Overflow);
+    record_overflow();
+  }
+
+  void monitor::record_overflow()
+  {
+    overflows.add();
+  }
+
+  void monitor::set_watch_count(size_t watches)
+  {
+    this->watches.set(watches);
+  }
+
+  void monitor::record_scan_time(uint64_t time_ns)
+  {
+    scan_times.record(time_ns);
+  }
+
+  fsw_monitor_stats monitor::get_stats() const
+  {
+    fsw_monitor_stats stats;
+    const uint64_t started = start_time.load(memory_order_relaxed);
+
+    stats.uptime_ns = started ? get_monotonic_time_ns() - started : 0;
+    stats.watches = watches.get();
+    stats.overflows = overflows.get();
+    stats.events = delivered_events.get();
+    stats.batches = delivered_batches.get();
+    stats.accepted_paths = accepted_paths.get();
+    stats.rejected_paths = rejected_paths.get();
+    batch_sizes.read(stats.batch_sizes);
+    scan_times.read(stats.scan_time_ns);
+    callback_times.read(stats.callback_time_ns);
+
+    return stats;
+  }
+
+  void monitor::notify_events(event_batch &events)
+  {
+    if (events.empty()) return;
+
+    event_batch * batch = &events;
+
+    if (coalesce_events)
+    {
+      coalescer.coalesce(events, coalesced_events);
+      events.clear();
+      batch = &coalesced_events;
+    }
+
+    if (debouncer.is_enabled())
+    {
+      // The debouncer publishes the events when they are due.
+      debouncer.add(*batch);
+      batch->clear();
+      return;
+    }
+
+    publish_events(*batch);
+  }
+
+  void monitor::publish_events(event_batch &events)
+  {
+    unique_lock<mutex> delivery_lock(delivery_mutex);
+
+    // Enrich after coalescing and debouncing, so that each path is stat()ed
+    // once, as late as possible.
+    if (enrich_events) enricher.enrich(events);
+
+    // Sequence numbers are assigned to the events which are actually
+    // delivered, in the order they are delivered.
+    last_sequence = events.assign_sequences(last_sequence + 1) - 1;
+
+    history.record(events);
+    deliver_in_order(events, delivery_lock);
+  }
+
+  void monitor::deliver_in_order(event_batch &events,
+                                 unique_lock<mutex> &delivery_lock)
+  {
+    // The callback runs without delivery_mutex held, so that it may call
+    // set_history_size() or replay_events().  Only one thread delivers at a
+    // time: the events published meanwhile, by other threads or by the
+    // callback itself, are queued and delivered by it, in order.
+    if (delivering)
+    {
+      for (size_t i = 0; i < events.size(); ++i)
+      {
+        queued_events.add(events, i);
+      }
+
+      events.clear();
+      return;
+    }
+
+    delivering = true;
+    delivery_lock.unlock();
+
+    try
+    {
+      deliver_events(events);
+      delivery_lock.lock();
+
+      while (!queued_events.empty())
+      {
+        event_batch queued = batch_pool.acquire();
+        queued.swap(queued_events);
+
+        delivery_lock.unlock();
+        deliver_events(queued);
+        batch_pool.release(std::move(queued));
+        delivery_lock.lock();
+      }
+    }
+    catch (...)
+    {
+      if (!delivery_lock.owns_lock()) delivery_lock.lock();
+      queued_events.clear();
+      delivering = false;
+      throw;
+    }
+
+    delivering = false;
+  }
+
+  void monitor::deliver_events(event_batch &events)
+  {
+    if (dispatcher)
+    {
+      dispatcher->push(events);
+      events.clear();
+      return;
+    }
+
+    invoke_callback(events);
+  }
+
+  void monitor::deliver_dispatched(event_batch &events)
+  {
+    invoke_callback(events);
+
+    unique_lock<mutex> delivery_lock(delivery_mutex);
+
+    while (!dispatched_replays.empty())
+    {
+      event_batch replayed = batch_pool.acquire();
+      replayed.swap(dispatched_replays);
+
+      delivery_lock.unlock();
+      invoke_callback(replayed);
+      batch_pool.release(std::move(replayed));
+      delivery_lock.lock();
+    }
+  }
+
+  void monitor::invoke_callback(event_batch &events)
+  {
+    const uint64_t callback_start = get_monotonic_time_ns();
+
+    delivered_events.add(events.size());
+    delivered_batches.add();
+    batch_sizes.record(events.size());
+
+    // Legacy callbacks receive a copy of the batch converted to
+    // std::vector<event>; batch callbacks get the batch itself.
+    if (batch_callback)
+    {
+      batch_callback(events, context);
+
+      // If the callback took ownership of the batch, continue with a
+      // recycled one instead of growing the moved-from batch from scratch.
+      if (!events.capacity())
+      {
+        event_batch recycled = batch_pool.acquire();
+        events.swap(recycled);
+      }
+    }
+    else
+    {
+      callback(events.to_events(), context);
+    }
+
+    callback_times.record(get_monotonic_time_ns() - callback_start);
+    events.clear();
+  }
+
+  event_batch_pool & monitor::get_batch_pool()
+  {
+    return batch_pool;
+  }
+
   void * monitor::get_context()
   {
     return context;
@@ -152,9 +523,10 @@ namespace fsw
 #endif
   }
 
-  monitor * monitor::create_default_monitor(std::vector<std::string> paths,
-                                            FSW_EVENT_CALLBACK * callback,
-                                            void * context)
+  template <typename C>
+  static monitor * create_default_monitor_with(std::vector<std::string> paths,
+                                               C * callback,
+                                               void * context)
   {
 #if defined(HAVE_CORESERVICES_CORESERVICES_H)
     return new fsevent_monitor(paths, callback, context);
@@ -167,15 +539,16 @@ namespace fsw
 #endif
   }
 
-  monitor * monitor::create_monitor(fsw_monitor_type type,
-                                    std::vector<std::string> paths,
-                                    FSW_EVENT_CALLBACK * callback,
-                                    void * context)
+  template <typename C>
+  static monitor * create_monitor_with(fsw_monitor_type type,
+                                       std::vector<std::string> paths,
+                                       C * callback,
+                                       void * context)
   {
     switch (type)
     {
     case system_default_monitor_type:
-      return monitor::create_default_monitor(paths, callback, context);
+      return create_default_monitor_with(paths, callback, context);
 
     case fsevents_monitor_type:
 #if defined(HAVE_CORESERVICES_CORESERVICES_H)
@@ -201,14 +574,109 @@ namespace fsw
     case poll_monitor_type:
       return new poll_monitor(paths, callback, context);
 
+    case replay_monitor_type:
+      return new replay_monitor(paths, callback, context);
+
     default:
       throw libfsw_exception("Unsupported monitor.", FSW_ERR_UNKNOWN_MONITOR_TYPE);
     }
   }
+
+  monitor * monitor::create_default_monitor(std::vector<std::string> paths,
+                                            FSW_EVENT_CALLBACK * callback,
+                                            void * context)
+  {
+    return create_default_monitor_with(paths, callback, context);
+  }
+
+  monitor * monitor::create_default_monitor(std::vector<std::string> paths,
+                                            FSW_EVENT_BATCH_CALLBACK * callback,
+                                            void * context)
+  {
+    return create_default_monitor_with(paths, callback, context);
+  }
+
+  monitor * monitor::create_monitor(fsw_monitor_type type,
+                                    std::vector<std::string> paths,
+                                    FSW_EVENT_CALLBACK * callback,
+                                    void * context)
+  {
+    return create_monitor_with(type, paths, callback, context);
+  }
+
+  monitor * monitor::create_monitor(fsw_monitor_type type,
+                                    std::vector<std::string> paths,
+                                    FSW_EVENT_BATCH_CALLBACK * callback,
+                                    void * context)
+  {
+    return create_monitor_with(type, paths, callback, context);
+  }
   
   void monitor::start()
   {
     lock_guard<mutex> run_guard(run_mutex);
-    this->run();
+
+    if (dispatcher) dispatcher->start();
+    if (debouncer.is_enabled()) debouncer.start();
+
+    start_time.store(get_monotonic_time_ns(), memory_order_relaxed);
+
+    try
+    {
+      this->run();
+    }
+    catch (...)
+    {
+      start_time.store(0, memory_order_relaxed);
+      stop_delivery();
+      stopping.store(false, memory_order_relaxed);
+      throw;
+    }
+
+    start_time.store(0, memory_order_relaxed);
+    stop_delivery();
+
+    // The monitor can be started again.
+    stopping.store(false, memory_order_relaxed);
+  }
+
+  void monitor::stop()
+  {
+    {
+      lock_guard<mutex> stop_guard(stop_mutex);
+      stopping.store(true, memory_order_relaxed);
+    }
+
+    stop_cv.notify_all();
+    on_stop();
+  }
+
+  void monitor::on_stop()
+  {
+  }
+
+  bool monitor::is_stopping() const
+  {
+    return stopping.load(memory_order_relaxed);
+  }
+
+  bool monitor::wait_for_stop(uint64_t timeout_ns)
+  {
+    unique_lock<mutex> stop_lock(stop_mutex);
+
+    return stop_cv.wait_for(stop_lock,
+                            chrono::nanoseconds(timeout_ns),
+                            [this]
+                            {
+                              return stopping.load(memory_order_relaxed);
+                            });
+  }
+
+  void monitor::stop_delivery()
+  {
+    // Events still pending or queued when the monitor stops are delivered
+    // before returning.
+    debouncer.stop();
+    if (dispatcher) dispatcher->stop();
   }
 }
\ No newline at end of file
@@ -21,12 +21,61 @@
 #  include <vector>
 #  include <string>
 #  include <mutex>
+#  include <memory>
+#  include <atomic>
+#  include <condition_variable>
 #  include "event.h"
+#  include "event_batch.h"
+#  include "event_coalescer.h"
+#  include "event_debouncer.h"
+#  include "event_dispatcher.h"
+#  include "event_history.h"
+#  include "monitor_stats.h"
+#  include "stat_enricher.h"
 #  include "../c/cmonitor.h"
 
 namespace fsw
 {
   typedef void FSW_EVENT_CALLBACK(const std::vector<event> &, void *);
+  /*
+   * A batch callback receives the batch owned by the monitor.  The callback
+   * may take ownership of the batch by moving it out (or swapping it): the
+   * monitor then continues with a batch taken from its pool.  Batches which
+   * are no longer needed can be returned to the pool of the monitor using
+   * get_batch_pool().release().
+   *
+   * Every event produced by a monitor carries a sequence number, starting
+   * from 1.  When the operating system drops events, the monitor delivers an
+   * event with an empty path and the Overflow flag.  If a history size is
+   * set, replay_events() delivers again the retained events whose sequence
+   * number is greater than or equal to from_sequence, preceded by an
+   * Overflow event (with sequence number 0) if some of them have already
+   * been discarded.  Called from a callback, replay_events() delivers the
+   * events once the callback returns.
+   *
+   * By default the callback runs on the thread of the monitor.  If a
+   * dispatch queue size is set (before calling start()), events are queued
+   * instead and the callback runs on a separate delivery thread, so that a
+   * slow callback does not prevent the monitor from draining the queue of
+   * the operating system.  When the queue is full or the memory used by the
+   * queued events exceeds the dispatch memory limit, the backpressure policy
+   * decides whether the monitor waits, discards events or coalesces the
+   * queued events by path (see event_dispatcher.h).
+   *
+   * Debounce, throttle and settle times (in seconds) delay and merge events
+   * per path, or per subtree if a debounce depth is set, before they are
+   * delivered (see event_debouncer.h).
+   *
+   * get_stats() returns the runtime statistics of a monitor (see
+   * fsw_monitor_stats in cmonitor.h), and can be called from any thread
+   * while the monitor is running.
+   *
+   * stop() asks a running monitor to stop: start() returns once the events
+   * already received have been delivered.  It can be called from any thread,
+   * including from a callback; when called before start(), the next call to
+   * start() returns right away.  A stopped monitor can be started again.
+   */
+  typedef void FSW_EVENT_BATCH_CALLBACK(event_batch &, void *);
 
   struct compiled_monitor_filter;
 
@@ -36,6 +85,9 @@ namespace fsw
     monitor(std::vector<std::string> paths,
             FSW_EVENT_CALLBACK * callback,
             void * context = nullptr);
+    monitor(std::vector<std::string> paths,
+            FSW_EVENT_BATCH_CALLBACK * callback,
+            void * context = nullptr);
     virtual ~monitor();
     monitor(const monitor& orig) = delete;
     monitor& operator=(const monitor & that) = delete;
@@ -44,36 +96,115 @@ namespace fsw
     void add_filter(const monitor_filter &filter);
     void set_filters(const std::vector<monitor_filter> &filters);
     void set_follow_symlinks(bool follow);
+    void set_coalesce_events(bool coalesce);
+    coalescing_stats get_coalescing_stats() const;
+    void set_enrich_events(bool enrich);
+    void set_enrichment_threads(unsigned int threads);
+    void set_history_size(size_t events);
+    bool replay_events(uint64_t from_sequence);
+    void set_dispatch_queue_size(size_t batches);
+    void set_backpressure_policy(fsw_backpressure_policy policy);
+    void set_dispatch_memory_limit(size_t bytes);
+    void set_debounce(double debounce);
+    void set_throttle(double throttle);
+    void set_settle_time(double settle);
+    void set_debounce_depth(unsigned int depth);
+    debounce_stats get_debounce_stats() const;
+    dispatch_stats get_dispatch_stats() const;
+    fsw_monitor_stats get_stats() const;
     void * get_context();
     void set_context(void * context);
+    event_batch_pool & get_batch_pool();
     void start();
+    void stop();
 
     static monitor * create_default_monitor(std::vector<std::string> paths,
                                             FSW_EVENT_CALLBACK * callback,
                                             void * context = nullptr);
+    static monitor * create_default_monitor(std::vector<std::string> paths,
+                                            FSW_EVENT_BATCH_CALLBACK * callback,
+                                            void * context = nullptr);
 
     static monitor * create_monitor(fsw_monitor_type type,
                                     std::vector<std::string> paths,
                                     FSW_EVENT_CALLBACK * callback,
                                     void * context = nullptr);
+    static monitor * create_monitor(fsw_monitor_type type,
+                                    std::vector<std::string> paths,
+                                    FSW_EVENT_BATCH_CALLBACK * callback,
+                                    void * context = nullptr);
 
   protected:
     bool accept_path(const std::string &path);
     bool accept_path(const char *path);
+    void notify_events(event_batch &events);
+    void add_overflow_event(event_batch &events, const event_timestamp &time);
+    void record_overflow();
+    void set_watch_count(size_t watches);
+    void record_scan_time(uint64_t time_ns);
+    bool is_stopping() const;
+    bool wait_for_stop(uint64_t timeout_ns);
 
     virtual void run() = 0;
+    /*
+     * Called by stop() to wake up a monitor blocked in the operating system.
+     * Monitors which only sleep with wait_for_stop(), or which block for a
+     * bounded time before checking is_stopping(), need not override it.
+     */
+    virtual void on_stop();
 
   protected:
     std::vector<std::string> paths;
-    FSW_EVENT_CALLBACK * callback;
+    FSW_EVENT_CALLBACK * callback = nullptr;
+    FSW_EVENT_BATCH_CALLBACK * batch_callback = nullptr;
     void * context = nullptr;
     double latency = 1.0;
     bool recursive = false;
     bool follow_symlinks = false;
+    bool coalesce_events = false;
+    bool enrich_events = false;
 
   private:
+    void publish_events(event_batch &events);
+    void deliver_in_order(event_batch &events,
+                          std::unique_lock<std::mutex> &delivery_lock);
+    void deliver_events(event_batch &events);
+    void deliver_dispatched(event_batch &events);
+    void stop_delivery();
+    void invoke_callback(event_batch &events);
+
     std::mutex run_mutex;
+    std::mutex delivery_mutex;
+    std::mutex stop_mutex;
+    std::condition_variable stop_cv;
+    std::atomic<bool> stopping{false};
+    event_batch_pool batch_pool;
+    event_history history{batch_pool};
+    uint64_t last_sequence = 0;
+    bool delivering = false;
+    event_batch queued_events;
+    event_batch dispatched_replays;
+    event_coalescer coalescer;
+    event_batch coalesced_events;
+    stat_enricher enricher;
+    std::unique_ptr<event_dispatcher> dispatcher;
+    fsw_backpressure_policy backpressure_policy = backpressure_block;
+    size_t dispatch_memory_limit = 0;
+    event_debouncer debouncer{[this](event_batch &events)
+    {
+      publish_events(events);
+    }};
     std::vector<compiled_monitor_filter> filters;
+    std::atomic<uint64_t> start_time{0};
+    stats_counter watches;
+    stats_counter overflows;
+    stats_counter delivered_events;
+    stats_counter delivered_batches;
+    stats_counter accepted_paths;
+    stats_counter rejected_paths;
+    stats_histogram batch_sizes;
+    stats_histogram scan_times;
+    stats_histogram callback_times;
   };
 }
 
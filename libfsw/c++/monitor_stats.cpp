@@ -0,0 +1,44 @@
+/* 
+ * Copyright (C) 2014, Enrico M. Crisostomo
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 3, or (at your option)
+ * any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+#include "monitor_stats.h"
+
+namespace fsw
+{
+
+  void stats_histogram::record(uint64_t value)
+  {
+    unsigned int bucket = 0;
+
+    for (uint64_t v = value; v && bucket < FSW_HISTOGRAM_BUCKETS - 1; v >>= 1)
+      ++bucket;
+
+    buckets[bucket].add();
+    count.add();
+    sum.add(value);
+    if (value > max.get()) max.set(value);
+  }
+
+  void stats_histogram::read(fsw_histogram &histogram) const
+  {
+    for (unsigned int i = 0; i < FSW_HISTOGRAM_BUCKETS; ++i)
+      histogram.buckets[i] = buckets[i].get();
+
+    histogram.count = count.get();
+    histogram.sum = sum.get();
+    histogram.max = max.get();
+  }
+}
@@ -0,0 +1,70 @@
+/* 
+ * Copyright (C) 2014, Enrico M. Crisostomo
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 3, or (at your option)
+ * any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+#ifndef FSW_MONITOR_STATS_H
+#  define FSW_MONITOR_STATS_H
+
+#  include <atomic>
+#  include <cstdint>
+#  include "../c/cmonitor.h"
+
+namespace fsw
+{
+
+  /*
+   * Statistics counters which any thread can read while they are updated.
+   * They are updated by one thread at a time (the monitor thread, or the
+   * thread delivering the events under the delivery mutex), so that plain
+   * relaxed loads and stores are enough and updating them costs no more
+   * than updating a non-atomic counter.
+   */
+  class stats_counter
+  {
+  public:
+    void add(uint64_t n = 1)
+    {
+      value.store(value.load(std::memory_order_relaxed) + n, std::memory_order_relaxed);
+    }
+
+    void set(uint64_t n)
+    {
+      value.store(n, std::memory_order_relaxed);
+    }
+
+    uint64_t get() const
+    {
+      return value.load(std::memory_order_relaxed);
+    }
+
+  private:
+    std::atomic<uint64_t> value{0};
+  };
+
+  class stats_histogram
+  {
+  public:
+    void record(uint64_t value);
+    void read(fsw_histogram &histogram) const;
+
+  private:
+    stats_counter buckets[FSW_HISTOGRAM_BUCKETS];
+    stats_counter count;
+    stats_counter sum;
+    stats_counter max;
+  };
+}
+
+#endif  /* FSW_MONITOR_STATS_H */
@@ -0,0 +1,220 @@
+/* 
+ * Copyright (C) 2014, Enrico M. Crisostomo
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 3, or (at your option)
+ * any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+#include "parallel_dispatcher.h"
+#include "libfsw_exception.h"
+#include <cstring>
+
+using namespace std;
+
+namespace fsw
+{
+
+  parallel_dispatcher::parallel_dispatcher(unsigned int threads,
+                                           FSW_SHARD_CALLBACK * callback,
+                                           void * context) :
+    callback(callback),
+    context(context),
+    pool(make_shared<event_batch_pool>())
+  {
+    if (callback == nullptr)
+    {
+      throw libfsw_exception("Callback cannot be null.", FSW_ERR_CALLBACK_NOT_SET);
+    }
+
+    if (!threads) threads = 1;
+
+    for (unsigned int i = 0; i < threads; ++i)
+    {
+      shards.push_back(unique_ptr<shard>(new shard));
+    }
+
+    for (unique_ptr<shard> &s : shards)
+    {
+      s->worker = thread(&parallel_dispatcher::shard_loop, this, std::ref(*s));
+    }
+  }
+
+  parallel_dispatcher::~parallel_dispatcher()
+  {
+    // Workers process their queued shards before exiting.
+    stopping.store(true);
+
+    for (unique_ptr<shard> &s : shards)
+    {
+      {
+        lock_guard<mutex> queue_guard(s->queue_mutex);
+        s->queue_cv.notify_one();
+      }
+
+      s->worker.join();
+    }
+  }
+
+  void parallel_dispatcher::set_roots(const vector<string> &roots)
+  {
+    lock_guard<mutex> publish_guard(publish_mutex);
+    this->roots = roots;
+  }
+
+  void parallel_dispatcher::set_wait_for_batch(bool wait)
+  {
+    wait_for_batch = wait;
+  }
+
+  size_t parallel_dispatcher::get_shard(const char * path, size_t length) const
+  {
+    for (const string &root : roots)
+    {
+      if (length >= root.length()
+          && ::memcmp(path, root.data(), root.length()) == 0
+          && (length == root.length()
+              || path[root.length()] == '/'
+              || (!root.empty() && root.back() == '/')))
+      {
+        return hash_path(root.data(), root.length()) % shards.size();
+      }
+    }
+
+    return hash_path(path, length) % shards.size();
+  }
+
+  uint64_t parallel_dispatcher::publish(event_batch &events)
+  {
+    lock_guard<mutex> publish_guard(publish_mutex);
+
+    if (events.empty()) return last_ticket;
+
+    shared_ptr<const event_batch> batch = share_batch(events, pool);
+    const uint64_t ticket = ++last_ticket;
+
+    selections.resize(shards.size());
+
+    for (event_selection &selection : selections)
+    {
+      selection.batch = batch;
+      selection.indexes.clear();
+    }
+
+    const vector<uint32_t> &flags = batch->get_flags();
+
+    for (size_t i = 0; i < batch->size(); ++i)
+    {
+      if (flags[i] & fsw_event_flag::Overflow)
+      {
+        for (event_selection &selection : selections)
+        {
+          selection.indexes.push_back(i);
+        }
+
+        continue;
+      }
+
+      selections[get_shard(batch->get_path(i), batch->get_path_length(i))]
+        .indexes.push_back(i);
+    }
+
+    size_t tasks = 0;
+    for (const event_selection &selection : selections)
+    {
+      if (!selection.empty()) ++tasks;
+    }
+
+    {
+      lock_guard<mutex> progress_guard(progress_mutex);
+      pending[ticket] = tasks;
+    }
+
+    for (size_t s = 0; s < shards.size(); ++s)
+    {
+      if (selections[s].empty()) continue;
+
+      lock_guard<mutex> queue_guard(shards[s]->queue_mutex);
+      shards[s]->tasks.push_back({ticket, std::move(selections[s])});
+      shards[s]->queue_cv.notify_one();
+    }
+
+    return ticket;
+  }
+
+  void parallel_dispatcher::shard_loop(shard &s)
+  {
+    for (;;)
+    {
+      shard_task task;
+
+      {
+        unique_lock<mutex> queue_lock(s.queue_mutex);
+
+        s.queue_cv.wait(queue_lock, [&]
+        {
+          return !s.tasks.empty() || stopping.load();
+        });
+
+        if (s.tasks.empty()) return;
+
+        task = std::move(s.tasks.front());
+        s.tasks.pop_front();
+      }
+
+      callback(task.events, context);
+
+      // Drop the reference to the batch before reporting completion.
+      task.events = event_selection();
+      complete(task.ticket);
+    }
+  }
+
+  void parallel_dispatcher::complete(uint64_t ticket)
+  {
+    lock_guard<mutex> progress_guard(progress_mutex);
+
+    auto it = pending.find(ticket);
+    if (--it->second) return;
+
+    pending.erase(it);
+    progress_cv.notify_all();
+  }
+
+  void parallel_dispatcher::wait(uint64_t ticket)
+  {
+    unique_lock<mutex> progress_lock(progress_mutex);
+
+    progress_cv.wait(progress_lock, [&]
+    {
+      return pending.empty() || pending.begin()->first > ticket;
+    });
+  }
+
+  void parallel_dispatcher::wait()
+  {
+    unique_lock<mutex> progress_lock(progress_mutex);
+
+    progress_cv.wait(progress_lock, [&]
+    {
+      return pending.empty();
+    });
+  }
+
+  void parallel_dispatcher::monitor_callback(event_batch &events,
+                                             void * dispatcher)
+  {
+    parallel_dispatcher * parallel = static_cast<parallel_dispatcher *> (dispatcher);
+    const uint64_t ticket = parallel->publish(events);
+
+    if (parallel->wait_for_batch) parallel->wait(ticket);
+  }
+}
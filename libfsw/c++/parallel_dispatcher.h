@@ -0,0 +1,118 @@
+/* 
+ * Copyright (C) 2014, Enrico M. Crisostomo
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 3, or (at your option)
+ * any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+#ifndef FSW_PARALLEL_DISPATCHER_H
+#  define FSW_PARALLEL_DISPATCHER_H
+
+#  include <atomic>
+#  include <condition_variable>
+#  include <cstdint>
+#  include <deque>
+#  include <map>
+#  include <memory>
+#  include <mutex>
+#  include <string>
+#  include <thread>
+#  include <vector>
+#  include "event_batch.h"
+#  include "event_fanout.h"
+
+namespace fsw
+{
+
+  typedef void FSW_SHARD_CALLBACK(const event_selection &, void *);
+
+  /*
+   * Runs a callback on a pool of threads, splitting each batch into shards
+   * by the hash of the path of its events.  Each thread owns a queue of
+   * shards which it processes in order, and all the events of a path are
+   * always routed to the same thread, so that the events of a path are
+   * processed in order, across batches too, while independent paths are
+   * processed concurrently.  If roots are set, events are sharded by the
+   * root containing them instead, which keeps the events of a tree on the
+   * same thread.  Events with the Overflow flag are delivered to every
+   * shard.
+   *
+   * The dispatcher is installed as the batch callback of a monitor:
+   *
+   *   parallel_dispatcher dispatcher(4, callback, context);
+   *   monitor * m = monitor::create_default_monitor(paths,
+   *                                                 parallel_dispatcher::monitor_callback,
+   *                                                 &dispatcher);
+   *
+   * publish() returns a ticket identifying the batch; wait(ticket) blocks
+   * until that batch and all the previous ones have been processed, and
+   * wait() until every published batch has.  By default the monitor
+   * callback waits for each batch before returning, so that the memory
+   * used by pending batches is bounded; set_wait_for_batch(false) lets the
+   * monitor continue while batches are processed.
+   */
+  class parallel_dispatcher
+  {
+  public:
+    parallel_dispatcher(unsigned int threads,
+                        FSW_SHARD_CALLBACK * callback,
+                        void * context = nullptr);
+    ~parallel_dispatcher();
+    parallel_dispatcher(const parallel_dispatcher& orig) = delete;
+    parallel_dispatcher& operator=(const parallel_dispatcher & that) = delete;
+
+    void set_roots(const std::vector<std::string> &roots);
+    void set_wait_for_batch(bool wait);
+    uint64_t publish(event_batch &events);
+    void wait(uint64_t ticket);
+    void wait();
+
+    static void monitor_callback(event_batch &events, void * dispatcher);
+
+  private:
+    struct shard_task
+    {
+      uint64_t ticket;
+      event_selection events;
+    };
+
+    struct shard
+    {
+      std::mutex queue_mutex;
+      std::condition_variable queue_cv;
+      std::deque<shard_task> tasks;
+      std::thread worker;
+    };
+
+    size_t get_shard(const char * path, size_t length) const;
+    void shard_loop(shard &s);
+    void complete(uint64_t ticket);
+
+    std::vector<std::unique_ptr<shard>> shards;
+    FSW_SHARD_CALLBACK * callback;
+    void * context;
+    std::vector<std::string> roots;
+    bool wait_for_batch = true;
+    std::atomic<bool> stopping{false};
+    std::shared_ptr<event_batch_pool> pool;
+
+    std::mutex publish_mutex;
+    std::vector<event_selection> selections;
+    uint64_t last_ticket = 0;
+
+    std::mutex progress_mutex;
+    std::condition_variable progress_cv;
+    std::map<uint64_t, size_t> pending;
+  };
+}
+
+#endif  /* FSW_PARALLEL_DISPATCHER_H */
@@ -21,6 +21,7 @@
 #include "poll_monitor.h"
 #include "c/libfsw_log.h"
 #include "path_utils.h"
+#include "stat_enricher.h"
 #include "libfsw_map.h"
 #include <unistd.h>
 #include <cstdlib>
@@ -50,10 +51,23 @@ namespace fsw
                              FSW_EVENT_CALLBACK * callback,
                              void * context) :
     monitor(paths, callback, context)
+  {
+    initialize();
+  }
+
+  poll_monitor::poll_monitor(vector<string> paths,
+                             FSW_EVENT_BATCH_CALLBACK * callback,
+                             void * context) :
+    monitor(paths, callback, context)
+  {
+    initialize();
+  }
+
+  void poll_monitor::initialize()
   {
     previous_data = new poll_monitor_data();
     new_data = new poll_monitor_data();
-    time(&curr_time);
+    curr_time = get_event_timestamp();
   }
 
   poll_monitor::~poll_monitor()
@@ -85,36 +99,49 @@ namespace fsw
     if (previous_data->tracked_files.count(path))
     {
       watched_file_info pwfi = previous_data->tracked_files[path];
-      vector<fsw_event_flag> flags;
+      uint32_t flags = 0;
 
       if (FSW_MTIME(stat) > pwfi.mtime)
       {
-        flags.push_back(fsw_event_flag::Updated);
+        flags |= fsw_event_flag::Updated;
       }
 
       if (FSW_CTIME(stat) > pwfi.ctime)
       {
-        flags.push_back(fsw_event_flag::AttributeModified);
+        flags |= fsw_event_flag::AttributeModified;
       }
 
-      if (flags.size() > 0)
+      if (flags)
       {
-        events.push_back({path, curr_time, flags});
+        add_event(path, stat, flags);
       }
 
       previous_data->tracked_files.erase(path);
     }
     else
     {
-      vector<fsw_event_flag> flags;
-      flags.push_back(fsw_event_flag::Created);
-
-      events.push_back({path, curr_time, flags});
+      add_event(path, stat, fsw_event_flag::Created);
     }
 
     return true;
   }
 
+  void poll_monitor::add_event(const string &path,
+                               const struct stat &stat,
+                               uint32_t flags)
+  {
+    events.add(path, curr_time, flags);
+
+    // The snapshot already contains the file information: save the enricher
+    // another stat() of the path.
+    if (enrich_events)
+    {
+      fsw_event_stat evt_stat;
+      fill_event_stat(stat, evt_stat);
+      events.set_stat(events.size() - 1, evt_stat);
+    }
+  }
+
   bool poll_monitor::add_path(const string &path,
                               const struct stat &fd_stat,
                               poll_monitor_scan_callback poll_callback)
@@ -154,14 +181,11 @@ namespace fsw
 
   void poll_monitor::find_removed_files()
   {
-    vector<fsw_event_flag> flags;
-    flags.push_back(fsw_event_flag::Removed);
-
     for (auto &removed : previous_data->tracked_files)
     {
       if (accept_path(removed.first))
       {
-        events.push_back({removed.first, curr_time, flags});
+        events.add(removed.first, curr_time, fsw_event_flag::Removed);
       }
     }
   }
@@ -196,18 +220,10 @@ namespace fsw
     }
   }
 
-  void poll_monitor::notify_events()
-  {
-    if (events.size())
-    {
-      callback(events, context);
-      events.clear();
-    }
-  }
-
   void poll_monitor::run()
   {
     collect_initial_data();
+    set_watch_count(previous_data->tracked_files.size());
 
     while (true)
     {
@@ -215,12 +231,17 @@ namespace fsw
       libfsw_log("Done scanning.\n");
 #endif
 
-      ::sleep(latency < MIN_POLL_LATENCY ? MIN_POLL_LATENCY : latency);
+      const unsigned int seconds = latency < MIN_POLL_LATENCY ? MIN_POLL_LATENCY : latency;
+
+      if (wait_for_stop(seconds * 1000000000ULL)) break;
 
-      time(&curr_time);
+      curr_time = get_event_timestamp();
 
       collect_data();
-      notify_events();
+      record_scan_time(get_monotonic_time_ns() - curr_time.monotonic_ns);
+      set_watch_count(previous_data->tracked_files.size());
+
+      notify_events(events);
     }
   }
 }
\ No newline at end of file
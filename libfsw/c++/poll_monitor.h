@@ -30,6 +30,9 @@ namespace fsw
     poll_monitor(std::vector<std::string> paths,
                  FSW_EVENT_CALLBACK * callback,
                  void * context = nullptr);
+    poll_monitor(std::vector<std::string> paths,
+                 FSW_EVENT_BATCH_CALLBACK * callback,
+                 void * context = nullptr);
     virtual ~poll_monitor();
     void run();
 
@@ -51,6 +54,7 @@ namespace fsw
 
     struct poll_monitor_data;
 
+    void initialize();
     void scan(const std::string &path, poll_monitor_scan_callback fn);
     void collect_initial_data();
     void collect_data();
@@ -60,15 +64,17 @@ namespace fsw
     bool initial_scan_callback(const std::string &path, const struct stat &stat);
     bool intermediate_scan_callback(const std::string &path,
                                     const struct stat &stat);
+    void add_event(const std::string &path,
+                   const struct stat &stat,
+                   uint32_t flags);
     void find_removed_files();
-    void notify_events();
     void swap_data_containers();
 
     poll_monitor_data *previous_data;
     poll_monitor_data *new_data;
 
-    std::vector<event> events;
-    time_t curr_time;
+    event_batch events;
+    event_timestamp curr_time;
   };
 }
 
@@ -0,0 +1,105 @@
+/* 
+ * Copyright (C) 2014, Enrico M. Crisostomo
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 3, or (at your option)
+ * any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+#ifdef HAVE_CONFIG_H
+#  include "libfsw_config.h"
+#endif
+
+#include "replay_monitor.h"
+#include "event_log.h"
+#include "libfsw_exception.h"
+
+using namespace std;
+
+namespace fsw
+{
+
+  replay_monitor::replay_monitor(vector<string> paths,
+                                 FSW_EVENT_CALLBACK * callback,
+                                 void * context) :
+    monitor(paths, callback, context)
+  {
+  }
+
+  replay_monitor::replay_monitor(vector<string> paths,
+                                 FSW_EVENT_BATCH_CALLBACK * callback,
+                                 void * context) :
+    monitor(paths, callback, context)
+  {
+  }
+
+  replay_monitor::~replay_monitor()
+  {
+  }
+
+  void replay_monitor::set_speed(double speed)
+  {
+    if (speed < 0)
+    {
+      throw libfsw_exception("Replay speed cannot be negative.", FSW_ERR_INVALID_LATENCY);
+    }
+
+    this->speed = speed;
+  }
+
+  void replay_monitor::replay(const string &path)
+  {
+    event_log_reader reader(path);
+    const uint64_t start = get_monotonic_time_ns();
+    uint64_t recorded_time = 0;
+    uint64_t interval_ns;
+
+    while (!is_stopping() && reader.read_batch(recorded, interval_ns))
+    {
+      recorded_time += interval_ns;
+
+      if (speed > 0)
+      {
+        const uint64_t due = start + static_cast<uint64_t> (recorded_time / speed);
+        const uint64_t now = get_monotonic_time_ns();
+
+        if (due > now && wait_for_stop(due - now)) return;
+      }
+
+      const uint64_t monotonic_ns = get_monotonic_time_ns();
+
+      for (size_t i = 0; i < recorded.size(); ++i)
+      {
+        const compact_event evt = recorded[i];
+
+        // Overflow and Settled events have no path to filter.
+        if (evt.get_path_length() && !accept_path(evt.get_path())) continue;
+
+        events.add(evt.get_path(),
+                   evt.get_path_length(),
+                   {evt.get_time_ns(), monotonic_ns},
+                   evt.get_flags());
+      }
+
+      notify_events(events);
+    }
+  }
+
+  void replay_monitor::run()
+  {
+    for (const string &path : paths)
+    {
+      if (is_stopping()) return;
+
+      replay(path);
+    }
+  }
+}
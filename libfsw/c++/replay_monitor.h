@@ -0,0 +1,63 @@
+/* 
+ * Copyright (C) 2014, Enrico M. Crisostomo
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 3, or (at your option)
+ * any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+#ifndef FSW_REPLAY_MONITOR_H
+#  define FSW_REPLAY_MONITOR_H
+
+#  include "monitor.h"
+
+namespace fsw
+{
+
+  /*
+   * Monitor replaying the batches recorded in event logs (see event_log.h)
+   * instead of watching the file system: its paths are the logs, which are
+   * replayed in order, and run() returns once all of them have been
+   * replayed.  The events keep their recorded time and flags and go through
+   * the same filters, coalescing, debouncing and delivery as the events of
+   * any other monitor, which makes the replay of a log a repeatable load for
+   * everything downstream of the operating system.
+   *
+   * By default batches are replayed with the pacing they were recorded with.
+   * A speed greater than 1 replays them proportionally faster, and a speed
+   * of 0 as fast as possible.
+   */
+  class replay_monitor : public monitor
+  {
+  public:
+    replay_monitor(std::vector<std::string> paths,
+                   FSW_EVENT_CALLBACK * callback,
+                   void * context = nullptr);
+    replay_monitor(std::vector<std::string> paths,
+                   FSW_EVENT_BATCH_CALLBACK * callback,
+                   void * context = nullptr);
+    virtual ~replay_monitor();
+    void set_speed(double speed);
+    void run();
+
+  private:
+    replay_monitor(const replay_monitor& orig) = delete;
+    replay_monitor& operator=(const replay_monitor & that) = delete;
+
+    void replay(const std::string &path);
+
+    double speed = 1.0;
+    event_batch recorded;
+    event_batch events;
+  };
+}
+
+#endif  /* FSW_REPLAY_MONITOR_H */
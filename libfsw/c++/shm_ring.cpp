@@ -0,0 +1,436 @@
+/* 
+ * Copyright (C) 2014, Enrico M. Crisostomo
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 3, or (at your option)
+ * any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+#ifdef HAVE_CONFIG_H
+#  include "libfsw_config.h"
+#endif
+
+#include <cerrno>
+#include <chrono>
+#include <climits>
+#include <cstring>
+#include <thread>
+#include <fcntl.h>
+#include <signal.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#ifdef HAVE_LINUX_FUTEX_H
+#  include <linux/futex.h>
+#  include <sys/syscall.h>
+#endif
+#include "shm_ring.h"
+#include "libfsw_exception.h"
+#include "../c/libfsw_log.h"
+
+using namespace std;
+
+namespace fsw
+{
+
+  // Position of a reader slot which has not started reading yet.
+  static const uint64_t NOT_READING = static_cast<uint64_t> (-1);
+
+  static uint64_t align_up(uint64_t offset, uint64_t alignment)
+  {
+    return (offset + alignment - 1) / alignment * alignment;
+  }
+
+  // Size of the record of an event with an empty path.
+  static const uint64_t MARKER_SIZE = align_up(sizeof (shm_ring_record) + 1, 8);
+
+  static shm_ring_reader_slot * get_slots(shm_ring_header * header)
+  {
+    return reinterpret_cast<shm_ring_reader_slot *> (
+      reinterpret_cast<char *> (header) + header->header_size);
+  }
+
+  shm_ring_writer::shm_ring_writer(const string &name,
+                                   size_t data_size,
+                                   uint32_t max_readers) :
+    name(name)
+  {
+    if (!max_readers)
+      throw libfsw_exception("A ring needs at least one reader slot.", FSW_ERR_SHARED_MEMORY);
+
+    uint64_t size = 4096;
+    while (size < data_size) size <<= 1;
+
+    const uint64_t header_size = align_up(sizeof (shm_ring_header), 64);
+    const uint64_t data_offset = align_up(header_size + max_readers * sizeof (shm_ring_reader_slot), 4096);
+    mapping_size = data_offset + size;
+
+    if (name.empty())
+    {
+#ifdef HAVE_MEMFD_CREATE
+      fd = ::memfd_create("fsw", 0);
+#else
+      throw libfsw_exception("Anonymous shared memory rings are not supported.", FSW_ERR_UNSUPPORTED_OPERATION);
+#endif
+    }
+    else
+    {
+      fd = ::shm_open(name.c_str(), O_CREAT | O_RDWR | O_TRUNC, 0600);
+    }
+
+    if (fd == -1)
+      throw libfsw_exception(string("Cannot create the shared memory ring: ") + strerror(errno), FSW_ERR_SHARED_MEMORY);
+
+    void * mapping = MAP_FAILED;
+
+    if (::ftruncate(fd, mapping_size) == 0)
+      mapping = ::mmap(nullptr, mapping_size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+
+    if (mapping == MAP_FAILED)
+    {
+      const int error = errno;
+
+      ::close(fd);
+      if (!name.empty()) ::shm_unlink(name.c_str());
+
+      throw libfsw_exception(string("Cannot map the shared memory ring: ") + strerror(error), FSW_ERR_SHARED_MEMORY);
+    }
+
+    // The object is zero-filled by ftruncate.
+    header = static_cast<shm_ring_header *> (mapping);
+    header->version = SHM_RING_VERSION;
+    header->header_size = header_size;
+    header->max_readers = max_readers;
+    header->data_offset = data_offset;
+    header->data_size = size;
+
+    slots = get_slots(header);
+    data = static_cast<char *> (mapping) + data_offset;
+
+    for (uint32_t i = 0; i < max_readers; ++i)
+      slots[i].position.store(NOT_READING, memory_order_relaxed);
+
+    // Readers check the magic number last.
+    atomic_thread_fence(memory_order_release);
+    header->magic = SHM_RING_MAGIC;
+  }
+
+  shm_ring_writer::~shm_ring_writer()
+  {
+    ::munmap(header, mapping_size);
+    ::close(fd);
+
+    if (!name.empty()) ::shm_unlink(name.c_str());
+  }
+
+  int shm_ring_writer::get_fd() const
+  {
+    return fd;
+  }
+
+  const string & shm_ring_writer::get_name() const
+  {
+    return name;
+  }
+
+  uint64_t shm_ring_writer::get_dropped_events() const
+  {
+    return header->dropped_events.load(memory_order_relaxed);
+  }
+
+  bool shm_ring_writer::reserve(uint64_t size)
+  {
+    for (int attempt = 0; attempt < 2; ++attempt)
+    {
+      uint64_t oldest = position;
+
+      for (uint32_t i = 0; i < header->max_readers; ++i)
+      {
+        if (!slots[i].pid.load(memory_order_acquire)) continue;
+
+        const uint64_t reader_position = slots[i].position.load(memory_order_acquire);
+        if (reader_position < oldest) oldest = reader_position;
+      }
+
+      if (position + size - oldest <= header->data_size) return true;
+
+      // Before dropping events, reclaim the slots of dead readers.
+      if (attempt) break;
+
+      bool reclaimed = false;
+
+      for (uint32_t i = 0; i < header->max_readers; ++i)
+      {
+        uint32_t pid = slots[i].pid.load(memory_order_acquire);
+
+        if (!pid || ::kill(pid, 0) == 0 || errno != ESRCH) continue;
+
+        libfsw_log("Reclaiming the slot of a dead shared memory ring reader.\n");
+
+        slots[i].position.store(NOT_READING, memory_order_relaxed);
+        if (slots[i].pid.compare_exchange_strong(pid, 0)) reclaimed = true;
+      }
+
+      if (!reclaimed) break;
+    }
+
+    return false;
+  }
+
+  void shm_ring_writer::write_record(uint32_t type,
+                                     uint64_t size,
+                                     const compact_event * evt)
+  {
+    const uint64_t offset = position & (header->data_size - 1);
+
+    // Records never wrap around: the end of the data area is skipped.
+    if (offset + size > header->data_size)
+    {
+      shm_ring_record * padding = reinterpret_cast<shm_ring_record *> (data + offset);
+      padding->size = header->data_size - offset;
+      padding->type = SHM_RING_PADDING;
+      position += padding->size;
+
+      write_record(type, size, evt);
+      return;
+    }
+
+    shm_ring_record * record = reinterpret_cast<shm_ring_record *> (data + offset);
+    record->size = size;
+    record->type = type;
+    record->sequence = evt->get_sequence();
+    record->time_ns = evt->get_time_ns();
+    record->monotonic_time_ns = evt->get_monotonic_time_ns();
+    record->last_time_ns = evt->get_last_time_ns();
+    record->flags = evt->get_flags();
+    record->path_length = evt->get_path_length();
+
+    char * path = reinterpret_cast<char *> (record + 1);
+    ::memcpy(path, evt->get_path(), record->path_length);
+    path[record->path_length] = '\0';
+
+    position += size;
+  }
+
+  void shm_ring_writer::publish(const event_batch &events)
+  {
+    const uint64_t data_size = header->data_size;
+    uint64_t published = position;
+
+    for (size_t i = 0; i < events.size(); ++i)
+    {
+      const compact_event evt = events[i];
+      const uint64_t size = align_up(sizeof (shm_ring_record) + evt.get_path_length() + 1, 8);
+      const uint64_t offset = position & (data_size - 1);
+
+      // A record may need the end of the data area to be padded, and the
+      // padding is always smaller than the record.  An overflow marker
+      // preceding the record may need padding as well.
+      const uint64_t needed = gap
+        ? 2 * (MARKER_SIZE + size)
+        : size + (offset + size > data_size ? data_size - offset : 0);
+
+      if (size > data_size / 2 || !reserve(needed))
+      {
+        header->dropped_events.fetch_add(1, memory_order_relaxed);
+        gap = true;
+        continue;
+      }
+
+      if (gap)
+      {
+        const compact_event overflow("", 0,
+                                     evt.get_time_ns(),
+                                     evt.get_monotonic_time_ns(),
+                                     evt.get_time_ns(),
+                                     Overflow);
+        write_record(SHM_RING_EVENT, MARKER_SIZE, &overflow);
+        gap = false;
+      }
+
+      write_record(SHM_RING_EVENT, size, &evt);
+
+      // Publish long batches in chunks, so that a reader attaching in the
+      // middle of a batch never starts more than half a ring behind.
+      if (position - published >= data_size / 2)
+      {
+        header->write_position.store(position, memory_order_release);
+        published = position;
+        notify();
+      }
+    }
+
+    if (position != published)
+    {
+      header->write_position.store(position, memory_order_release);
+      notify();
+    }
+  }
+
+  void shm_ring_writer::notify()
+  {
+    header->wakeup.fetch_add(1);
+
+    if (!header->waiters.load()) return;
+
+#ifdef HAVE_LINUX_FUTEX_H
+    ::syscall(SYS_futex, reinterpret_cast<uint32_t *> (&header->wakeup),
+              FUTEX_WAKE, INT_MAX, nullptr, nullptr, 0);
+#endif
+  }
+
+  void shm_ring_writer::publish_batch(event_batch &events, void * writer)
+  {
+    static_cast<shm_ring_writer *> (writer)->publish(events);
+  }
+
+  shm_ring_reader::shm_ring_reader(int fd)
+  {
+    attach(fd);
+  }
+
+  shm_ring_reader::shm_ring_reader(const string &name)
+  {
+    // Shared memory object names have no slash but the leading one, while
+    // other names (e.g. /proc/PID/fd/FD) are paths.
+    int fd = name.find('/', 1) == string::npos
+      ? ::shm_open(name.c_str(), O_RDWR, 0)
+      : ::open(name.c_str(), O_RDWR);
+
+    if (fd == -1)
+      throw libfsw_exception(string("Cannot open the shared memory ring: ") + strerror(errno), FSW_ERR_SHARED_MEMORY);
+
+    try
+    {
+      attach(fd);
+    }
+    catch (...)
+    {
+      ::close(fd);
+      throw;
+    }
+
+    ::close(fd);
+  }
+
+  shm_ring_reader::~shm_ring_reader()
+  {
+    slot->position.store(NOT_READING, memory_order_relaxed);
+    slot->pid.store(0, memory_order_release);
+
+    ::munmap(header, mapping_size);
+  }
+
+  void shm_ring_reader::attach(int fd)
+  {
+    struct stat st;
+
+    if (::fstat(fd, &st) != 0 || st.st_size < static_cast<off_t> (sizeof (shm_ring_header)))
+      throw libfsw_exception("Invalid shared memory ring.", FSW_ERR_SHARED_MEMORY);
+
+    mapping_size = st.st_size;
+    void * mapping = ::mmap(nullptr, mapping_size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+
+    if (mapping == MAP_FAILED)
+      throw libfsw_exception(string("Cannot map the shared memory ring: ") + strerror(errno), FSW_ERR_SHARED_MEMORY);
+
+    header = static_cast<shm_ring_header *> (mapping);
+    atomic_thread_fence(memory_order_acquire);
+
+    // The data area is read modulo its size, which must be a power of 2
+    // large enough for the records to stay 8-byte aligned.
+    data_size = header->data_size;
+
+    if (header->magic != SHM_RING_MAGIC
+      || header->version != SHM_RING_VERSION
+      || data_size < MARKER_SIZE
+      || (data_size & (data_size - 1))
+      || header->data_offset % 8
+      || data_size > mapping_size
+      || header->data_offset > mapping_size - data_size)
+    {
+      ::munmap(mapping, mapping_size);
+      throw libfsw_exception("Invalid shared memory ring.", FSW_ERR_SHARED_MEMORY);
+    }
+
+    shm_ring_reader_slot * slots = get_slots(header);
+    data = static_cast<char *> (mapping) + header->data_offset;
+
+    for (uint32_t i = 0; i < header->max_readers; ++i)
+    {
+      uint32_t free_slot = 0;
+
+      if (slots[i].pid.compare_exchange_strong(free_slot, ::getpid()))
+      {
+        slot = &slots[i];
+        position = header->write_position.load(memory_order_acquire);
+        slot->position.store(position, memory_order_release);
+
+        return;
+      }
+    }
+
+    ::munmap(mapping, mapping_size);
+    throw libfsw_exception("No reader slot is available in the shared memory ring.", FSW_ERR_SHARED_MEMORY);
+  }
+
+  const char * shm_ring_reader::read_record(uint64_t end, shm_ring_record &record) const
+  {
+    const uint64_t offset = position & (data_size - 1);
+
+    // The record is copied before it is checked, since the ring can be
+    // written by another process at any time.
+    ::memcpy(&record, data + offset, sizeof (record));
+
+    if (record.size < sizeof (shm_ring_record)
+      || record.size % 8
+      || record.size > data_size - offset
+      || record.size > end - position
+      || (record.type == SHM_RING_EVENT
+          && record.path_length >= record.size - sizeof (shm_ring_record)))
+    {
+      throw libfsw_exception("Invalid shared memory ring record.", FSW_ERR_SHARED_MEMORY);
+    }
+
+    return data + offset + sizeof (shm_ring_record);
+  }
+
+  bool shm_ring_reader::wait(int timeout_ms)
+  {
+    const auto deadline = chrono::steady_clock::now() + chrono::milliseconds(timeout_ms);
+
+    for (;;)
+    {
+      const uint32_t wakeup = header->wakeup.load();
+
+      if (header->write_position.load(memory_order_acquire) != position) return true;
+      if (timeout_ms == 0) return false;
+
+      chrono::nanoseconds remaining = deadline - chrono::steady_clock::now();
+
+      if (timeout_ms > 0 && remaining.count() <= 0) return false;
+
+#ifdef HAVE_LINUX_FUTEX_H
+      struct timespec ts;
+      ts.tv_sec = remaining.count() / 1000000000;
+      ts.tv_nsec = remaining.count() % 1000000000;
+
+      header->waiters.fetch_add(1);
+      ::syscall(SYS_futex, reinterpret_cast<uint32_t *> (&header->wakeup),
+                FUTEX_WAIT, wakeup, timeout_ms < 0 ? nullptr : &ts, nullptr, 0);
+      header->waiters.fetch_sub(1);
+#else
+      (void) wakeup;
+      this_thread::sleep_for(chrono::milliseconds(1));
+#endif
+    }
+  }
+}
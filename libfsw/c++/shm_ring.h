@@ -0,0 +1,210 @@
+/* 
+ * Copyright (C) 2014, Enrico M. Crisostomo
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 3, or (at your option)
+ * any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+#ifndef FSW_SHM_RING_H
+#  define FSW_SHM_RING_H
+
+#  include <atomic>
+#  include <cstddef>
+#  include <cstdint>
+#  include <string>
+#  include "event_batch.h"
+
+namespace fsw
+{
+
+  /*
+   * Events published into a shared memory ring by one process can be read,
+   * without copying them, by other processes.  A ring is created by a
+   * shm_ring_writer either in an anonymous memfd, which is shared by passing
+   * its descriptor (or /proc/PID/fd/FD) to the readers, or in a POSIX shared
+   * memory object opened by name.
+   *
+   * Layout of a ring (version 1).  Integers are stored in the byte order of
+   * the host and all offsets are relative to the start of the ring.
+   *
+   *   0             shm_ring_header
+   *   header_size   max_readers shm_ring_reader_slot entries
+   *   data_offset   data area of data_size bytes, a power of 2
+   *
+   * Positions are byte counts which never wrap: position p is stored at
+   * offset data_offset + p % data_size.  The data area holds a sequence of
+   * 8-byte aligned records, each starting with a shm_ring_record header.  An
+   * event record is followed by the NUL-terminated path of the event and by
+   * padding up to size.  A padding record fills the end of the data area
+   * when the next record does not fit before it wraps around.
+   *
+   * write_position is the position after the last published record, and
+   * wakeup is incremented every time records are published; on Linux it is
+   * a futex word which readers wait on.  Each reader owns a slot, claimed by
+   * storing its pid, holding the position of the next record it reads.  The
+   * writer never overwrites records a reader has not consumed: events that
+   * do not fit are dropped and replaced by an event with the Overflow flag
+   * once there is room again.  Slots of readers which no longer exist are
+   * reclaimed by the writer when the ring is full.
+   *
+   * There must be a single writer per ring.
+   */
+  static const uint32_t SHM_RING_MAGIC = 0x52575346;  // "FSWR"
+  static const uint32_t SHM_RING_VERSION = 1;
+  static const uint32_t SHM_RING_EVENT = 1;
+  static const uint32_t SHM_RING_PADDING = 2;
+
+  typedef struct shm_ring_header
+  {
+    uint32_t magic;
+    uint32_t version;
+    uint32_t header_size;
+    uint32_t max_readers;
+    uint64_t data_offset;
+    uint64_t data_size;
+    alignas(64) std::atomic<uint64_t> write_position;
+    std::atomic<uint64_t> dropped_events;
+    std::atomic<uint32_t> wakeup;
+    std::atomic<uint32_t> waiters;
+  } shm_ring_header;
+
+  typedef struct shm_ring_reader_slot
+  {
+    alignas(64) std::atomic<uint64_t> position;
+    std::atomic<uint32_t> pid;
+  } shm_ring_reader_slot;
+
+  typedef struct shm_ring_record
+  {
+    uint32_t size;
+    uint32_t type;
+    uint64_t sequence;
+    uint64_t time_ns;
+    uint64_t monotonic_time_ns;
+    uint64_t last_time_ns;
+    uint32_t flags;
+    uint32_t path_length;
+  } shm_ring_record;
+
+  class shm_ring_writer
+  {
+  public:
+    /*
+     * Creates a ring whose data area holds data_size bytes (rounded up to a
+     * power of 2) and which can be read by at most max_readers readers at a
+     * time.  If name is empty the ring is an anonymous memfd.
+     */
+    explicit shm_ring_writer(const std::string &name = "",
+                             size_t data_size = 1 << 22,
+                             uint32_t max_readers = 16);
+    shm_ring_writer(const shm_ring_writer &orig) = delete;
+    shm_ring_writer& operator=(const shm_ring_writer &that) = delete;
+    virtual ~shm_ring_writer();
+
+    int get_fd() const;
+    const std::string & get_name() const;
+    uint64_t get_dropped_events() const;
+    void publish(const event_batch &events);
+
+    /*
+     * Batch callback publishing the events into the ring passed as context,
+     * e.g. monitor::create_monitor(type, paths, publish_batch, &writer).
+     */
+    static void publish_batch(event_batch &events, void * writer);
+
+  private:
+    bool reserve(uint64_t size);
+    void write_record(uint32_t type,
+                      uint64_t size,
+                      const compact_event * evt);
+    void notify();
+
+    std::string name;
+    int fd;
+    size_t mapping_size;
+    shm_ring_header * header = nullptr;
+    shm_ring_reader_slot * slots = nullptr;
+    char * data = nullptr;
+    uint64_t position = 0;
+    bool gap = false;
+  };
+
+  class shm_ring_reader
+  {
+  public:
+    /*
+     * Attaches to the ring in the given descriptor, or in the shared memory
+     * object or file with the given name.  Reading starts with the events
+     * published after the reader attaches.
+     */
+    explicit shm_ring_reader(int fd);
+    explicit shm_ring_reader(const std::string &name);
+    shm_ring_reader(const shm_ring_reader &orig) = delete;
+    shm_ring_reader& operator=(const shm_ring_reader &that) = delete;
+    virtual ~shm_ring_reader();
+
+    /*
+     * Waits up to timeout_ms milliseconds (forever if negative) for events
+     * to be published, then calls fn with each of the available events and
+     * returns their number.  The path of an event points into the ring and
+     * is only valid until fn returns.  A libfsw_exception is thrown if the
+     * ring holds a record which is not valid.
+     */
+    template <typename F>
+    size_t read(F fn, int timeout_ms)
+    {
+      if (!wait(timeout_ms)) return 0;
+
+      const uint64_t end = header->write_position.load(std::memory_order_acquire);
+      size_t count = 0;
+
+      while (position < end)
+      {
+        shm_ring_record record;
+        const char * path = read_record(end, record);
+
+        if (record.type == SHM_RING_EVENT)
+        {
+          fn(compact_event(path,
+                           record.path_length,
+                           record.time_ns,
+                           record.monotonic_time_ns,
+                           record.last_time_ns,
+                           record.flags,
+                           record.sequence));
+          ++count;
+        }
+
+        position += record.size;
+      }
+
+      // Records are released to the writer once all of them are read.
+      slot->position.store(position, std::memory_order_release);
+
+      return count;
+    }
+
+  private:
+    void attach(int fd);
+    bool wait(int timeout_ms);
+    const char * read_record(uint64_t end, shm_ring_record &record) const;
+
+    size_t mapping_size = 0;
+    uint64_t data_size = 0;
+    shm_ring_header * header = nullptr;
+    shm_ring_reader_slot * slot = nullptr;
+    char * data = nullptr;
+    uint64_t position = 0;
+  };
+}
+
+#endif  /* FSW_SHM_RING_H */
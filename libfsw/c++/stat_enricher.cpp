@@ -0,0 +1,238 @@
+/* 
+ * Copyright (C) 2014, Enrico M. Crisostomo
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 3, or (at your option)
+ * any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+#ifdef HAVE_CONFIG_H
+#  include "libfsw_config.h"
+#endif
+
+#include "stat_enricher.h"
+#include <fcntl.h>
+
+using namespace std;
+
+#if defined HAVE_STRUCT_STAT_ST_MTIM
+#  define FSW_MTIME_NSEC(stat) (stat.st_mtim.tv_nsec)
+#elif defined HAVE_STRUCT_STAT_ST_MTIMESPEC
+#  define FSW_MTIME_NSEC(stat) (stat.st_mtimespec.tv_nsec)
+#else
+#  define FSW_MTIME_NSEC(stat) (0)
+#endif
+
+namespace fsw
+{
+
+  // Number of paths claimed at once by a worker.
+  static const size_t STAT_CHUNK_SIZE = 16;
+
+  static uint32_t get_type_flag(uint32_t mode)
+  {
+    if (S_ISREG(mode)) return fsw_event_flag::IsFile;
+    if (S_ISDIR(mode)) return fsw_event_flag::IsDir;
+    if (S_ISLNK(mode)) return fsw_event_flag::IsSymLink;
+
+    return 0;
+  }
+
+  void fill_event_stat(const struct stat &fd_stat, fsw_event_stat &evt_stat)
+  {
+    evt_stat.valid = true;
+    evt_stat.mode = fd_stat.st_mode;
+    evt_stat.size = fd_stat.st_size;
+    evt_stat.inode = fd_stat.st_ino;
+    evt_stat.nlink = fd_stat.st_nlink;
+    evt_stat.mtime_ns = static_cast<uint64_t> (fd_stat.st_mtime) * 1000000000ULL
+      + FSW_MTIME_NSEC(fd_stat);
+  }
+
+  bool stat_event_path(const char * path, fsw_event_stat &evt_stat)
+  {
+#ifdef HAVE_STATX
+    struct statx fd_statx;
+
+    if (::statx(AT_FDCWD,
+                path,
+                AT_SYMLINK_NOFOLLOW,
+                STATX_TYPE | STATX_MODE | STATX_SIZE | STATX_INO | STATX_NLINK | STATX_MTIME,
+                &fd_statx) != 0)
+    {
+      evt_stat = fsw_event_stat();
+      return false;
+    }
+
+    evt_stat.valid = true;
+    evt_stat.mode = fd_statx.stx_mode;
+    evt_stat.size = fd_statx.stx_size;
+    evt_stat.inode = fd_statx.stx_ino;
+    evt_stat.nlink = fd_statx.stx_nlink;
+    evt_stat.mtime_ns = static_cast<uint64_t> (fd_statx.stx_mtime.tv_sec) * 1000000000ULL
+      + fd_statx.stx_mtime.tv_nsec;
+#else
+    struct stat fd_stat;
+
+    if (::lstat(path, &fd_stat) != 0)
+    {
+      evt_stat = fsw_event_stat();
+      return false;
+    }
+
+    fill_event_stat(fd_stat, evt_stat);
+#endif
+
+    return true;
+  }
+
+  stat_enricher::~stat_enricher()
+  {
+    stop_workers();
+  }
+
+  void stat_enricher::stop_workers()
+  {
+    {
+      lock_guard<mutex> job_lock(job_mutex);
+      stopping = true;
+    }
+
+    job_cv.notify_all();
+
+    for (thread &worker : workers)
+    {
+      worker.join();
+    }
+
+    workers.clear();
+    stopping = false;
+  }
+
+  void stat_enricher::set_threads(unsigned int threads)
+  {
+    stop_workers();
+
+    // The generation is read here rather than by the workers: a worker
+    // starting after the next call to enrich() would otherwise take that
+    // job's generation as already seen and never join it.
+    unsigned long current_generation;
+
+    {
+      lock_guard<mutex> job_lock(job_mutex);
+      current_generation = generation;
+    }
+
+    // The calling thread always takes part in the work.
+    for (unsigned int i = 1; i < threads; ++i)
+    {
+      workers.push_back(thread(&stat_enricher::worker_loop, this, current_generation));
+    }
+  }
+
+  void stat_enricher::worker_loop(unsigned long seen_generation)
+  {
+    unique_lock<mutex> job_lock(job_mutex);
+
+    while (true)
+    {
+      job_cv.wait(job_lock, [&]
+      {
+        return stopping || generation != seen_generation;
+      });
+
+      if (stopping) return;
+
+      seen_generation = generation;
+
+      job_lock.unlock();
+      stat_pending();
+      job_lock.lock();
+
+      if (--active_workers == 0) done_cv.notify_all();
+    }
+  }
+
+  void stat_enricher::stat_pending()
+  {
+    size_t first;
+
+    while ((first = next_pending.fetch_add(STAT_CHUNK_SIZE)) < pending.size())
+    {
+      const size_t last = min(first + STAT_CHUNK_SIZE, pending.size());
+
+      for (size_t i = first; i < last; ++i)
+      {
+        stat_event_path(job->get_path(pending[i]), results[i]);
+      }
+    }
+  }
+
+  void stat_enricher::enrich(event_batch &batch)
+  {
+    const vector<uint32_t> &flags = batch.get_flags();
+
+    pending.clear();
+
+    for (size_t i = 0; i < batch.size(); ++i)
+    {
+      const fsw_event_stat &evt_stat = batch.get_stat(i);
+
+      if (evt_stat.valid)
+      {
+        batch.merge(i, get_type_flag(evt_stat.mode), 0);
+        continue;
+      }
+
+      if (flags[i] & (fsw_event_flag::Removed | fsw_event_flag::Overflow)) continue;
+
+      pending.push_back(i);
+    }
+
+    if (pending.empty()) return;
+
+    job = &batch;
+    results.resize(pending.size());
+    next_pending.store(0);
+
+    if (workers.empty() || pending.size() < PARALLEL_THRESHOLD)
+    {
+      stat_pending();
+    }
+    else
+    {
+      {
+        lock_guard<mutex> job_lock(job_mutex);
+        active_workers = workers.size();
+        ++generation;
+      }
+
+      job_cv.notify_all();
+      stat_pending();
+
+      unique_lock<mutex> job_lock(job_mutex);
+      done_cv.wait(job_lock, [&]
+      {
+        return active_workers == 0;
+      });
+    }
+
+    job = nullptr;
+
+    for (size_t i = 0; i < pending.size(); ++i)
+    {
+      if (!results[i].valid) continue;
+
+      batch.set_stat(pending[i], results[i]);
+      batch.merge(pending[i], get_type_flag(results[i].mode), 0);
+    }
+  }
+}
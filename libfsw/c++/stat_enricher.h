@@ -0,0 +1,77 @@
+/* 
+ * Copyright (C) 2014, Enrico M. Crisostomo
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 3, or (at your option)
+ * any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+#ifndef FSW_STAT_ENRICHER_H
+#  define FSW_STAT_ENRICHER_H
+
+#  include <atomic>
+#  include <condition_variable>
+#  include <mutex>
+#  include <thread>
+#  include <vector>
+#  include <sys/stat.h>
+#  include "event_batch.h"
+
+namespace fsw
+{
+
+  void fill_event_stat(const struct stat &fd_stat, fsw_event_stat &evt_stat);
+  bool stat_event_path(const char * path, fsw_event_stat &evt_stat);
+
+  /*
+   * Fills the file information of the events of a batch which do not have
+   * one yet, and sets the IsFile, IsDir and IsSymLink flags accordingly.
+   * Events whose path has been removed are not stat()ed.
+   *
+   * Monitors set the information they already have (e.g. the poll monitor
+   * from its snapshot) when adding events, so that only the remaining paths
+   * are stat()ed.  If worker threads are configured, large batches are split
+   * across them.
+   */
+  class stat_enricher
+  {
+  public:
+    stat_enricher() = default;
+    ~stat_enricher();
+    stat_enricher(const stat_enricher& orig) = delete;
+    stat_enricher& operator=(const stat_enricher & that) = delete;
+
+    void set_threads(unsigned int threads);
+    void enrich(event_batch &batch);
+
+    static const size_t PARALLEL_THRESHOLD = 64;
+
+  private:
+    void stop_workers();
+    void worker_loop(unsigned long seen_generation);
+    void stat_pending();
+
+    const event_batch * job = nullptr;
+    std::vector<size_t> pending;
+    std::vector<fsw_event_stat> results;
+    std::atomic<size_t> next_pending{0};
+
+    std::vector<std::thread> workers;
+    std::mutex job_mutex;
+    std::condition_variable job_cv;
+    std::condition_variable done_cv;
+    unsigned long generation = 0;
+    unsigned int active_workers = 0;
+    bool stopping = false;
+  };
+}
+
+#endif  /* FSW_STAT_ENRICHER_H */
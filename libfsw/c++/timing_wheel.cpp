@@ -0,0 +1,126 @@
+/* 
+ * Copyright (C) 2014, Enrico M. Crisostomo
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 3, or (at your option)
+ * any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+#include "timing_wheel.h"
+
+using namespace std;
+
+namespace fsw
+{
+
+  timing_wheel::timing_wheel(uint64_t tick_ns, uint64_t now_ns) :
+    tick_ns(tick_ns ? tick_ns : 1),
+    current_tick(now_ns / this->tick_ns),
+    slots(SLOTS * LEVELS, NONE)
+  {
+  }
+
+  void timing_wheel::link(uint32_t id, uint64_t min_tick)
+  {
+    timer &t = timers[id];
+    const uint64_t range = 1ULL << (LEVEL_BITS * LEVELS);
+
+    uint64_t tick = t.deadline_tick < min_tick ? min_tick : t.deadline_tick;
+    if (tick - current_tick >= range) tick = current_tick + range - 1;
+
+    const uint64_t delta = tick - current_tick;
+    unsigned int level = 0;
+
+    while (level < LEVELS - 1 && delta >= (1ULL << (LEVEL_BITS * (level + 1))))
+    {
+      ++level;
+    }
+
+    t.slot = level * SLOTS + ((tick >> (LEVEL_BITS * level)) & (SLOTS - 1));
+    t.prev = NONE;
+    t.next = slots[t.slot];
+
+    if (t.next != NONE) timers[t.next].prev = id;
+    slots[t.slot] = id;
+    ++count;
+  }
+
+  void timing_wheel::unlink(uint32_t id)
+  {
+    timer &t = timers[id];
+
+    if (t.prev != NONE) timers[t.prev].next = t.next;
+    else slots[t.slot] = t.next;
+
+    if (t.next != NONE) timers[t.next].prev = t.prev;
+
+    t.slot = NONE;
+    --count;
+  }
+
+  void timing_wheel::cascade(unsigned int level)
+  {
+    uint32_t &head = slots[level * SLOTS
+                          + ((current_tick >> (LEVEL_BITS * level)) & (SLOTS - 1))];
+
+    while (head != NONE)
+    {
+      const uint32_t id = head;
+      unlink(id);
+      link(id, current_tick);
+    }
+  }
+
+  void timing_wheel::schedule(uint32_t id, uint64_t deadline_ns)
+  {
+    if (id >= timers.size()) timers.resize(id + 1, {0, NONE, NONE, NONE});
+    if (timers[id].slot != NONE) unlink(id);
+
+    // Round up, so that a timer never fires before its deadline.
+    timers[id].deadline_tick = (deadline_ns + tick_ns - 1) / tick_ns;
+    link(id, current_tick + 1);
+  }
+
+  void timing_wheel::cancel(uint32_t id)
+  {
+    if (is_scheduled(id)) unlink(id);
+  }
+
+  bool timing_wheel::is_scheduled(uint32_t id) const
+  {
+    return id < timers.size() && timers[id].slot != NONE;
+  }
+
+  size_t timing_wheel::size() const
+  {
+    return count;
+  }
+
+  uint64_t timing_wheel::get_next_tick() const
+  {
+    for (uint64_t tick = current_tick + 1; tick <= current_tick + SLOTS; ++tick)
+    {
+      if (slots[tick & (SLOTS - 1)] != NONE) return tick;
+
+      // The next level needs to be cascaded first.
+      if (!(tick & (SLOTS - 1))) return tick;
+    }
+
+    return current_tick + SLOTS;
+  }
+
+  uint64_t timing_wheel::get_next_wakeup() const
+  {
+    if (!count) return NEVER;
+
+    return get_next_tick() * tick_ns;
+  }
+}
@@ -0,0 +1,137 @@
+/* 
+ * Copyright (C) 2014, Enrico M. Crisostomo
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 3, or (at your option)
+ * any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+#ifndef FSW_TIMING_WHEEL_H
+#  define FSW_TIMING_WHEEL_H
+
+#  include <cstddef>
+#  include <cstdint>
+#  include <vector>
+
+namespace fsw
+{
+
+  /*
+   * Hierarchical timing wheel.  Timers are identified by small integers
+   * chosen by the caller and kept in intrusive lists, one per slot, so that
+   * scheduling, rescheduling and cancelling a timer are O(1) regardless of
+   * the number of pending timers.  The wheel has LEVELS levels of SLOTS
+   * slots each: level 0 has a resolution of one tick, and each level covers
+   * SLOTS times the range of the previous one.  Timers are moved to lower
+   * levels (cascaded) as the wheel turns.  Deadlines farther than the range
+   * of the wheel are parked in the last level and rescheduled when reached.
+   *
+   * Times are expressed in nanoseconds of the same clock as the one passed
+   * to advance(), which calls expired(id) for every timer whose deadline
+   * has been reached.  get_next_wakeup() returns a time not later than the
+   * next deadline (or NEVER), suitable for sleeping until advance() has
+   * work to do.  The wheel is not synchronized.
+   */
+  class timing_wheel
+  {
+  public:
+    explicit timing_wheel(uint64_t tick_ns, uint64_t now_ns);
+
+    void schedule(uint32_t id, uint64_t deadline_ns);
+    void cancel(uint32_t id);
+    bool is_scheduled(uint32_t id) const;
+    size_t size() const;
+    uint64_t get_next_wakeup() const;
+
+    template <typename F>
+    void advance(uint64_t now_ns, F expired);
+
+    static const unsigned int LEVEL_BITS = 6;
+    static const unsigned int SLOTS = 1 << LEVEL_BITS;
+    static const unsigned int LEVELS = 4;
+    static const uint64_t NEVER = static_cast<uint64_t> (-1);
+
+  private:
+    static const uint32_t NONE = static_cast<uint32_t> (-1);
+
+    struct timer
+    {
+      uint64_t deadline_tick;
+      uint32_t prev;
+      uint32_t next;
+      uint32_t slot;
+    };
+
+    void link(uint32_t id, uint64_t min_tick);
+    void unlink(uint32_t id);
+    void cascade(unsigned int level);
+    uint64_t get_next_tick() const;
+
+    uint64_t tick_ns;
+    uint64_t current_tick;
+    std::vector<timer> timers;
+    std::vector<uint32_t> slots;
+    std::vector<uint32_t> expiring;
+    size_t count = 0;
+  };
+
+  template <typename F>
+  void timing_wheel::advance(uint64_t now_ns, F expired)
+  {
+    const uint64_t target_tick = now_ns / tick_ns;
+
+    while (current_tick < target_tick)
+    {
+      // Nothing to expire: jump to the target.
+      if (!count)
+      {
+        current_tick = target_tick;
+        break;
+      }
+
+      // Skip the ticks with nothing to expire or to cascade.
+      const uint64_t next_tick = get_next_tick();
+
+      if (next_tick > target_tick)
+      {
+        current_tick = target_tick;
+        break;
+      }
+
+      current_tick = next_tick;
+
+      // Cascade the higher levels whose slot is starting.
+      for (unsigned int level = 1; level < LEVELS; ++level)
+      {
+        if (current_tick & ((1ULL << (LEVEL_BITS * level)) - 1)) break;
+        cascade(level);
+      }
+
+      uint32_t &head = slots[current_tick & (SLOTS - 1)];
+      expiring.clear();
+
+      while (head != NONE)
+      {
+        const uint32_t id = head;
+        unlink(id);
+
+        // Timers parked beyond the range of the wheel go around again.
+        if (timers[id].deadline_tick > current_tick) link(id, current_tick + 1);
+        else expiring.push_back(id);
+      }
+
+      // Callbacks may schedule timers again.
+      for (uint32_t id : expiring) expired(id);
+    }
+  }
+}
+
+#endif  /* FSW_TIMING_WHEEL_H */
@@ -18,6 +18,7 @@
 #  define FSW__CEVENT_H
 
 #  include <ctime>
+#  include <stdint.h>
 
 #  ifdef __cplusplus
 extern "C"
@@ -36,15 +37,49 @@ extern "C"
     IsFile = 128,
     IsDir = 256,
     IsSymLink = 512,
-    Link = 1024
+    Link = 1024,
+    Overflow = 2048,
+    Settled = 4096
   };
 
+  /*
+   * File information attached to an event when stat enrichment is enabled.
+   * valid is false if the information is not available, e.g. because the
+   * path was removed.  mode is the st_mode of the path, which is not followed
+   * if it is a symbolic link.
+   */
+  typedef struct fsw_event_stat
+  {
+    bool valid;
+    uint32_t mode;
+    uint64_t size;
+    uint64_t inode;
+    uint64_t nlink;
+    uint64_t mtime_ns;
+  } fsw_event_stat;
+
+  /*
+   * evt_time_ns is the CLOCK_REALTIME time of the event in nanoseconds since
+   * the Epoch, while monotonic_time_ns is the CLOCK_MONOTONIC time at which the
+   * event was captured by the monitor.
+   *
+   * sequence is a number assigned by the monitor to each event it produces,
+   * starting from 1 and increasing by one for every event.  Events may be
+   * lost, e.g. when the queue of the operating system overflows: in this case
+   * an event with the Overflow flag and an empty path is delivered.  An event
+   * with the Settled flag and an empty path signals that no change has been
+   * observed for the configured settle time.
+   */
   typedef struct fsw_cevent
   {
     char * path;
     time_t evt_time;
     fsw_event_flag *flags;
     unsigned int flags_num;
+    uint64_t evt_time_ns;
+    uint64_t monotonic_time_ns;
+    fsw_event_stat stat;
+    uint64_t sequence;
   } fsw_cevent;
 
   typedef void (*FSW_CEVENT_CALLBACK)(fsw_cevent const * const * const events,
@@ -18,6 +18,7 @@
 #  define FSW__CMONITOR_H
 
 #  include <ctime>
+#  include <stdint.h>
 
 #  ifdef __cplusplus
 extern "C"
@@ -30,9 +31,60 @@ extern "C"
     fsevents_monitor_type,
     kqueue_monitor_type,
     inotify_monitor_type,
-    poll_monitor_type
+    poll_monitor_type,
+    replay_monitor_type
   };
 
+  /*
+   * What a monitor does with new events when the queue of an asynchronous
+   * dispatcher is full or above its memory limit.
+   */
+  enum fsw_backpressure_policy
+  {
+    backpressure_block = 0,
+    backpressure_drop_oldest,
+    backpressure_drop_newest,
+    backpressure_coalesce
+  };
+
+#  define FSW_HISTOGRAM_BUCKETS 32
+
+  /*
+   * Histogram with logarithmic buckets: bucket 0 counts the values equal to
+   * 0, bucket i the values v such that 2^(i-1) <= v < 2^i, and the last
+   * bucket every larger value as well.
+   */
+  typedef struct fsw_histogram
+  {
+    uint64_t buckets[FSW_HISTOGRAM_BUCKETS];
+    uint64_t count;
+    uint64_t sum;
+    uint64_t max;
+  } fsw_histogram;
+
+  /*
+   * Runtime statistics of a monitor.  uptime_ns is 0 when the monitor is not
+   * running.  watches is the number of objects watched by the monitor (e.g.
+   * inotify watches, or files tracked by the poll monitor), and overflows
+   * the number of times the operating system dropped events.  events and
+   * batches count what was delivered to the callback, and accepted_paths and
+   * rejected_paths the paths checked against the filters.  Times are in
+   * nanoseconds: scan_time_ns records the scans of the poll monitor.
+   */
+  typedef struct fsw_monitor_stats
+  {
+    uint64_t uptime_ns;
+    uint64_t watches;
+    uint64_t overflows;
+    uint64_t events;
+    uint64_t batches;
+    uint64_t accepted_paths;
+    uint64_t rejected_paths;
+    fsw_histogram batch_sizes;
+    fsw_histogram scan_time_ns;
+    fsw_histogram callback_time_ns;
+  } fsw_monitor_stats;
+
 #  ifdef __cplusplus
 }
 #  endif
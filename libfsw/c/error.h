@@ -41,6 +41,10 @@ extern "C"
 #  define FSW_ERR_STALE_MONITOR_THREAD      (1 << 14)
 #  define FSW_ERR_THREAD_FAULT              (1 << 15)
 #  define FSW_ERR_UNSUPPORTED_OPERATION     (1 << 16)
+#  define FSW_ERR_INVALID_DEBOUNCE          (1 << 17)
+#  define FSW_ERR_INVALID_BUFFER            (1 << 18)
+#  define FSW_ERR_SHARED_MEMORY             (1 << 19)
+#  define FSW_ERR_INVALID_EVENT_LOG         (1 << 20)
 
 #  ifdef __cplusplus
 }
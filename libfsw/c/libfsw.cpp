@@ -18,9 +18,17 @@
 #  include "libfsw_config.h"
 #endif
 
+#include <algorithm>
 #include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <deque>
 #include <iostream>
+#include <memory>
 #include <mutex>
+#include <system_error>
+#include <thread>
+#include <cstring>
 #include <ctime>
 #include <stdlib.h>
 #include "libfsw.h"
@@ -32,125 +40,298 @@
 using namespace std;
 using namespace fsw;
 
+/*
+ * Maximum number of events queued for fsw_read_events().  When it is
+ * reached, the monitor waits for the reader to catch up.
+ */
+static const size_t FSW_READ_QUEUE_MAX_EVENTS = 1 << 16;
+
+/*
+ * Maximum number of buffers holding events read with fsw_read_events() and
+ * not released yet, each of which keeps the batches it references alive.
+ */
+static const size_t FSW_READ_MAX_LEASES = 256;
+
+/*
+ * Events returned by a call to fsw_read_events() reference the batches they
+ * were read from, whose storage is kept alive until they are released.
+ */
+typedef struct FSW_EVENT_LEASE
+{
+  explicit FSW_EVENT_LEASE(const fsw_cevent * buffer) : buffer(buffer)
+  {
+  }
+
+  const fsw_cevent * buffer;
+  vector<shared_ptr<const event_batch>> batches;
+  vector<fsw_event_flag> flags;
+} FSW_EVENT_LEASE;
+
+/*
+ * Queue of the batches produced by a monitor started with
+ * fsw_start_monitor_async(), together with the index of the first event of
+ * the front batch which has not been read yet.
+ */
+typedef struct FSW_EVENT_QUEUE
+{
+  mutex queue_mutex;
+  condition_variable not_empty;
+  condition_variable not_full;
+  deque<pair<shared_ptr<const event_batch>, size_t>> batches;
+  size_t queued_events = 0;
+  shared_ptr<event_batch_pool> pool = make_shared<event_batch_pool>();
+  vector<unique_ptr<FSW_EVENT_LEASE>> leases;
+  bool stopped = false;
+  int error = FSW_OK;
+} FSW_EVENT_QUEUE;
+
+/*
+ * The events passed to the callback of a session are stored in a single
+ * block of memory, which holds this header followed by the array of
+ * pointers to the events, the events, their flags and their paths.  The
+ * block is reused for every batch, unless the callback retains it with
+ * fsw_retain_events().
+ */
+typedef struct FSW_CEVENT_BUFFER
+{
+  size_t capacity;
+  bool retained;
+} FSW_CEVENT_BUFFER;
+
 typedef struct FSW_SESSION
 {
   FSW_HANDLE handle;
   vector<string> paths;
   fsw_monitor_type type;
-  monitor *monitor;
-  FSW_CEVENT_CALLBACK callback;
+  fsw::monitor * monitor;
+  atomic<FSW_CEVENT_CALLBACK> callback;
   double latency;
   bool recursive;
   bool follow_symlinks;
+  bool coalesce_events;
+  bool enrich_events;
+  size_t history_size;
+  size_t dispatch_queue_size;
+  fsw_backpressure_policy backpressure_policy;
+  size_t dispatch_memory_limit;
+  double debounce;
+  double throttle;
+  double settle_time;
+  unsigned int debounce_depth;
   vector<monitor_filter> filters;
+  shared_ptr<FSW_EVENT_QUEUE> queue;
+  FSW_CEVENT_BUFFER * cevent_buffer;
+  // Held for as long as the monitor of the session is running.
+  mutex run_mutex;
   atomic<bool> running;
+  // Number of calls using the monitor without the mutex of the shard held.
+  unsigned int monitor_users;
 } FSW_SESSION;
 
-static bool srand_initialized = false;
-static fsw_hash_map<FSW_HANDLE, unique_ptr<FSW_SESSION>> sessions;
-static fsw_hash_map<FSW_HANDLE, unique_ptr<mutex>> session_mutexes;
-static std::mutex session_mutex;
+/*
+ * Sessions are spread across shards by handle, each guarded by its own
+ * mutex, so that calls on independent sessions do not contend.  The mutex of
+ * a shard is only held to look up and configure its sessions: events are
+ * delivered to the session bound to the monitor without any lookup.
+ */
+static const size_t FSW_SESSION_SHARDS = 16;
+
+typedef struct FSW_SESSION_SHARD
+{
+  mutex shard_mutex;
+  fsw_hash_map<FSW_HANDLE, unique_ptr<FSW_SESSION>> sessions;
+} FSW_SESSION_SHARD;
+
+static FSW_SESSION_SHARD session_shards[FSW_SESSION_SHARDS];
+static atomic<FSW_HANDLE> last_handle(0);
 #if defined(HAVE_CXX_THREAD_LOCAL)
 static FSW_THREAD_LOCAL unsigned int last_error;
 #endif
 
 // Default library callback.
-FSW_EVENT_CALLBACK libfsw_cpp_callback_proxy;
+FSW_EVENT_BATCH_CALLBACK libfsw_cpp_callback_proxy;
+// Library callback of sessions started with fsw_start_monitor_async().
+FSW_EVENT_BATCH_CALLBACK libfsw_cpp_queue_proxy;
 FSW_SESSION * get_session(const FSW_HANDLE handle);
 
-int create_monitor(FSW_HANDLE handle, const fsw_monitor_type type);
+int create_monitor(FSW_SESSION * session, const fsw_monitor_type type);
 
-void libfsw_cpp_callback_proxy(const std::vector<event> & events,
-                               void * handle_ptr)
+static FSW_SESSION_SHARD & get_session_shard(const FSW_HANDLE handle)
 {
-  // TODO: A C friendly error handler should be notified instead of throwing an exception.
-  if (!handle_ptr)
-    throw int(FSW_ERR_MISSING_CONTEXT);
+  return session_shards[handle % FSW_SESSION_SHARDS];
+}
 
-  const FSW_HANDLE * handle = static_cast<FSW_HANDLE *> (handle_ptr);
+static mutex & get_session_mutex(const FSW_HANDLE handle)
+{
+  return get_session_shard(handle).shard_mutex;
+}
 
-  fsw_cevent ** cevents = static_cast<fsw_cevent **> (::malloc(sizeof (fsw_cevent) * events.size()));
+static size_t align_up(const size_t offset, const size_t alignment)
+{
+  return (offset + alignment - 1) / alignment * alignment;
+}
+
+// Offset of the array of event pointers from the start of a buffer.
+static const size_t FSW_CEVENT_BUFFER_EVENTS = align_up(sizeof (FSW_CEVENT_BUFFER),
+                                                        alignof (fsw_cevent *));
+
+static FSW_CEVENT_BUFFER * get_cevent_buffer(fsw_cevent const * const * const events)
+{
+  return reinterpret_cast<FSW_CEVENT_BUFFER *> (
+    const_cast<char *> (reinterpret_cast<const char *> (events)) - FSW_CEVENT_BUFFER_EVENTS);
+}
 
-  if (cevents == nullptr)
-    throw int(FSW_ERR_MEMORY);
+/*
+ * Converts a batch into the C events stored in buffer, which is grown if
+ * needed, and returns the array of pointers to them.
+ */
+static fsw_cevent ** fill_cevent_buffer(FSW_CEVENT_BUFFER * & buffer,
+                                        const event_batch & events)
+{
+  const size_t event_num = events.size();
+  const vector<uint32_t> & masks = events.get_flags();
+  const vector<char> & arena = events.get_path_arena();
+  size_t flag_num = 0;
 
-  for (int i = 0; i < events.size(); ++i)
+  for (const uint32_t mask : masks)
   {
-    const event evt = events[i];
-    fsw_cevent *cevt = new fsw_cevent();
+    for (uint32_t bit = 1; bit && bit <= mask; bit <<= 1)
+      if (mask & bit) ++flag_num;
+  }
 
-    // Copy event into C event wrapper.
-    const string path = evt.get_path();
+  const size_t events_offset = align_up(FSW_CEVENT_BUFFER_EVENTS + event_num * sizeof (fsw_cevent *),
+                                        alignof (fsw_cevent));
+  const size_t flags_offset = align_up(events_offset + event_num * sizeof (fsw_cevent),
+                                       alignof (fsw_event_flag));
+  const size_t paths_offset = flags_offset + flag_num * sizeof (fsw_event_flag);
+  const size_t size = paths_offset + arena.size();
 
-    // TODO: best way to allocate and copy a char * from string
-    cevt->path = static_cast<char *> (::malloc(sizeof (char *) * (path.length() + 1)));
-    if (!cevt->path) throw int(FSW_ERR_MEMORY);
+  if (!buffer || buffer->capacity < size)
+  {
+    const size_t capacity = buffer ? max(size, 2 * buffer->capacity) : size;
 
-    evt.get_path().copy(cevt->path, path.length() + 1);
+    ::free(buffer);
+    buffer = static_cast<FSW_CEVENT_BUFFER *> (::malloc(capacity));
+    if (!buffer) throw int(FSW_ERR_MEMORY);
 
-    cevt->evt_time = evt.get_time();
+    buffer->capacity = capacity;
+  }
 
-    const vector<fsw_event_flag> flags = evt.get_flags();
-    cevt->flags_num = flags.size();
+  buffer->retained = false;
 
-    if (!cevt->flags_num) cevt->flags = nullptr;
-    else
-    {
-      cevt->flags = static_cast<fsw_event_flag *> (::malloc(sizeof (fsw_event_flag) * cevt->flags_num));
-      if (!cevt->flags) throw int(FSW_ERR_MEMORY);
-    }
+  char * base = reinterpret_cast<char *> (buffer);
+  fsw_cevent ** cevents = reinterpret_cast<fsw_cevent **> (base + FSW_CEVENT_BUFFER_EVENTS);
+  fsw_cevent * cevent = reinterpret_cast<fsw_cevent *> (base + events_offset);
+  fsw_event_flag * flags = reinterpret_cast<fsw_event_flag *> (base + flags_offset);
+  char * paths = base + paths_offset;
+
+  // The paths are NUL-terminated in the arena of the batch, which is copied
+  // as a whole.
+  if (!arena.empty()) ::memcpy(paths, arena.data(), arena.size());
 
-    for (int e = 0; e < cevt->flags_num; ++e)
+  for (size_t i = 0; i < event_num; ++i, ++cevent)
+  {
+    const compact_event evt = events[i];
+    const uint32_t mask = masks[i];
+
+    cevent->path = paths + events.get_path_offsets()[i];
+    cevent->evt_time = evt.get_time();
+    cevent->evt_time_ns = evt.get_time_ns();
+    cevent->monotonic_time_ns = evt.get_monotonic_time_ns();
+    cevent->stat = evt.get_stat();
+    cevent->sequence = evt.get_sequence();
+    cevent->flags = mask ? flags : nullptr;
+    cevent->flags_num = 0;
+
+    for (uint32_t bit = 1; bit && bit <= mask; bit <<= 1)
     {
-      cevt->flags[e] = flags[e];
+      if (!(mask & bit)) continue;
+
+      *flags++ = static_cast<fsw_event_flag> (bit);
+      ++cevent->flags_num;
     }
 
-    cevents[i] = cevt;
+    cevents[i] = cevent;
   }
 
+  return cevents;
+}
+
+void libfsw_cpp_callback_proxy(event_batch & events, void * session_ptr)
+{
+  // TODO: A C friendly error handler should be notified instead of throwing an exception.
+  if (!session_ptr)
+    throw int(FSW_ERR_MISSING_CONTEXT);
+
+  // The monitor is bound to its session, which cannot be destroyed while
+  // the monitor is running.  The buffer is only used by the thread
+  // delivering the events of the monitor.
+  FSW_SESSION * session = static_cast<FSW_SESSION *> (session_ptr);
+
   // TODO manage C++ exceptions from C code
-  std::lock_guard<std::mutex> session_lock(session_mutex);
-  FSW_SESSION * session = get_session(*handle);
-  (*(session->callback))(cevents, events.size());
+  fsw_cevent ** cevents = fill_cevent_buffer(session->cevent_buffer, events);
+  (*(session->callback.load(memory_order_acquire)))(cevents, events.size());
+
+  // A buffer retained by the callback now belongs to it.
+  if (session->cevent_buffer->retained) session->cevent_buffer = nullptr;
 }
 
-FSW_HANDLE fsw_init_session(const fsw_monitor_type type)
+void libfsw_cpp_queue_proxy(event_batch & events, void * queue_ptr)
 {
-  std::lock_guard<std::mutex> session_lock(session_mutex);
+  if (!queue_ptr)
+    throw int(FSW_ERR_MISSING_CONTEXT);
 
-  if (!srand_initialized)
-  {
-    srand(time(nullptr));
-    srand_initialized = true;
-  }
+  FSW_EVENT_QUEUE * queue = static_cast<FSW_EVENT_QUEUE *> (queue_ptr);
 
-  int handle;
+  unique_lock<mutex> queue_lock(queue->queue_mutex);
 
-  do
+  // Slow readers throttle the monitor instead of growing the queue without
+  // bounds.  A single batch larger than the limit is accepted when the queue
+  // is empty.
+  queue->not_full.wait(queue_lock, [queue, &events]
   {
-    handle = rand();
-  }  while (sessions.find(handle) != sessions.end());
+    return queue->batches.empty()
+      || queue->queued_events + events.size() <= FSW_READ_QUEUE_MAX_EVENTS;
+  });
+
+  queue->queued_events += events.size();
+  queue->batches.emplace_back(share_batch(events, queue->pool), 0);
+  queue->not_empty.notify_all();
+}
 
+FSW_HANDLE fsw_init_session(const fsw_monitor_type type)
+{
+  FSW_HANDLE handle;
   FSW_SESSION *session = new FSW_SESSION{};
 
-  session->handle = handle;
   session->type = type;
 
-  // Store the handle and a mutex to guard access to session instances.
-  sessions[handle] = unique_ptr<FSW_SESSION>(session);
-  session_mutexes[handle] = unique_ptr<mutex>(new mutex);
+  // Handles are assigned sequentially.  Only after wrapping around can a
+  // handle still be in use, in which case it is skipped.
+  for (;;)
+  {
+    handle = ++last_handle;
+
+    if (handle == FSW_HANDLE(FSW_INVALID_HANDLE)) continue;
+
+    FSW_SESSION_SHARD & shard = get_session_shard(handle);
+    std::lock_guard<std::mutex> session_lock(shard.shard_mutex);
 
-  return handle;
+    if (shard.sessions.find(handle) != shard.sessions.end()) continue;
+
+    session->handle = handle;
+    shard.sessions[handle] = unique_ptr<FSW_SESSION>(session);
+
+    return handle;
+  }
 }
 
-int create_monitor(const FSW_HANDLE handle, const fsw_monitor_type type)
+int create_monitor(FSW_SESSION * session, const fsw_monitor_type type)
 {
   try
   {
-    FSW_SESSION * session = get_session(handle);
-
     // Check sufficient data is present to build a monitor.
-    if (!session->callback)
+    if (!session->callback && !session->queue)
       return fsw_set_last_error(int(FSW_ERR_CALLBACK_NOT_SET));
 
     if (session->monitor)
@@ -159,11 +340,26 @@ int create_monitor(const FSW_HANDLE handle, const fsw_monitor_type type)
     if (!session->paths.size())
       return fsw_set_last_error(int(FSW_ERR_PATHS_NOT_SET));
 
-    FSW_HANDLE * handle_ptr = new FSW_HANDLE(session->handle);
-    monitor * current_monitor = monitor::create_monitor(type,
-                                                        session->paths,
-                                                        libfsw_cpp_callback_proxy,
-                                                        handle_ptr);
+    monitor * current_monitor;
+
+    // Sessions started with fsw_start_monitor_async() have no callback: the
+    // batches are queued instead and the monitor context is the queue, which
+    // is owned by the session.
+    if (session->queue)
+    {
+      current_monitor = monitor::create_monitor(type,
+                                                session->paths,
+                                                libfsw_cpp_queue_proxy,
+                                                session->queue.get());
+    }
+    else
+    {
+      current_monitor = monitor::create_monitor(type,
+                                                session->paths,
+                                                libfsw_cpp_callback_proxy,
+                                                session);
+    }
+
     session->monitor = current_monitor;
   }
   catch (libfsw_exception ex)
@@ -185,7 +381,7 @@ int fsw_add_path(const FSW_HANDLE handle, const char * path)
 
   try
   {
-    std::lock_guard<std::mutex> session_lock(session_mutex);
+    std::lock_guard<std::mutex> session_lock(get_session_mutex(handle));
     FSW_SESSION * session = get_session(handle);
 
     session->paths.push_back(path);
@@ -205,7 +401,7 @@ int fsw_set_callback(const FSW_HANDLE handle, const FSW_CEVENT_CALLBACK callback
 
   try
   {
-    std::lock_guard<std::mutex> session_lock(session_mutex);
+    std::lock_guard<std::mutex> session_lock(get_session_mutex(handle));
     FSW_SESSION * session = get_session(handle);
 
     session->callback = callback;
@@ -225,7 +421,7 @@ int fsw_set_latency(const FSW_HANDLE handle, const double latency)
 
   try
   {
-    std::lock_guard<std::mutex> session_lock(session_mutex);
+    std::lock_guard<std::mutex> session_lock(get_session_mutex(handle));
     FSW_SESSION * session = get_session(handle);
 
     session->latency = latency;
@@ -242,7 +438,7 @@ int fsw_set_recursive(const FSW_HANDLE handle, const bool recursive)
 {
   try
   {
-    std::lock_guard<std::mutex> session_lock(session_mutex);
+    std::lock_guard<std::mutex> session_lock(get_session_mutex(handle));
     FSW_SESSION * session = get_session(handle);
 
     session->recursive = recursive;
@@ -260,7 +456,7 @@ int fsw_set_follow_symlinks(const FSW_HANDLE handle,
 {
   try
   {
-    std::lock_guard<std::mutex> session_lock(session_mutex);
+    std::lock_guard<std::mutex> session_lock(get_session_mutex(handle));
     FSW_SESSION * session = get_session(handle);
 
     session->follow_symlinks = follow_symlinks;
@@ -273,12 +469,254 @@ int fsw_set_follow_symlinks(const FSW_HANDLE handle,
   return fsw_set_last_error(FSW_OK);
 }
 
+int fsw_set_coalesce_events(const FSW_HANDLE handle, const bool coalesce)
+{
+  try
+  {
+    std::lock_guard<std::mutex> session_lock(get_session_mutex(handle));
+    FSW_SESSION * session = get_session(handle);
+
+    session->coalesce_events = coalesce;
+  }
+  catch (int error)
+  {
+    return fsw_set_last_error(error);
+  }
+
+  return fsw_set_last_error(FSW_OK);
+}
+
+int fsw_set_enrich_events(const FSW_HANDLE handle, const bool enrich)
+{
+  try
+  {
+    std::lock_guard<std::mutex> session_lock(get_session_mutex(handle));
+    FSW_SESSION * session = get_session(handle);
+
+    session->enrich_events = enrich;
+  }
+  catch (int error)
+  {
+    return fsw_set_last_error(error);
+  }
+
+  return fsw_set_last_error(FSW_OK);
+}
+
+int fsw_set_history_size(const FSW_HANDLE handle, const size_t history_size)
+{
+  try
+  {
+    std::lock_guard<std::mutex> session_lock(get_session_mutex(handle));
+    FSW_SESSION * session = get_session(handle);
+
+    session->history_size = history_size;
+  }
+  catch (int error)
+  {
+    return fsw_set_last_error(error);
+  }
+
+  return fsw_set_last_error(FSW_OK);
+}
+
+int fsw_set_dispatch_queue_size(const FSW_HANDLE handle,
+                                const size_t queue_size)
+{
+  try
+  {
+    std::lock_guard<std::mutex> session_lock(get_session_mutex(handle));
+    FSW_SESSION * session = get_session(handle);
+
+    session->dispatch_queue_size = queue_size;
+  }
+  catch (int error)
+  {
+    return fsw_set_last_error(error);
+  }
+
+  return fsw_set_last_error(FSW_OK);
+}
+
+int fsw_set_backpressure_policy(const FSW_HANDLE handle,
+                                const fsw_backpressure_policy policy)
+{
+  try
+  {
+    std::lock_guard<std::mutex> session_lock(get_session_mutex(handle));
+    FSW_SESSION * session = get_session(handle);
+
+    session->backpressure_policy = policy;
+  }
+  catch (int error)
+  {
+    return fsw_set_last_error(error);
+  }
+
+  return fsw_set_last_error(FSW_OK);
+}
+
+int fsw_set_dispatch_memory_limit(const FSW_HANDLE handle, const size_t bytes)
+{
+  try
+  {
+    std::lock_guard<std::mutex> session_lock(get_session_mutex(handle));
+    FSW_SESSION * session = get_session(handle);
+
+    session->dispatch_memory_limit = bytes;
+  }
+  catch (int error)
+  {
+    return fsw_set_last_error(error);
+  }
+
+  return fsw_set_last_error(FSW_OK);
+}
+
+int fsw_set_debounce(const FSW_HANDLE handle, const double debounce)
+{
+  if (debounce < 0)
+    return fsw_set_last_error(int(FSW_ERR_INVALID_DEBOUNCE));
+
+  try
+  {
+    std::lock_guard<std::mutex> session_lock(get_session_mutex(handle));
+    FSW_SESSION * session = get_session(handle);
+
+    session->debounce = debounce;
+  }
+  catch (int error)
+  {
+    return fsw_set_last_error(error);
+  }
+
+  return fsw_set_last_error(FSW_OK);
+}
+
+int fsw_set_throttle(const FSW_HANDLE handle, const double throttle)
+{
+  if (throttle < 0)
+    return fsw_set_last_error(int(FSW_ERR_INVALID_DEBOUNCE));
+
+  try
+  {
+    std::lock_guard<std::mutex> session_lock(get_session_mutex(handle));
+    FSW_SESSION * session = get_session(handle);
+
+    session->throttle = throttle;
+  }
+  catch (int error)
+  {
+    return fsw_set_last_error(error);
+  }
+
+  return fsw_set_last_error(FSW_OK);
+}
+
+int fsw_set_settle_time(const FSW_HANDLE handle, const double settle_time)
+{
+  if (settle_time < 0)
+    return fsw_set_last_error(int(FSW_ERR_INVALID_DEBOUNCE));
+
+  try
+  {
+    std::lock_guard<std::mutex> session_lock(get_session_mutex(handle));
+    FSW_SESSION * session = get_session(handle);
+
+    session->settle_time = settle_time;
+  }
+  catch (int error)
+  {
+    return fsw_set_last_error(error);
+  }
+
+  return fsw_set_last_error(FSW_OK);
+}
+
+int fsw_set_debounce_depth(const FSW_HANDLE handle, const unsigned int debounce_depth)
+{
+  try
+  {
+    std::lock_guard<std::mutex> session_lock(get_session_mutex(handle));
+    FSW_SESSION * session = get_session(handle);
+
+    session->debounce_depth = debounce_depth;
+  }
+  catch (int error)
+  {
+    return fsw_set_last_error(error);
+  }
+
+  return fsw_set_last_error(FSW_OK);
+}
+
+int fsw_replay_events(const FSW_HANDLE handle, const uint64_t from_sequence)
+{
+  try
+  {
+    unique_lock<mutex> session_lock(get_session_mutex(handle));
+    FSW_SESSION * session = get_session(handle);
+
+    if (!session->monitor || !session->running.load(memory_order_acquire))
+      return fsw_set_last_error(int(FSW_ERR_UNKNOWN_MONITOR));
+
+    // The events are delivered to the callback, which may call back into
+    // the library: the mutex of the shard is released, and the session is
+    // kept from being destroyed until the replay is done.
+    ++session->monitor_users;
+    session_lock.unlock();
+
+    try
+    {
+      session->monitor->replay_events(from_sequence);
+    }
+    catch (...)
+    {
+      session_lock.lock();
+      --session->monitor_users;
+      throw;
+    }
+
+    session_lock.lock();
+    --session->monitor_users;
+  }
+  catch (int error)
+  {
+    return fsw_set_last_error(error);
+  }
+
+  return fsw_set_last_error(FSW_OK);
+}
+
+int fsw_get_stats(const FSW_HANDLE handle, fsw_monitor_stats * const stats)
+{
+  if (!stats)
+    return fsw_set_last_error(int(FSW_ERR_INVALID_BUFFER));
+
+  try
+  {
+    std::lock_guard<std::mutex> session_lock(get_session_mutex(handle));
+    FSW_SESSION * session = get_session(handle);
+
+    if (!session->monitor)
+      return fsw_set_last_error(int(FSW_ERR_UNKNOWN_MONITOR));
+
+    *stats = session->monitor->get_stats();
+  }
+  catch (int error)
+  {
+    return fsw_set_last_error(error);
+  }
+
+  return fsw_set_last_error(FSW_OK);
+}
+
 int fsw_add_filter(const FSW_HANDLE handle,
                    const fsw_cmonitor_filter filter)
 {
   try
   {
-    std::lock_guard<std::mutex> session_lock(session_mutex);
+    std::lock_guard<std::mutex> session_lock(get_session_mutex(handle));
     FSW_SESSION * session = get_session(handle);
 
     session->filters.push_back({filter.text, filter.type, filter.case_sensitive, filter.extended});
@@ -316,7 +754,7 @@ int fsw_start_monitor(const FSW_HANDLE handle)
 {
   try
   {
-    unique_lock<mutex> session_lock(session_mutex, defer_lock);
+    unique_lock<mutex> session_lock(get_session_mutex(handle), defer_lock);
     session_lock.lock();
 
     FSW_SESSION * session = get_session(handle);
@@ -324,18 +762,27 @@ int fsw_start_monitor(const FSW_HANDLE handle)
     if (session->running.load(memory_order_acquire))
       return fsw_set_last_error(int(FSW_ERR_MONITOR_ALREADY_RUNNING));
 
-    unique_ptr<mutex> & sm = session_mutexes.at(handle);
-    lock_guard<mutex> lock_sm(*sm.get());
+    lock_guard<mutex> lock_sm(session->run_mutex);
 
     session_lock.unlock();
 
     if (!session->monitor)
-      create_monitor(handle, session->type);
+      create_monitor(session, session->type);
 
     session->monitor->set_filters(session->filters);
     session->monitor->set_follow_symlinks(session->follow_symlinks);
     session->monitor->set_latency(session->latency);
     session->monitor->set_recursive(session->recursive);
+    session->monitor->set_coalesce_events(session->coalesce_events);
+    session->monitor->set_enrich_events(session->enrich_events);
+    session->monitor->set_history_size(session->history_size);
+    session->monitor->set_backpressure_policy(session->backpressure_policy);
+    session->monitor->set_dispatch_memory_limit(session->dispatch_memory_limit);
+    session->monitor->set_dispatch_queue_size(session->dispatch_queue_size);
+    session->monitor->set_debounce(session->debounce);
+    session->monitor->set_throttle(session->throttle);
+    session->monitor->set_settle_time(session->settle_time);
+    session->monitor->set_debounce_depth(session->debounce_depth);
     session->running.store(true, memory_order_release);
 
     monitor_start_guard<bool> guard(session->running, false);
@@ -350,31 +797,287 @@ int fsw_start_monitor(const FSW_HANDLE handle)
   return fsw_set_last_error(FSW_OK);
 }
 
-int fsw_destroy_session(const FSW_HANDLE handle)
+int fsw_stop_monitor(const FSW_HANDLE handle)
+{
+  try
+  {
+    std::lock_guard<std::mutex> session_lock(get_session_mutex(handle));
+    FSW_SESSION * session = get_session(handle);
+
+    // running is set once the monitor has been created.
+    if (!session->running.load(memory_order_acquire) || !session->monitor)
+      return fsw_set_last_error(int(FSW_ERR_UNKNOWN_MONITOR));
+
+    session->monitor->stop();
+  }
+  catch (int error)
+  {
+    return fsw_set_last_error(error);
+  }
+
+  return fsw_set_last_error(FSW_OK);
+}
+
+int fsw_start_monitor_async(const FSW_HANDLE handle)
 {
   try
   {
-    std::lock_guard<std::mutex> session_lock(session_mutex);
+    std::lock_guard<std::mutex> session_lock(get_session_mutex(handle));
     FSW_SESSION * session = get_session(handle);
 
-    unique_ptr<mutex> & sm = session_mutexes[handle];
-    lock_guard<mutex> sm_lock(*sm.get());
+    if (session->queue || session->running.load(memory_order_acquire))
+      return fsw_set_last_error(int(FSW_ERR_MONITOR_ALREADY_RUNNING));
 
     if (session->monitor)
+      return fsw_set_last_error(int(FSW_ERR_MONITOR_ALREADY_EXISTS));
+
+    if (!session->paths.size())
+      return fsw_set_last_error(int(FSW_ERR_PATHS_NOT_SET));
+
+    shared_ptr<FSW_EVENT_QUEUE> queue(new FSW_EVENT_QUEUE);
+    session->queue = queue;
+
+    // The monitor thread outlives neither the queue, which it shares, nor
+    // the session, which cannot be destroyed while the monitor is running.
+    thread monitor_thread([handle, queue]
     {
-      void * context = session->monitor->get_context();
+      int error;
 
-      if (!context)
+      try
+      {
+        error = fsw_start_monitor(handle);
+      }
+      catch (libfsw_exception & ex)
       {
-        session->monitor->set_context(nullptr);
-        delete static_cast<FSW_HANDLE *> (context);
+        error = int(ex);
       }
+      catch (...)
+      {
+        error = FSW_ERR_UNKNOWN_ERROR;
+      }
+
+      lock_guard<mutex> queue_lock(queue->queue_mutex);
+      queue->stopped = true;
+      queue->error = error;
+      queue->not_empty.notify_all();
+    });
 
-      delete session->monitor;
+    monitor_thread.detach();
+  }
+  catch (int error)
+  {
+    return fsw_set_last_error(error);
+  }
+  catch (system_error &)
+  {
+    return fsw_set_last_error(int(FSW_ERR_THREAD_FAULT));
+  }
+
+  return fsw_set_last_error(FSW_OK);
+}
+
+/*
+ * Returns the queue of a session started with fsw_start_monitor_async().
+ */
+static shared_ptr<FSW_EVENT_QUEUE> get_session_queue(const FSW_HANDLE handle)
+{
+  std::lock_guard<std::mutex> session_lock(get_session_mutex(handle));
+  shared_ptr<FSW_EVENT_QUEUE> queue = get_session(handle)->queue;
+
+  if (!queue)
+    throw int(FSW_ERR_UNKNOWN_MONITOR);
+
+  return queue;
+}
+
+int fsw_read_events(const FSW_HANDLE handle,
+                    fsw_cevent * const buffer,
+                    const unsigned int max_events,
+                    const int timeout_ms)
+{
+  if (!buffer || !max_events)
+  {
+    fsw_set_last_error(int(FSW_ERR_INVALID_BUFFER));
+    return -1;
+  }
+
+  shared_ptr<FSW_EVENT_QUEUE> queue;
+
+  try
+  {
+    queue = get_session_queue(handle);
+  }
+  catch (int error)
+  {
+    fsw_set_last_error(error);
+    return -1;
+  }
+
+  unique_lock<mutex> queue_lock(queue->queue_mutex);
+
+  if (queue->leases.size() >= FSW_READ_MAX_LEASES
+      && none_of(queue->leases.begin(),
+                 queue->leases.end(),
+                 [buffer](const unique_ptr<FSW_EVENT_LEASE> &lease)
+                 {
+                   return lease->buffer == buffer;
+                 }))
+  {
+    fsw_set_last_error(int(FSW_ERR_INVALID_BUFFER));
+    return -1;
+  }
+
+  auto readable = [&queue]
+  {
+    return !queue->batches.empty() || queue->stopped;
+  };
+
+  if (timeout_ms < 0)
+    queue->not_empty.wait(queue_lock, readable);
+  else
+    queue->not_empty.wait_for(queue_lock, chrono::milliseconds(timeout_ms), readable);
+
+  if (queue->batches.empty())
+  {
+    if (!queue->stopped)
+    {
+      fsw_set_last_error(FSW_OK);
+      return 0;
+    }
+
+    fsw_set_last_error(queue->error != FSW_OK ? queue->error : int(FSW_ERR_UNKNOWN_MONITOR));
+    return -1;
+  }
+
+  // Reading into a buffer which was not released releases it first.
+  for (auto it = queue->leases.begin(); it != queue->leases.end(); ++it)
+  {
+    if ((*it)->buffer == buffer)
+    {
+      queue->leases.erase(it);
+      break;
+    }
+  }
+
+  unique_ptr<FSW_EVENT_LEASE> lease(new FSW_EVENT_LEASE(buffer));
+  unsigned int read = 0;
+
+  while (read < max_events && !queue->batches.empty())
+  {
+    pair<shared_ptr<const event_batch>, size_t> & front = queue->batches.front();
+    const event_batch & batch = *front.first;
+    const size_t last = min<size_t>(batch.size(), front.second + (max_events - read));
+
+    for (size_t i = front.second; i < last; ++i, ++read)
+    {
+      const compact_event evt = batch[i];
+      const uint32_t mask = evt.get_flags();
+      fsw_cevent & cevt = buffer[read];
+
+      // Paths point into the arena of the batch, which the lease keeps alive.
+      cevt.path = const_cast<char *> (evt.get_path());
+      cevt.evt_time = evt.get_time();
+      cevt.evt_time_ns = evt.get_time_ns();
+      cevt.monotonic_time_ns = evt.get_monotonic_time_ns();
+      cevt.stat = evt.get_stat();
+      cevt.sequence = evt.get_sequence();
+      cevt.flags_num = 0;
+
+      for (uint32_t bit = 1; bit && bit <= mask; bit <<= 1)
+      {
+        if (!(mask & bit)) continue;
+
+        lease->flags.push_back(static_cast<fsw_event_flag> (bit));
+        ++cevt.flags_num;
+      }
     }
 
-    sessions.erase(handle);
-    session_mutexes.erase(handle);
+    lease->batches.push_back(front.first);
+    front.second = last;
+
+    if (last == batch.size()) queue->batches.pop_front();
+  }
+
+  // The flags are stored contiguously once all of them are known, since the
+  // vector may be reallocated while it grows.
+  fsw_event_flag * flags = lease->flags.data();
+
+  for (unsigned int i = 0; i < read; ++i)
+  {
+    buffer[i].flags = buffer[i].flags_num ? flags : nullptr;
+    flags += buffer[i].flags_num;
+  }
+
+  queue->queued_events -= read;
+  queue->leases.push_back(move(lease));
+  queue->not_full.notify_all();
+
+  fsw_set_last_error(FSW_OK);
+
+  return read;
+}
+
+int fsw_release_events(const FSW_HANDLE handle, const fsw_cevent * const buffer)
+{
+  try
+  {
+    shared_ptr<FSW_EVENT_QUEUE> queue = get_session_queue(handle);
+    lock_guard<mutex> queue_lock(queue->queue_mutex);
+
+    for (auto it = queue->leases.begin(); it != queue->leases.end(); ++it)
+    {
+      if ((*it)->buffer == buffer)
+      {
+        queue->leases.erase(it);
+        return fsw_set_last_error(FSW_OK);
+      }
+    }
+  }
+  catch (int error)
+  {
+    return fsw_set_last_error(error);
+  }
+
+  return fsw_set_last_error(int(FSW_ERR_INVALID_BUFFER));
+}
+
+int fsw_retain_events(fsw_cevent const * const * const events)
+{
+  if (!events)
+    return fsw_set_last_error(int(FSW_ERR_INVALID_BUFFER));
+
+  get_cevent_buffer(events)->retained = true;
+
+  return fsw_set_last_error(FSW_OK);
+}
+
+void fsw_free_events(fsw_cevent const * const * const events)
+{
+  if (events) ::free(get_cevent_buffer(events));
+}
+
+int fsw_destroy_session(const FSW_HANDLE handle)
+{
+  try
+  {
+    std::lock_guard<std::mutex> session_lock(get_session_mutex(handle));
+    FSW_SESSION * session = get_session(handle);
+
+    // A running session cannot be destroyed, nor one whose monitor is still
+    // replaying events.
+    unique_lock<mutex> sm_lock(session->run_mutex, try_to_lock);
+
+    if (!sm_lock.owns_lock() || session->monitor_users)
+      return fsw_set_last_error(int(FSW_ERR_MONITOR_ALREADY_RUNNING));
+
+    // The context of the monitor is the session or its queue, which are
+    // owned by the session.
+    if (session->monitor) delete session->monitor;
+
+    ::free(session->cevent_buffer);
+
+    sm_lock.unlock();
+    get_session_shard(handle).sessions.erase(handle);
   }
   catch (int error)
   {
@@ -386,10 +1089,13 @@ int fsw_destroy_session(const FSW_HANDLE handle)
 
 FSW_SESSION * get_session(const FSW_HANDLE handle)
 {
-  if (sessions.find(handle) == sessions.end())
+  FSW_SESSION_SHARD & shard = get_session_shard(handle);
+  auto it = shard.sessions.find(handle);
+
+  if (it == shard.sessions.end())
     throw int(FSW_ERR_SESSION_UNKNOWN);
 
-  return sessions[handle].get();
+  return it->second.get();
 }
 
 int fsw_set_last_error(const int error)
@@ -17,6 +17,7 @@
 #ifndef LIBFSW_H
 #  define LIBFSW_H
 
+#  include <stddef.h>
 #  include "cevent.h"
 #  include "cmonitor.h"
 #  include "cfilter.h"
@@ -43,12 +44,99 @@ extern "C"
   int fsw_set_recursive(const FSW_HANDLE handle, const bool recursive);
   int fsw_set_follow_symlinks(const FSW_HANDLE handle,
                               const bool follow_symlinks);
+  int fsw_set_coalesce_events(const FSW_HANDLE handle, const bool coalesce);
+  int fsw_set_enrich_events(const FSW_HANDLE handle, const bool enrich);
+  int fsw_set_history_size(const FSW_HANDLE handle, const size_t history_size);
+  /*
+   * If queue_size is not 0, the callback is invoked on a separate delivery
+   * thread fed by a queue of at most queue_size batches.
+   */
+  int fsw_set_dispatch_queue_size(const FSW_HANDLE handle,
+                                  const size_t queue_size);
+  /*
+   * Select what happens when the dispatch queue is full or the events it
+   * holds use more than the given number of bytes (0 means no limit).
+   * Batches larger than the memory limit are queued in parts which fit in
+   * it.
+   */
+  int fsw_set_backpressure_policy(const FSW_HANDLE handle,
+                                  const fsw_backpressure_policy policy);
+  int fsw_set_dispatch_memory_limit(const FSW_HANDLE handle, const size_t bytes);
+  /*
+   * Debounce, throttle and settle times are expressed in seconds; 0 disables
+   * them.  If debounce_depth is not 0, events are debounced per subtree of
+   * debounce_depth path components instead of per path.
+   */
+  int fsw_set_debounce(const FSW_HANDLE handle, const double debounce);
+  int fsw_set_throttle(const FSW_HANDLE handle, const double throttle);
+  int fsw_set_settle_time(const FSW_HANDLE handle, const double settle_time);
+  int fsw_set_debounce_depth(const FSW_HANDLE handle,
+                             const unsigned int debounce_depth);
   int fsw_add_filter(const FSW_HANDLE handle, const fsw_cmonitor_filter filter);
   int fsw_start_monitor(const FSW_HANDLE handle);
+  /*
+   * Asks the running monitor of a session to stop: fsw_start_monitor()
+   * returns once the events already received have been delivered.  It can be
+   * called from any thread, including from the callback.
+   */
+  int fsw_stop_monitor(const FSW_HANDLE handle);
+  /*
+   * The events passed to the callback, including their paths and flags, are
+   * only valid until the callback returns, since their memory is reused for
+   * the next batch.  A callback which needs to keep them can retain them
+   * with fsw_retain_events(): the memory is then no longer reused and must be
+   * freed with fsw_free_events().
+   */
+  int fsw_retain_events(fsw_cevent const * const * const events);
+  void fsw_free_events(fsw_cevent const * const * const events);
+  /*
+   * Delivers again to the callback the events of a running monitor whose
+   * sequence number is greater than or equal to from_sequence, provided they
+   * are still retained by the history (see fsw_set_history_size).  If some of
+   * them are no longer available, an event with the Overflow flag is
+   * delivered first.  When called from the callback, the events are
+   * delivered once the callback returns.
+   */
+  int fsw_replay_events(const FSW_HANDLE handle, const uint64_t from_sequence);
+  /*
+   * Copies the runtime statistics of the monitor of a session into stats.
+   * It can be called while the monitor is running.
+   */
+  int fsw_get_stats(const FSW_HANDLE handle, fsw_monitor_stats * const stats);
+  /*
+   * Starts the monitor of a session on a background thread and returns
+   * immediately.  No callback is required: the events are queued until they
+   * are read with fsw_read_events().  When the queue is full the monitor
+   * waits for the reader to catch up.
+   */
+  int fsw_start_monitor_async(const FSW_HANDLE handle);
+  /*
+   * Fills buffer with at most max_events queued events of a session started
+   * with fsw_start_monitor_async(), waiting up to timeout_ms milliseconds for
+   * events to be available (forever if timeout_ms is negative).  Returns the
+   * number of events read, 0 if the timeout expired, or -1 on error, in
+   * which case fsw_last_error() returns the error code.  Once the monitor has
+   * stopped and all its events have been read, -1 is returned.
+   *
+   * The paths and flags of the events are not copied: they remain valid
+   * until the buffer is released with fsw_release_events() or is passed
+   * again to fsw_read_events().  At most 256 buffers may hold unreleased
+   * events at the same time: reading into another buffer then fails with
+   * FSW_ERR_INVALID_BUFFER until one of them is released.
+   */
+  int fsw_read_events(const FSW_HANDLE handle,
+                      fsw_cevent * const buffer,
+                      const unsigned int max_events,
+                      const int timeout_ms);
+  int fsw_release_events(const FSW_HANDLE handle,
+                         const fsw_cevent * const buffer);
+  /*
+   * A session cannot be destroyed while its monitor is running or while
+   * fsw_replay_events() is in progress.
+   */
   int fsw_destroy_session(const FSW_HANDLE handle);
   int fsw_set_last_error(const int error);
   int fsw_last_error();
-  // TODO: implement function to signal a monitor to stop.
   bool fsw_is_verbose();
 
 #  ifdef __cplusplus
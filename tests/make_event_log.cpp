@@ -0,0 +1,105 @@
+/* 
+ * Copyright (C) 2014, Enrico M. Crisostomo
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 3, or (at your option)
+ * any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+/*
+ * make-event-log: writes a synthetic event log for the tests.
+ *
+ *   make-event-log FILE BATCHES EVENTS
+ *
+ * writes BATCHES batches of EVENTS events each into the event log FILE (see
+ * libfsw/c++/event_log.h).  The paths, times and flags of the events are a
+ * function of their index only, so that two logs written with the same
+ * arguments are identical.
+ */
+#ifdef HAVE_CONFIG_H
+#  include "config.h"
+#endif
+#include <iostream>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include "libfsw/c++/event_log.h"
+#include "libfsw/c++/libfsw_exception.h"
+
+using namespace std;
+
+// Arbitrary time of the first event, in nanoseconds since the Epoch.
+static const uint64_t FIRST_EVENT_TIME_NS = 1700000000000000000ULL;
+
+static unsigned long parse_count(const char * value)
+{
+  char * end;
+  const unsigned long count = strtoul(value, &end, 10);
+
+  if (end == value || *end != '\0' || count == 0)
+  {
+    cerr << "Invalid count: " << value << endl;
+    exit(EXIT_FAILURE);
+  }
+
+  return count;
+}
+
+int main(int argc, char ** argv)
+{
+  if (argc != 4)
+  {
+    cerr << "Usage: " << argv[0] << " FILE BATCHES EVENTS" << endl;
+    return EXIT_FAILURE;
+  }
+
+  const unsigned long batches = parse_count(argv[2]);
+  const unsigned long events = parse_count(argv[3]);
+
+  try
+  {
+    fsw::event_log_writer writer(argv[1]);
+    fsw::event_batch batch;
+    char path[128];
+
+    for (unsigned long b = 0; b < batches; ++b)
+    {
+      batch.clear();
+
+      for (unsigned long i = 0; i < events; ++i)
+      {
+        const unsigned long index = b * events + i;
+        const int length = snprintf(path, sizeof (path),
+                                    "/home/user/project/src/module_%lu/file_%lu.cpp",
+                                    index % 37, index);
+
+        // The flags cycle through the 12 lowest bits.
+        batch.add(path,
+                  length,
+                  {FIRST_EVENT_TIME_NS + index * 1000, 0},
+                  1u << (index % 12));
+      }
+
+      if (!writer.write_batch(batch))
+      {
+        perror(argv[1]);
+        return EXIT_FAILURE;
+      }
+    }
+  }
+  catch (fsw::libfsw_exception & ex)
+  {
+    cerr << ex.what() << endl;
+    return EXIT_FAILURE;
+  }
+
+  return EXIT_SUCCESS;
+}
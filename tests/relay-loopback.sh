@@ -0,0 +1,185 @@
+#!/bin/sh
+#
+# Copyright (C) 2014, Enrico M. Crisostomo
+#
+# This program is free software; you can redistribute it and/or modify
+# it under the terms of the GNU General Public License as published by
+# the Free Software Foundation; either version 3, or (at your option)
+# any later version.
+#
+# This program is distributed in the hope that it will be useful,
+# but WITHOUT ANY WARRANTY; without even the implied warranty of
+# MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+# GNU General Public License for more details.
+#
+# You should have received a copy of the GNU General Public License
+# along with this program.  If not, see <http://www.gnu.org/licenses/>.
+#
+# Loopback test of fsw --relay and fsw --aggregate, run by make check:
+#
+#   1. A log of 1,000,000 events is replayed through a relay, and the
+#      events printed by the aggregator must be the events of the log.
+#   2. The same, through a proxy which cuts the connection once a third of
+#      the log has been forwarded: the relay must reconnect and resend the
+#      batches which were not acknowledged, without loss or duplicates.
+#      This step needs python3 and is skipped without it.
+#   3. 300 relays replay a log of 1,000 events at the same time, and the
+#      aggregator must print all their events.
+#
+# FSW and MAKE_EVENT_LOG override the programs under test, and
+# RELAY_TEST_PORT the first of the two local TCP ports used.
+
+FSW=${FSW:-./fsw}
+MAKE_EVENT_LOG=${MAKE_EVENT_LOG:-tests/make-event-log}
+PORT=${RELAY_TEST_PORT:-$((20000 + $$ % 20000))}
+PROXY_PORT=$((PORT + 1))
+TIMEOUT=120
+
+WORK_DIR=$(mktemp -d "${TMPDIR:-/tmp}/fsw-relay-test.XXXXXX") || exit 1
+AGGREGATOR=
+PROXY=
+
+cleanup()
+{
+  [ -n "$AGGREGATOR" ] && kill "$AGGREGATOR" 2>/dev/null
+  [ -n "$PROXY" ] && kill "$PROXY" 2>/dev/null
+  wait 2>/dev/null
+  rm -rf "$WORK_DIR"
+}
+
+trap cleanup EXIT
+trap 'exit 1' HUP INT TERM
+
+fail()
+{
+  echo "FAIL: $*" >&2
+  exit 1
+}
+
+start_aggregator()
+{
+  "$FSW" -n --aggregate="tcp://127.0.0.1:$PORT" > "$WORK_DIR/aggregated" &
+  AGGREGATOR=$!
+}
+
+stop_aggregator()
+{
+  kill "$AGGREGATOR"
+  wait "$AGGREGATOR" 2>/dev/null
+  AGGREGATOR=
+}
+
+# Waits until the aggregator has printed $1 events.
+wait_for_events()
+{
+  elapsed=0
+
+  while [ "$(wc -l < "$WORK_DIR/aggregated")" -lt "$1" ]
+  do
+    [ $elapsed -ge $TIMEOUT ] && fail "$(wc -l < "$WORK_DIR/aggregated") events received out of $1"
+    sleep 1
+    elapsed=$((elapsed + 1))
+  done
+}
+
+# Checks that the aggregator printed the events of the log $1, with their
+# paths prefixed by the name of the relay.
+check_events()
+{
+  "$FSW" -n --replay --replay-speed=0 "$1" > "$WORK_DIR/expected" || fail "cannot replay $1"
+  sed 's/^[^:]*://' "$WORK_DIR/aggregated" > "$WORK_DIR/received"
+  cmp -s "$WORK_DIR/expected" "$WORK_DIR/received" || fail "the events received differ from the events of $1"
+}
+
+"$MAKE_EVENT_LOG" "$WORK_DIR/large.log" 1000 1000 || fail "cannot write the event log"
+"$MAKE_EVENT_LOG" "$WORK_DIR/small.log" 10 100 || fail "cannot write the event log"
+
+echo "Relaying 1000000 events."
+start_aggregator
+"$FSW" --replay --replay-speed=0 --relay="tcp://127.0.0.1:$PORT" "$WORK_DIR/large.log" || fail "the relay failed"
+wait_for_events 1000000
+stop_aggregator
+check_events "$WORK_DIR/large.log"
+
+if command -v python3 > /dev/null 2>&1
+then
+  echo "Relaying 1000000 events through a connection cut once."
+
+  # Forwards the connections to the aggregator, and cuts the first one after
+  # CUT bytes were sent by the relay.
+  python3 - "$PROXY_PORT" "$PORT" 8000000 <<'PROXY' &
+import socket, sys, threading
+
+listen_port, port, cut = int(sys.argv[1]), int(sys.argv[2]), int(sys.argv[3])
+cut_done = threading.Event()
+
+def forward(source, target, cut_after):
+    sent = 0
+    try:
+        while True:
+            data = source.recv(65536)
+            if not data:
+                break
+            sent += len(data)
+            if cut_after and sent > cut_after and not cut_done.is_set():
+                cut_done.set()
+                break
+            target.sendall(data)
+    except OSError:
+        pass
+    for s in (source, target):
+        try:
+            s.shutdown(socket.SHUT_RDWR)
+        except OSError:
+            pass
+
+listener = socket.socket()
+listener.setsockopt(socket.SOL_SOCKET, socket.SO_REUSEADDR, 1)
+listener.bind(('127.0.0.1', listen_port))
+listener.listen()
+
+while True:
+    client, _ = listener.accept()
+    server = socket.create_connection(('127.0.0.1', port))
+    threading.Thread(target=forward, args=(client, server, cut), daemon=True).start()
+    threading.Thread(target=forward, args=(server, client, 0), daemon=True).start()
+PROXY
+  PROXY=$!
+
+  start_aggregator
+  "$FSW" --replay --replay-speed=0 --relay="tcp://127.0.0.1:$PROXY_PORT" "$WORK_DIR/large.log" 2> "$WORK_DIR/relay.err" || fail "the relay failed"
+  grep -q "lost" "$WORK_DIR/relay.err" || fail "the connection was not cut"
+  wait_for_events 1000000
+  stop_aggregator
+  check_events "$WORK_DIR/large.log"
+
+  kill "$PROXY"
+  wait "$PROXY" 2>/dev/null
+  PROXY=
+else
+  echo "python3 not found: skipping the forced disconnection."
+fi
+
+echo "Relaying 1000 events from each of 300 relays."
+start_aggregator
+relays=
+i=0
+
+while [ $i -lt 300 ]
+do
+  "$FSW" --replay --replay-speed=0 --relay="tcp://127.0.0.1:$PORT" "$WORK_DIR/small.log" &
+  relays="$relays $!"
+  i=$((i + 1))
+done
+
+for relay in $relays
+do
+  wait "$relay" || fail "a relay failed"
+done
+
+wait_for_events 300000
+stop_aggregator
+[ "$(wc -l < "$WORK_DIR/aggregated")" -eq 300000 ] || fail "more events than sent were received"
+grep -qv "^[^:]*:/home/user/project/" "$WORK_DIR/aggregated" && fail "unexpected events were received"
+
+echo "PASS"
@@ -0,0 +1,401 @@
+/* 
+ * Copyright (C) 2014, Enrico M. Crisostomo
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 3, or (at your option)
+ * any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+/*
+ * unit-tests: tests of the event pipeline of libfsw, run by make check.
+ *
+ * Every test builds its own objects and checks their behaviour through their
+ * public interface: the ordering, gap reporting, overload and stop paths of
+ * event_dispatcher, event_coalescer, timing_wheel and event_history.  The
+ * failed checks are printed and the program exits with a non-zero status if
+ * any failed.
+ */
+#ifdef HAVE_CONFIG_H
+#  include "config.h"
+#endif
+#include <iostream>
+#include <chrono>
+#include <cstdlib>
+#include <string>
+#include <thread>
+#include <vector>
+#include "libfsw/c++/event_dispatcher.h"
+#include "libfsw/c++/event_coalescer.h"
+#include "libfsw/c++/event_history.h"
+#include "libfsw/c++/timing_wheel.h"
+
+using namespace std;
+using namespace fsw;
+
+static unsigned int failures = 0;
+
+#define CHECK(condition) check((condition), #condition, __LINE__)
+
+static void check(bool condition, const char * text, int line)
+{
+  if (condition) return;
+
+  cerr << "FAIL: " << __FILE__ << ":" << line << ": " << text << endl;
+  ++failures;
+}
+
+static void add_event(event_batch &batch, const string &path, uint32_t flags)
+{
+  batch.add(path, get_event_timestamp(), flags);
+}
+
+static string path_of(unsigned int i)
+{
+  return "/p/" + to_string(i);
+}
+
+/*
+ * Records what a dispatcher delivers: the paths of the events, in order, with
+ * "!" standing for an Overflow event.
+ */
+class delivery_log
+{
+public:
+  explicit delivery_log(unsigned int delay_ms = 0) : delay_ms(delay_ms)
+  {
+  }
+
+  event_dispatcher::delivery_function function()
+  {
+    return [this](event_batch &batch)
+    {
+      for (size_t i = 0; i < batch.size(); ++i)
+      {
+        if (batch.get_flags()[i] & fsw_event_flag::Overflow) paths.push_back("!");
+        else paths.push_back(batch.get_path(i));
+      }
+
+      bytes.push_back(batch.get_memory_usage());
+      if (delay_ms) this_thread::sleep_for(chrono::milliseconds(delay_ms));
+    };
+  }
+
+  vector<string> paths;
+  vector<size_t> bytes;
+
+private:
+  unsigned int delay_ms;
+};
+
+static void push_one(event_dispatcher &dispatcher, const string &path)
+{
+  event_batch batch;
+  add_event(batch, path, fsw_event_flag::Updated);
+  dispatcher.push(batch);
+}
+
+static void test_dispatcher_order()
+{
+  // A slow delivery thread makes the producer wait for free slots.
+  delivery_log log(1);
+  event_dispatcher dispatcher(2, log.function());
+  dispatcher.start();
+
+  for (unsigned int i = 0; i < 50; ++i) push_one(dispatcher, path_of(i));
+
+  dispatcher.stop();
+
+  bool ordered = log.paths.size() == 50;
+  for (unsigned int i = 0; ordered && i < 50; ++i)
+  {
+    ordered = log.paths[i] == path_of(i);
+  }
+
+  const dispatch_stats stats = dispatcher.get_stats();
+  CHECK(ordered);
+  CHECK(stats.batches == 50);
+  CHECK(stats.events == 50);
+  CHECK(stats.stalls > 0);
+  CHECK(stats.depth == 0);
+  CHECK(stats.dropped_batches == 0);
+}
+
+static void test_dispatcher_stop_drains()
+{
+  // The batches queued before the delivery thread starts are delivered by
+  // stop().
+  delivery_log log;
+  event_dispatcher dispatcher(4, log.function());
+
+  for (unsigned int i = 0; i < 4; ++i) push_one(dispatcher, path_of(i));
+
+  dispatcher.start();
+  dispatcher.stop();
+
+  CHECK(log.paths == vector<string>({"/p/0", "/p/1", "/p/2", "/p/3"}));
+  CHECK(dispatcher.get_stats().depth == 0);
+}
+
+static void test_dispatcher_drop_newest()
+{
+  // The discarded batches are reported after the batches queued before
+  // them, and before the ones queued after them.
+  delivery_log log;
+  event_dispatcher dispatcher(2, log.function());
+  dispatcher.set_policy(backpressure_drop_newest);
+
+  for (unsigned int i = 0; i < 4; ++i) push_one(dispatcher, path_of(i));
+
+  dispatcher.start();
+  dispatcher.stop();
+
+  // The ring accepts batches again once drained.
+  push_one(dispatcher, path_of(4));
+  dispatcher.start();
+  dispatcher.stop();
+
+  const dispatch_stats stats = dispatcher.get_stats();
+  CHECK(log.paths == vector<string>({"/p/0", "/p/1", "!", "/p/4"}));
+  CHECK(stats.dropped_batches == 2);
+  CHECK(stats.dropped_events == 2);
+}
+
+static void test_dispatcher_drop_oldest()
+{
+  // The discarded batches are reported before the oldest batch kept.
+  delivery_log log;
+  event_dispatcher dispatcher(2, log.function());
+  dispatcher.set_policy(backpressure_drop_oldest);
+
+  for (unsigned int i = 0; i < 4; ++i) push_one(dispatcher, path_of(i));
+
+  dispatcher.start();
+  dispatcher.stop();
+
+  const dispatch_stats stats = dispatcher.get_stats();
+  CHECK(log.paths == vector<string>({"!", "/p/2", "/p/3"}));
+  CHECK(stats.dropped_batches == 2);
+  CHECK(stats.dropped_events == 2);
+}
+
+static void test_dispatcher_coalesce()
+{
+  // Once half the ring is used, the queued batches are coalesced into the
+  // new one: no event is lost, so no Overflow is reported.
+  vector<uint32_t> flags;
+  delivery_log log;
+  event_dispatcher::delivery_function record_paths = log.function();
+  event_dispatcher dispatcher(4, [&](event_batch &batch)
+  {
+    flags.insert(flags.end(), batch.get_flags().begin(), batch.get_flags().end());
+    record_paths(batch);
+  });
+  dispatcher.set_policy(backpressure_coalesce);
+
+  event_batch batch;
+  add_event(batch, "/x", fsw_event_flag::Created);
+  dispatcher.push(batch);
+  add_event(batch, "/x", fsw_event_flag::Updated);
+  dispatcher.push(batch);
+  add_event(batch, "/y", fsw_event_flag::Updated);
+  dispatcher.push(batch);
+
+  dispatcher.start();
+  dispatcher.stop();
+
+  const dispatch_stats stats = dispatcher.get_stats();
+  CHECK(log.paths == vector<string>({"/x", "/y"}));
+  CHECK(flags.size() == 2
+        && flags[0] == (fsw_event_flag::Created | fsw_event_flag::Updated));
+  CHECK(stats.coalesced_events == 1);
+  CHECK(stats.dropped_batches == 0);
+}
+
+static void test_dispatcher_memory_limit()
+{
+  // A batch larger than the memory limit is delivered in parts which fit in
+  // it, in order.
+  const size_t limit = 300;
+  delivery_log log;
+  event_dispatcher dispatcher(4, log.function());
+  dispatcher.set_memory_limit(limit);
+  dispatcher.start();
+
+  event_batch batch;
+  for (unsigned int i = 0; i < 100; ++i)
+  {
+    add_event(batch, path_of(i), fsw_event_flag::Updated);
+  }
+
+  dispatcher.push(batch);
+  dispatcher.stop();
+
+  bool ordered = log.paths.size() == 100;
+  for (unsigned int i = 0; ordered && i < 100; ++i)
+  {
+    ordered = log.paths[i] == path_of(i);
+  }
+
+  bool within_limit = log.bytes.size() > 1;
+  for (size_t bytes : log.bytes) within_limit = within_limit && bytes <= limit;
+
+  CHECK(batch.empty());
+  CHECK(ordered);
+  CHECK(within_limit);
+}
+
+static void test_coalescer()
+{
+  event_batch in;
+  add_event(in, "/a", fsw_event_flag::Created);
+  add_event(in, "/b", fsw_event_flag::Updated);
+  add_event(in, "/a", fsw_event_flag::Updated);
+  add_event(in, "/a", fsw_event_flag::Removed);
+  add_event(in, "/a", fsw_event_flag::Created);
+
+  event_coalescer coalescer;
+  event_batch out;
+  coalescer.coalesce(in, out);
+
+  // The events of /a up to its removal are merged at the position of the
+  // first one; the creation which follows the removal is kept apart.
+  CHECK(out.size() == 3);
+
+  if (out.size() == 3)
+  {
+    CHECK(string(out.get_path(0)) == "/a");
+    CHECK(out.get_flags()[0] == (fsw_event_flag::Created
+                                 | fsw_event_flag::Updated
+                                 | fsw_event_flag::Removed));
+    CHECK(out.get_times_ns()[0] == in.get_times_ns()[0]);
+    CHECK(out.get_last_times_ns()[0] == in.get_times_ns()[3]);
+    CHECK(string(out.get_path(1)) == "/b");
+    CHECK(string(out.get_path(2)) == "/a");
+    CHECK(out.get_flags()[2] == fsw_event_flag::Created);
+  }
+
+  const coalescing_stats stats = coalescer.get_stats();
+  CHECK(stats.events_in == 5);
+  CHECK(stats.events_out == 3);
+}
+
+static void test_timing_wheel()
+{
+  const uint64_t tick = 1000;
+  timing_wheel wheel(tick, 0);
+  vector<uint32_t> expired;
+  auto record = [&](uint32_t id)
+  {
+    expired.push_back(id);
+  };
+
+  // Deadlines on every level, and beyond the range of the wheel.
+  const uint64_t range = 1ULL << (timing_wheel::LEVEL_BITS * timing_wheel::LEVELS);
+  wheel.schedule(0, 5 * tick);
+  wheel.schedule(1, 100 * tick);
+  wheel.schedule(2, 5000 * tick);
+  wheel.schedule(3, 3 * range * tick);
+  wheel.schedule(4, 7 * tick);
+  wheel.cancel(4);
+
+  CHECK(wheel.size() == 4);
+  CHECK(!wheel.is_scheduled(4));
+  CHECK(wheel.get_next_wakeup() <= 5 * tick);
+
+  wheel.advance(5 * tick - 1, record);
+  CHECK(expired.empty());
+
+  wheel.advance(5 * tick, record);
+  CHECK(expired == vector<uint32_t>({0}));
+
+  // Rescheduling moves a timer.
+  wheel.schedule(1, 50 * tick);
+  wheel.advance(99 * tick, record);
+  CHECK(expired == vector<uint32_t>({0, 1}));
+
+  wheel.advance(5000 * tick, record);
+  CHECK(expired == vector<uint32_t>({0, 1, 2}));
+  CHECK(wheel.get_next_wakeup() <= 3 * range * tick);
+
+  wheel.advance(3 * range * tick - 1, record);
+  CHECK(expired.size() == 3);
+
+  wheel.advance(3 * range * tick, record);
+  CHECK(expired == vector<uint32_t>({0, 1, 2, 3}));
+  CHECK(wheel.size() == 0);
+  CHECK(wheel.get_next_wakeup() == timing_wheel::NEVER);
+}
+
+static void record_events(event_history &history,
+                          uint64_t first_sequence,
+                          unsigned int count)
+{
+  event_batch batch;
+  for (unsigned int i = 0; i < count; ++i) add_event(batch, "/h", 0);
+  batch.assign_sequences(first_sequence);
+  history.record(batch);
+}
+
+static void test_history()
+{
+  event_batch_pool pool;
+  event_history history(pool);
+  history.set_capacity(10);
+
+  // Nothing is missing before events are dropped.
+  event_batch out;
+  CHECK(history.replay(0, out));
+  CHECK(out.empty());
+
+  record_events(history, 1, 5);
+  CHECK(history.replay(0, out));
+  CHECK(out.size() == 5);
+
+  // Of a batch larger than the history, only the newest events are kept.
+  record_events(history, 6, 20);
+  CHECK(history.get_last_dropped_sequence() == 15);
+
+  out.clear();
+  CHECK(history.replay(16, out));
+  CHECK(out.size() == 10 && out.get_sequences()[0] == 16);
+
+  out.clear();
+  CHECK(!history.replay(15, out));
+  CHECK(out.size() == 10);
+
+  out.clear();
+  CHECK(!history.replay(0, out));
+
+  // Shrinking the history drops the oldest batches.
+  history.set_capacity(5);
+  CHECK(history.get_last_dropped_sequence() == 25);
+}
+
+int main()
+{
+  test_dispatcher_order();
+  test_dispatcher_stop_drains();
+  test_dispatcher_drop_newest();
+  test_dispatcher_drop_oldest();
+  test_dispatcher_coalesce();
+  test_dispatcher_memory_limit();
+  test_coalescer();
+  test_timing_wheel();
+  test_history();
+
+  if (failures)
+  {
+    cerr << failures << " checks failed." << endl;
+    return EXIT_FAILURE;
+  }
+
+  return EXIT_SUCCESS;
+}